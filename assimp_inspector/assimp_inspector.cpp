@@ -12,6 +12,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include "../assimp_wrapper/import_profile.h"
 
 struct NodeMeshBoneIndex
 {
@@ -32,7 +33,6 @@ std::vector<std::string> node_hierarcy_info; //labels for graphs;
 												 //the actual
 												 //information
 
-const aiScene* importScene(const std::string& path);
 void printDotFileGraph(const aiScene* scene, const std::string& outPath);
 void printNodes(const aiNode* node, const std::string& dotName);
 void printDotNode(const std::string& nodeName, const std::string& label);
@@ -44,12 +44,15 @@ int main(int argc, char* argv[])
 	using std::endl;
 	using std::ofstream;
 	
-	if(argc != 3){
-		cout << "Usage: " << argv[0] << " [collada file] [out file]" << endl;
+	ImportPreset preset = IMPORT_DEFAULT;
+	if((argc != 3 && argc != 4) || (argc == 4 && !ImportProfile::parsePreset(argv[3], preset))){
+		cout << "Usage: " << argv[0] << " [collada file] [out file] [default|fastload|fastrender]" << endl;
 		return 0;
 	}
 	
-	const aiScene* scene = importScene(argv[1]);
+	//The graph shows the nodes and meshes Scene would get with this profile
+	ImportProfile profile(preset);
+	const aiScene* scene = profile.import(argv[1]);
 
 	if(!scene){
 		cout << "Couldn't open collada file, " << '\"' << argv[1] << '\"' << endl;
@@ -59,17 +62,6 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-const aiScene* importScene(const std::string& path)
-{
-	const aiScene* assimpScene = 0;
-	assimpScene = aiImportFile( path.c_str(), 
-								aiProcess_CalcTangentSpace       | 
-								aiProcess_Triangulate            |
-								aiProcess_JoinIdenticalVertices  |
-								aiProcess_SortByPType); // aiProcess_FlipUVs
-	return assimpScene;
-}
-
 void printDotFileGraph(const aiScene* scene, const std::string& outPath)
 {
 	using std::endl;
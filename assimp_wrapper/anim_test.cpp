@@ -17,8 +17,13 @@
 #include "png_loader.h"
 #include "glstuff.h"
 #include "scene.h"
+#include "texture_cache.h"
+#include "program_cache.h"
+#include "pack.h"
+#include "profiler.h"
 //#define GL33
 //#define FULLSCREEN
+//#define DUALQUAT
 
 static const int width = 1280;   
 static const int height = 720;
@@ -28,46 +33,77 @@ GLFWwindow* window;
 class SimpleRenderer : public AnimRenderer
 {
 public:
-	SimpleRenderer()
+	SimpleRenderer(Scene& scene)
 	{
-		shader = createShaderProgram();
+#ifdef DUALQUAT
+		vertexPath = "assimp_wrapper/shader_dq.vs";
+#else
+		vertexPath = "assimp_wrapper/shader.vs";
+#endif
+		/* Every mesh range gets a variant for its attribute signature.
+		   Hand them all to the driver at once, so they compile side by
+		   side, and only wait for the two fallbacks declaring every
+		   attribute: the unskinned one, and the one reading all four
+		   influences, which is exact for any range as unused weights
+		   are 0 */
+		ProgramCache& programs = ProgramCache::shared();
+		fallback[0] = programs.program(vertexPath, "assimp_wrapper/shader.fs", "#define NUM_INFLUENCES 0\n");
+		fallback[1] = programs.program(vertexPath, "assimp_wrapper/shader.fs", "");
+		for(size_t i = 0; i < scene.getMeshCount(); ++i)
+			for(int n = 0; n < MeshGLData::NUM_INFLUENCE_RANGES; ++n)
+				if(scene.getMeshGLData(i)->influenceCount[n])
+					variant(scene.getMeshGLData(i), n);
 		projection = perspective(90.0f, 16.0f/9.0f, 1.0f, 100.0f);
 		glEnable(GL_DEPTH_TEST);
 		glViewport(0, 0, width, height);
 		glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
-		std::vector<unsigned int> texData;
-		unsigned int texWidth, texHeight;
-		if(!LoadImagePNG("data/texture.png", texData, texWidth, texHeight)){
-			printf("Couldn't load image texture.png.\n");
-			texWidth = 256;
-			texHeight = 256;
-			texData.resize(texWidth * texHeight);
-			std::fill(texData.begin(), texData.end(), 0xFFFFFFFF);
-		}
-		glGenTextures(1, &texture);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texWidth, texHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texData[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		//Meshes without a material texture get this one, through the
+		//same cache, so it is decoded once however many use it
+		texture = TextureCache::shared().acquire("data/texture.png");
+	}
+
+	~SimpleRenderer()
+	{
+		TextureCache::shared().release(texture);
 	}
 	
 	void draw(int idx)
 	{
-		drawBegin(shader, idx);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		bindUniformSampler(shader, "sampler0", GL_TEXTURE0);
-		int loc = glGetUniformLocation(shader, "projection");
-		if(loc != -1)
-			glUniformMatrix4fv(loc, 1, GL_TRUE, projection.c_ptr());
-
-		drawEnd(idx);
+		//Draw each bone influence range with its own shader variant
+		for(int n = 0; n < MeshGLData::NUM_INFLUENCE_RANGES; ++n){
+			if(!getRangeCount(idx, n)) continue;
+			GLuint shader = ProgramCache::shared().resolve(variant(getMeshGLData(idx), n), fallback[n ? 1 : 0]);
+			drawBegin(shader, idx);
+			if(getMeshGLData(idx)->textures[MeshGLData::TEXTURE_DIFFUSE] == ~0u){
+				bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, TextureCache::shared().texture(texture));
+				bindUniformSampler(shader, "sampler0", GL_TEXTURE0);
+			}
+			int loc = getUniformLocation(shader, "projection");
+			setUniformMatrix4(shader, loc, 1, true, projection.c_ptr());
+
+			drawRange(idx, n);
+		}
 	}
 private:
-	GLuint shader;
-	GLuint texture;
+	//Program drawing range 'influences' of 'mesh', submitted on first use
+	ProgramTicket variant(const MeshGLData* mesh, int influences)
+	{
+		AttribSignature signature = mesh->signature;
+		signature.bonesPerVertex = influences;
+		std::map<unsigned int, ProgramTicket>::iterator it = tickets.find(signature.pack());
+		if(it != tickets.end()) return it->second;
+		ProgramTicket ticket = ProgramCache::shared().submit(vertexPath, "assimp_wrapper/shader.fs",
+															 signature.defines());
+		tickets[signature.pack()] = ticket;
+		return ticket;
+	}
+
+	const char* vertexPath;
+	//Variants by packed AttribSignature
+	std::map<unsigned int, ProgramTicket> tickets;
+	GLuint fallback[2]; //unskinned, all influences
+	unsigned int texture; //TextureCache handle
 	Matrix4f projection;
 };
 	
@@ -130,6 +166,12 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	//Linked programs are kept here between runs
+	ProgramCache::shared().setBinaryDirectory("shader_cache");
+	//Models, textures and shaders built into a pack by packtool, if
+	//there is one. Anything not in it is read from loose files
+	PackFiles::shared().mount("data.pak");
+
 	//Scene scene("data/pandoras_box2.x");
 	//Scene scene("data/test.dae");
 	//Scene scene("data/pandoras_box3.dae");
@@ -153,8 +195,11 @@ int main(int argc, char* argv[])
 			glfwTerminate();
 			return 0;
 		}
+#ifdef DUALQUAT
+		animation->setSkinningMode(SKIN_DUALQUAT);
+#endif
 	
-		AnimRenderer* renderer = new SimpleRenderer;
+		SimpleRenderer* renderer = new SimpleRenderer(scene);
 		for(size_t i = 0; i < scene.getMeshCount(); ++i){
 			animation->addRenderer(renderer, i);
 		}
@@ -162,15 +207,35 @@ int main(int argc, char* argv[])
 
 		while(!glfwWindowShouldClose(window)){
 			glfwPollEvents();
+			//Pick up the shader variants that finished compiling
+			ProgramCache::shared().poll();
 			float t = glfwGetTime();
 			animation->render(t);
 			glfwSwapBuffers(window);
+			PROFILE_FRAME();
 			if(t*32.0f >= 190.0f)
 				glfwSetTime(0.0f);
 		}
+		const GLStateStats& stats = getGLStateStats();
+		printf("GL state calls issued: %lu, skipped: %lu\n", stats.issued, stats.skipped);
+		const TextureCacheStats& textures = TextureCache::shared().getStats();
+		printf("Textures: %lu requested, %lu decoded\n", textures.requests, textures.decodes);
+		const ProgramCacheStats& programs = ProgramCache::shared().getStats();
+		printf("Programs: %lu compiled, %lu loaded from binaries, %lu binaries rejected, %lu failed\n",
+			   programs.compiled, programs.binaries, programs.rejected, programs.failed);
+#ifdef ASSIMP_GL_PROFILE
+		ProfileStats step;
+		if(Profiler::get().getStats("AnimGLData::stepAnimation", step))
+			printf("stepAnimation: %.3f ms average, %.3f ms max\n", step.average, step.max);
+		Profiler::get().exportChromeTrace("profile.json");
+#endif
+		//Drops the fallback texture, before releaseGL() below frees the rest
+		delete renderer;
 	} catch(std::exception& e){
 		printf("Couldn't load file \"%s\"\n", s.c_str());
 	}
+	TextureCache::shared().releaseGL();
+	ProgramCache::shared().releaseGL();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	
@@ -0,0 +1,231 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <stdexcept>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+/* Memory owned by a Scene.
+
+   Arena: bump allocator for data created once at load time and freed
+   together with the scene. Nothing is freed individually, and
+   destructors are never run, so only use it for plain structs.
+
+   Pool<T>: fixed size objects with O(1) create/destroy through a free
+   list. Memory is grabbed in chunks and kept until the pool dies.
+
+   Slab: equally sized, aligned slots in one contiguous buffer, addressed
+   by index. Used for the bone palettes of all animation instances, so
+   they sit next to each other in memory. Growing the slab moves it, so
+   only hold on to slot indices, never to pointers. */
+
+inline void* alignedAlloc(size_t size, size_t alignment)
+{
+	void* p = 0;
+#ifdef WIN32
+	p = _aligned_malloc(size ? size : alignment, alignment);
+	if(!p)
+		throw std::bad_alloc();
+#else
+	if(posix_memalign(&p, alignment, size ? size : alignment) != 0)
+		throw std::bad_alloc();
+#endif
+	return p;
+}
+
+//Only for memory from alignedAlloc()
+inline void alignedFree(void* p)
+{
+#ifdef WIN32
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+struct Arena
+{
+	static const size_t BLOCK_SIZE = 64 * 1024;
+	static const size_t BLOCK_ALIGNMENT = 64;
+
+	Arena() : m_Current(0), m_Used(0), m_Size(0) {}
+	~Arena() { release(); }
+
+	//Raw memory; whatever is built in it must not need a destructor
+	void* allocate(size_t size, size_t alignment = 16)
+	{
+		size_t offset = (m_Used + alignment - 1) & ~(alignment - 1);
+		if(!m_Current || offset + size > m_Size){
+			//Big allocations get a block of their own, so the current
+			//block isn't wasted
+			if(size > BLOCK_SIZE / 4){
+				char* block = (char*)alignedAlloc(size, alignment > BLOCK_ALIGNMENT ? alignment : BLOCK_ALIGNMENT);
+				m_Blocks.push_back(block);
+				return block;
+			}
+			m_Current = (char*)alignedAlloc(BLOCK_SIZE, BLOCK_ALIGNMENT);
+			m_Blocks.push_back(m_Current);
+			m_Size = BLOCK_SIZE;
+			offset = 0;
+		}
+		m_Used = offset + size;
+		return m_Current + offset;
+	}
+
+	//Destructors are never run, so only types that don't need one
+	template<typename T> T* create()
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena never runs destructors");
+		return new(allocate(sizeof(T), alignof(T))) T();
+	}
+
+	template<typename T> T* createArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena never runs destructors");
+		T* p = (T*)allocate(sizeof(T) * count, alignof(T));
+		for(size_t i = 0; i < count; ++i)
+			new(p + i) T();
+		return p;
+	}
+
+	//Free everything at once
+	void release()
+	{
+		for(size_t i = 0; i < m_Blocks.size(); ++i)
+			alignedFree(m_Blocks[i]);
+		m_Blocks.clear();
+		m_Current = 0;
+		m_Used = m_Size = 0;
+	}
+
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+	std::vector<char*> m_Blocks;
+	char* m_Current;
+	size_t m_Used;
+	size_t m_Size;
+};
+
+template<typename T, int CHUNK = 64>
+struct Pool
+{
+	Pool() : m_Free(0), m_Live(0) {}
+	//Objects still alive are not destroyed, only their memory is freed
+	~Pool()
+	{
+		for(size_t i = 0; i < m_Chunks.size(); ++i)
+			alignedFree(m_Chunks[i]);
+	}
+
+	T* create()
+	{
+		if(!m_Free) grow();
+		Slot* slot = m_Free;
+		m_Free = slot->next;
+		++m_Live;
+		return new(slot->storage) T();
+	}
+
+	void destroy(T* p)
+	{
+		if(!p) return;
+		p->~T();
+		Slot* slot = reinterpret_cast<Slot*>(p);
+		slot->next = m_Free;
+		m_Free = slot;
+		--m_Live;
+	}
+
+	size_t size() const { return m_Live; }
+
+private:
+	union Slot
+	{
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	void grow()
+	{
+		Slot* chunk = (Slot*)alignedAlloc(sizeof(Slot) * CHUNK, alignof(Slot) > 16 ? alignof(Slot) : 16);
+		m_Chunks.push_back(chunk);
+		for(int i = CHUNK - 1; i >= 0; --i){
+			chunk[i].next = m_Free;
+			m_Free = &chunk[i];
+		}
+	}
+
+	Pool(const Pool&);
+	Pool& operator=(const Pool&);
+	std::vector<Slot*> m_Chunks;
+	Slot* m_Free;
+	size_t m_Live;
+};
+
+struct Slab
+{
+	static const size_t ALIGNMENT = 64;
+
+	Slab() : m_Data(0), m_SlotSize(0), m_Capacity(0), m_Count(0) {}
+	~Slab() { alignedFree(m_Data); }
+
+	//Must be called before the first acquire(). Slots are padded to
+	//ALIGNMENT bytes
+	void init(size_t slotSize)
+	{
+		m_SlotSize = (slotSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	unsigned int acquire()
+	{
+		if(!m_FreeSlots.empty()){
+			unsigned int slot = m_FreeSlots.back();
+			m_FreeSlots.pop_back();
+			return slot;
+		}
+		if(m_Count == m_Capacity)
+			grow(m_Capacity ? m_Capacity * 2 : 16);
+		return m_Count++;
+	}
+
+	void release(unsigned int slot)
+	{
+		//Never allocates, capacity is reserved in grow()
+		m_FreeSlots.push_back(slot);
+	}
+
+	void* get(unsigned int slot) const { return m_Data + slot * m_SlotSize; }
+	size_t slotSize() const { return m_SlotSize; }
+	size_t capacity() const { return m_Capacity; }
+
+private:
+	void grow(size_t capacity)
+	{
+		char* data = (char*)alignedAlloc(capacity * m_SlotSize, ALIGNMENT);
+		if(m_Data){
+			std::memcpy(data, m_Data, m_Count * m_SlotSize);
+			alignedFree(m_Data);
+		}
+		m_Data = data;
+		m_Capacity = capacity;
+		m_FreeSlots.reserve(capacity);
+	}
+
+	Slab(const Slab&);
+	Slab& operator=(const Slab&);
+	char* m_Data;
+	size_t m_SlotSize;
+	size_t m_Capacity;
+	size_t m_Count;
+	std::vector<unsigned int> m_FreeSlots;
+};
+
+#endif
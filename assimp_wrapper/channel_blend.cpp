@@ -0,0 +1,183 @@
+#include "channel_blend.h"
+#include <cmath>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void ChannelBatch::resize(unsigned int lanes)
+{
+	m_Lanes = lanes;
+	m_Stride = (lanes + 3) & ~3u;
+	m_Data.assign(NUM_FIELDS * m_Stride, 0.0f);
+	//Identity rotations, so padding lanes stay finite when normalized
+	std::fill(field(ROT0_W), field(ROT0_W) + m_Stride, 1.0f);
+	std::fill(field(ROT1_W), field(ROT1_W) + m_Stride, 1.0f);
+}
+
+/* Angle between nlerp and slerp for keys 'omega' apart (in quaternion
+   space), over the whole interval. Rotation angles are twice that */
+static float nlerpError(float omega)
+{
+	float maxError = 0.0f;
+	for(int i = 1; i < 32; ++i){
+		float t = i / 32.0f;
+		float nlerpAngle = std::atan2(t * std::sin(omega), (1.0f - t) + t * std::cos(omega));
+		maxError = std::max(maxError, 2.0f * std::fabs(nlerpAngle - t * omega));
+	}
+	return maxError;
+}
+
+float nlerpCosThreshold(float maxError)
+{
+	//After the sign flip, keys are at most 90 degrees apart
+	float lo = 0.0f, hi = 1.57079632679f;
+	if(nlerpError(hi) <= maxError) return 0.0f;
+	for(int i = 0; i < 24; ++i){
+		float mid = 0.5f * (lo + hi);
+		if(nlerpError(mid) <= maxError) lo = mid;
+		else hi = mid;
+	}
+	return std::cos(lo);
+}
+
+/* Blend weights for one lane, the same way aiQuaternion::Interpolate
+   picks them. 'cosom' is already made positive */
+static inline void slerpWeights(float cosom, float t, float& s0, float& s1)
+{
+	if((1.0f - cosom) > 0.0001f){
+		float omega = std::acos(cosom);
+		float sinom = std::sin(omega);
+		s0 = std::sin((1.0f - t) * omega) / sinom;
+		s1 = std::sin(t * omega) / sinom;
+	} else {
+		s0 = 1.0f - t;
+		s1 = t;
+	}
+}
+
+#ifdef __SSE2__
+static inline void lerp3(ChannelBatch& b, unsigned int stride, ChannelBatch::Field t,
+						 ChannelBatch::Field v0, ChannelBatch::Field v1, ChannelBatch::Field out)
+{
+	for(unsigned int i = 0; i < stride; i += 4){
+		__m128 f = _mm_loadu_ps(b.field(t) + i);
+		for(int c = 0; c < 3; ++c){
+			__m128 a = _mm_loadu_ps(b.field((ChannelBatch::Field)(v0 + c)) + i);
+			__m128 e = _mm_loadu_ps(b.field((ChannelBatch::Field)(v1 + c)) + i);
+			__m128 r = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(e, a), f));
+			_mm_storeu_ps(b.field((ChannelBatch::Field)(out + c)) + i, r);
+		}
+	}
+}
+
+void blendChannels(ChannelBatch& b, RotationBlend mode, float nlerpCos)
+{
+	typedef ChannelBatch CB;
+	unsigned int stride = b.m_Stride;
+	lerp3(b, stride, CB::POS_T, CB::POS0_X, CB::POS1_X, CB::POS_X);
+	lerp3(b, stride, CB::SCALE_T, CB::SCALE0_X, CB::SCALE1_X, CB::SCALE_X);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 threshold = _mm_set1_ps(mode == BLEND_NLERP ? nlerpCos : 2.0f);
+	for(unsigned int i = 0; i < stride; i += 4){
+		__m128 q0[4], q1[4];
+		for(int c = 0; c < 4; ++c){
+			q0[c] = _mm_loadu_ps(b.field((CB::Field)(CB::ROT0_W + c)) + i);
+			q1[c] = _mm_loadu_ps(b.field((CB::Field)(CB::ROT1_W + c)) + i);
+		}
+		__m128 t = _mm_loadu_ps(b.field(CB::ROT_T) + i);
+		__m128 cosom = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q0[0], q1[0]), _mm_mul_ps(q0[1], q1[1])),
+								  _mm_add_ps(_mm_mul_ps(q0[2], q1[2]), _mm_mul_ps(q0[3], q1[3])));
+		//Take the short way around: flip the end key's sign
+		__m128 sign = _mm_and_ps(_mm_cmplt_ps(cosom, zero), _mm_set1_ps(-0.0f));
+		cosom = _mm_xor_ps(cosom, sign);
+		for(int c = 0; c < 4; ++c)
+			q1[c] = _mm_xor_ps(q1[c], sign);
+
+		//Linear weights, replaced by slerp weights for the lanes that
+		//need them
+		__m128 s0 = _mm_sub_ps(one, t);
+		__m128 s1 = t;
+		int slerpLanes = _mm_movemask_ps(_mm_cmplt_ps(cosom, threshold));
+		if(slerpLanes){
+			float c4[4], t4[4], w0[4], w1[4];
+			_mm_storeu_ps(c4, cosom);
+			_mm_storeu_ps(t4, t);
+			_mm_storeu_ps(w0, s0);
+			_mm_storeu_ps(w1, s1);
+			for(int l = 0; l < 4; ++l)
+				if(slerpLanes & (1 << l))
+					slerpWeights(c4[l], t4[l], w0[l], w1[l]);
+			s0 = _mm_loadu_ps(w0);
+			s1 = _mm_loadu_ps(w1);
+		}
+
+		__m128 r[4];
+		for(int c = 0; c < 4; ++c)
+			r[c] = _mm_add_ps(_mm_mul_ps(q0[c], s0), _mm_mul_ps(q1[c], s1));
+		if(mode == BLEND_NLERP){
+			__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[0], r[0]), _mm_mul_ps(r[1], r[1])),
+									 _mm_add_ps(_mm_mul_ps(r[2], r[2]), _mm_mul_ps(r[3], r[3])));
+			__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+			for(int c = 0; c < 4; ++c)
+				r[c] = _mm_mul_ps(r[c], inv);
+		}
+		for(int c = 0; c < 4; ++c)
+			_mm_storeu_ps(b.field((CB::Field)(CB::ROT_W + c)) + i, r[c]);
+	}
+}
+
+#else
+
+static inline void lerp3(ChannelBatch& b, unsigned int stride, ChannelBatch::Field t,
+						 ChannelBatch::Field v0, ChannelBatch::Field v1, ChannelBatch::Field out)
+{
+	const float* f = b.field(t);
+	for(int c = 0; c < 3; ++c){
+		const float* a = b.field((ChannelBatch::Field)(v0 + c));
+		const float* e = b.field((ChannelBatch::Field)(v1 + c));
+		float* r = b.field((ChannelBatch::Field)(out + c));
+		for(unsigned int i = 0; i < stride; ++i)
+			r[i] = a[i] + (e[i] - a[i]) * f[i];
+	}
+}
+
+void blendChannels(ChannelBatch& b, RotationBlend mode, float nlerpCos)
+{
+	typedef ChannelBatch CB;
+	unsigned int stride = b.m_Stride;
+	lerp3(b, stride, CB::POS_T, CB::POS0_X, CB::POS1_X, CB::POS_X);
+	lerp3(b, stride, CB::SCALE_T, CB::SCALE0_X, CB::SCALE1_X, CB::SCALE_X);
+
+	float threshold = (mode == BLEND_NLERP) ? nlerpCos : 2.0f;
+	for(unsigned int i = 0; i < stride; ++i){
+		float q0[4], q1[4], r[4];
+		for(int c = 0; c < 4; ++c){
+			q0[c] = b.field((CB::Field)(CB::ROT0_W + c))[i];
+			q1[c] = b.field((CB::Field)(CB::ROT1_W + c))[i];
+		}
+		float t = b.field(CB::ROT_T)[i];
+		float cosom = q0[0]*q1[0] + q0[1]*q1[1] + q0[2]*q1[2] + q0[3]*q1[3];
+		float sign = 1.0f;
+		if(cosom < 0.0f){
+			cosom = -cosom;
+			sign = -1.0f;
+		}
+		float s0 = 1.0f - t, s1 = t;
+		if(cosom < threshold)
+			slerpWeights(cosom, t, s0, s1);
+		s1 *= sign;
+		float len2 = 0.0f;
+		for(int c = 0; c < 4; ++c){
+			r[c] = q0[c] * s0 + q1[c] * s1;
+			len2 += r[c] * r[c];
+		}
+		float inv = (mode == BLEND_NLERP) ? 1.0f / std::sqrt(len2) : 1.0f;
+		for(int c = 0; c < 4; ++c)
+			b.field((CB::Field)(CB::ROT_W + c))[i] = r[c] * inv;
+	}
+}
+
+#endif
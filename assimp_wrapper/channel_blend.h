@@ -0,0 +1,57 @@
+#ifndef CHANNEL_BLEND_H
+#define CHANNEL_BLEND_H
+
+#include <vector>
+
+/* Structure-of-arrays interpolation of animation channels.
+
+   AnimGLData gathers the two bracketing keys and the blend factor of
+   every animated node into one lane each, then blendChannels()
+   interpolates all lanes at once, four at a time with SSE. Quaternions
+   are stored w, x, y, z like aiQuaternion. */
+
+enum RotationBlend
+{
+	BLEND_SLERP, //same result as aiQuaternion::Interpolate
+	BLEND_NLERP  //normalized lerp, slerp only for keys far apart
+};
+
+struct ChannelBatch
+{
+	enum Field
+	{
+		//inputs
+		POS_T, POS0_X, POS0_Y, POS0_Z, POS1_X, POS1_Y, POS1_Z,
+		SCALE_T, SCALE0_X, SCALE0_Y, SCALE0_Z, SCALE1_X, SCALE1_Y, SCALE1_Z,
+		ROT_T, ROT0_W, ROT0_X, ROT0_Y, ROT0_Z, ROT1_W, ROT1_X, ROT1_Y, ROT1_Z,
+		//results
+		POS_X, POS_Y, POS_Z,
+		SCALE_X, SCALE_Y, SCALE_Z,
+		ROT_W, ROT_X, ROT_Y, ROT_Z,
+		NUM_FIELDS
+	};
+
+	ChannelBatch() : m_Lanes(0), m_Stride(0) {}
+	//Lanes are padded to a multiple of 4 with identity transforms
+	void resize(unsigned int lanes);
+	unsigned int size() const { return m_Lanes; }
+	float* field(Field f) { return m_Data.data() + f * m_Stride; }
+	const float* field(Field f) const { return m_Data.data() + f * m_Stride; }
+
+private:
+	friend void blendChannels(ChannelBatch& batch, RotationBlend mode, float nlerpCos);
+	unsigned int m_Lanes;
+	unsigned int m_Stride;
+	std::vector<float> m_Data;
+};
+
+/* Cosine of the largest angle between two rotation keys for which the
+   normalized lerp stays within 'maxError' radians of slerp. Keys further
+   apart are slerped by blendChannels() in BLEND_NLERP mode */
+float nlerpCosThreshold(float maxError);
+
+/* Fill the result fields of every lane. 'nlerpCos' is only used with
+   BLEND_NLERP, see nlerpCosThreshold() */
+void blendChannels(ChannelBatch& batch, RotationBlend mode, float nlerpCos);
+
+#endif
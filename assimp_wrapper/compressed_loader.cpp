@@ -0,0 +1,221 @@
+#include "compressed_loader.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include "glstuff.h"
+#include "pack.h"
+
+//Bytes per 4x4 block, or 0 for formats we don't load
+static unsigned int blockBytes(GLenum format)
+{
+	switch(format){
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return 16;
+	}
+	return 0;
+}
+
+static size_t levelSize(GLenum format, unsigned int width, unsigned int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+static bool readFile(const std::string& name, std::vector<unsigned char>& data)
+{
+	const char* packed;
+	size_t packedSize;
+	std::vector<char> buffer;
+	if(PackFiles::shared().read(name, packed, packedSize, buffer)){
+		data.assign(packed, packed + packedSize);
+		return packedSize > 0;
+	}
+	FILE* fp = fopen(name.c_str(), "rb");
+	if(!fp) return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	bool ok = size > 0;
+	if(ok){
+		data.resize(size);
+		ok = fread(&data[0], 1, size, fp) == (size_t)size;
+	}
+	fclose(fp);
+	return ok;
+}
+
+static unsigned int readU32(const unsigned char* p, bool swap = false)
+{
+	if(swap)
+		return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+	return ((unsigned int)p[3] << 24) | ((unsigned int)p[2] << 16) | ((unsigned int)p[1] << 8) | p[0];
+}
+
+static unsigned int fourCC(const char* code)
+{
+	return readU32((const unsigned char*)code);
+}
+
+/* Cut the chain at the first level that is missing or runs past the
+   end of the file. Fails if not even the top level is there */
+static bool addLevels(CompressedImage& image, size_t offset, unsigned int count)
+{
+	unsigned int w = image.width, h = image.height;
+	image.levels.clear();
+	for(unsigned int i = 0; i < count; ++i){
+		CompressedLevel level = { w, h, offset, levelSize(image.format, w, h) };
+		if(level.offset + level.size > image.data.size()) break;
+		image.levels.push_back(level);
+		offset += level.size;
+		if(w == 1 && h == 1) break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	return !image.levels.empty();
+}
+
+bool LoadImageDDS(const std::string& name, CompressedImage& image)
+{
+	enum { DDPF_FOURCC = 0x4, DDSD_MIPMAPCOUNT = 0x20000, HEADER = 128, DX10_HEADER = 20 };
+	std::vector<unsigned char>& data = image.data;
+	if(!readFile(name, data) || data.size() < HEADER || memcmp(&data[0], "DDS ", 4))
+		return false;
+	//The header follows the magic, see DDS_HEADER and DDS_PIXELFORMAT
+	const unsigned char* header = &data[4];
+	unsigned int flags = readU32(header + 4);
+	image.height = readU32(header + 8);
+	image.width = readU32(header + 12);
+	unsigned int depth = readU32(header + 20);
+	unsigned int mipCount = (flags & DDSD_MIPMAPCOUNT) ? readU32(header + 24) : 1;
+	unsigned int pixelFlags = readU32(header + 76);
+	unsigned int code = readU32(header + 80);
+	unsigned int caps2 = readU32(header + 108);
+	if(!(pixelFlags & DDPF_FOURCC) || caps2 != 0 || depth > 1 || !image.width || !image.height)
+		return false;
+
+	size_t offset = HEADER;
+	image.format = 0;
+	if(code == fourCC("DXT1")) image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	else if(code == fourCC("DXT5")) image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	else if(code == fourCC("ATI2") || code == fourCC("BC5U")) image.format = GL_COMPRESSED_RG_RGTC2;
+	else if(code == fourCC("DX10")){
+		if(data.size() < HEADER + DX10_HEADER) return false;
+		const unsigned char* dx10 = &data[HEADER];
+		unsigned int arraySize = readU32(dx10 + 12);
+		if(readU32(dx10 + 4) != 3 || arraySize > 1) //3 is a 2D texture
+			return false;
+		switch(readU32(dx10)){ //DXGI_FORMAT
+		case 71: image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+		case 72: image.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+		case 77: image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+		case 78: image.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+		case 83: image.format = GL_COMPRESSED_RG_RGTC2; break;
+		case 98: image.format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+		case 99: image.format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+		}
+		offset += DX10_HEADER;
+	}
+	if(!image.format) return false;
+	return addLevels(image, offset, mipCount ? mipCount : 1);
+}
+
+bool LoadImageKTX(const std::string& name, CompressedImage& image)
+{
+	static const unsigned char identifier[12] = {
+		0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+	};
+	enum { HEADER = 64 };
+	std::vector<unsigned char>& data = image.data;
+	if(!readFile(name, data) || data.size() < HEADER || memcmp(&data[0], identifier, 12))
+		return false;
+	//Written in the byte order of the tool that made it
+	bool swap = readU32(&data[12]) != 0x04030201;
+	if(swap && readU32(&data[12], true) != 0x04030201)
+		return false;
+	const unsigned char* h = &data[16];
+	unsigned int glType = readU32(h, swap);
+	image.format = readU32(h + 12, swap);
+	image.width = readU32(h + 20, swap);
+	image.height = readU32(h + 24, swap);
+	unsigned int depth = readU32(h + 28, swap);
+	unsigned int arrayElements = readU32(h + 32, swap);
+	unsigned int faces = readU32(h + 36, swap);
+	unsigned int mipCount = readU32(h + 40, swap);
+	unsigned int keyValueBytes = readU32(h + 44, swap);
+	if(glType != 0 || !blockBytes(image.format) || depth > 0 || arrayElements > 0 || faces != 1 ||
+	   !image.width || !image.height)
+		return false;
+
+	/* Every level is prefixed by its size. Compressed levels are a
+	   multiple of 4 bytes, so there is no padding to skip, but the
+	   sizes are checked against the format anyway */
+	size_t offset = HEADER + (size_t)keyValueBytes;
+	unsigned int w = image.width, hgt = image.height;
+	image.levels.clear();
+	for(unsigned int i = 0; i < (mipCount ? mipCount : 1); ++i){
+		if(offset + 4 > data.size()) break;
+		unsigned int size = readU32(&data[offset], swap);
+		offset += 4;
+		CompressedLevel level = { w, hgt, offset, size };
+		if(size != levelSize(image.format, w, hgt) || offset + size > data.size()) break;
+		image.levels.push_back(level);
+		offset += (size + 3) & ~3u;
+		w = w > 1 ? w / 2 : 1;
+		hgt = hgt > 1 ? hgt / 2 : 1;
+	}
+	return !image.levels.empty();
+}
+
+bool LoadImageCompressed(const std::string& name, CompressedImage& image)
+{
+	size_t dot = name.find_last_of('.');
+	if(dot == std::string::npos) return false;
+	std::string ext = name.substr(dot + 1);
+	for(size_t i = 0; i < ext.size(); ++i)
+		ext[i] = tolower(ext[i]);
+	if(ext == "dds") return LoadImageDDS(name, image);
+	if(ext == "ktx") return LoadImageKTX(name, image);
+	return false;
+}
+
+bool isCompressedFormatSupported(GLenum format)
+{
+	switch(format){
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc;
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+	case GL_COMPRESSED_RG_RGTC2:
+		return GLEW_ARB_texture_compression_rgtc;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return GLEW_ARB_texture_compression_bptc;
+	}
+	return false;
+}
+
+bool UploadCompressedImage(const CompressedImage& image, GLuint texture)
+{
+	if(image.levels.empty() || !isCompressedFormatSupported(image.format))
+		return false;
+	bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texture);
+	for(size_t i = 0; i < image.levels.size(); ++i){
+		const CompressedLevel& level = image.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format, level.width, level.height, 0,
+							   level.size, &image.data[level.offset]);
+	}
+	//A chain cut short is still complete this way
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+	return true;
+}
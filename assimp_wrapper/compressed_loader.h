@@ -0,0 +1,44 @@
+#ifndef COMPRESSED_LOADER_H
+#define COMPRESSED_LOADER_H
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+/* Block compressed textures from DDS and KTX (version 1) files.
+
+   Supported are BC1 (DXT1), BC3 (DXT5), BC5 (ATI2/RGTC2) and BC7
+   (BPTC), including their sRGB variants. The blocks are uploaded as they
+   are stored, with glCompressedTexImage2D(), so loading costs little
+   more than reading the file. Cube maps, arrays and volume textures are
+   rejected. */
+
+struct CompressedLevel
+{
+	unsigned int width;
+	unsigned int height;
+	size_t offset; //into CompressedImage::data
+	size_t size;
+};
+
+struct CompressedImage
+{
+	GLenum format; //GL internal format, e.g. GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	unsigned int width;
+	unsigned int height;
+	std::vector<CompressedLevel> levels; //largest first
+	std::vector<unsigned char> data;     //the file, levels point into it
+};
+
+bool LoadImageDDS(const std::string& name, CompressedImage& image);
+bool LoadImageKTX(const std::string& name, CompressedImage& image);
+//Picks the container by the extension, .dds or .ktx
+bool LoadImageCompressed(const std::string& name, CompressedImage& image);
+
+//True if the current GL context can sample 'format'
+bool isCompressedFormatSupported(GLenum format);
+/* Upload every level of 'image' to 'texture', bound on GL_TEXTURE0,
+   and limit GL_TEXTURE_MAX_LEVEL to the levels the file has. Returns
+   false if the context doesn't support the format */
+bool UploadCompressedImage(const CompressedImage& image, GLuint texture);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef DUALQUAT_H
+#define DUALQUAT_H
+
+#include <assimp/types.h>
+#include <cmath>
+
+/* A unit dual quaternion q = real + e*dual describing a rigid
+   transform. Both parts are stored as x, y, z, w so the struct can be
+   uploaded directly as two vec4 uniforms (32 bytes per bone instead of
+   the 64 bytes a 4x4 matrix needs).
+
+   Dual quaternions can not represent scale, so any scale in the bone
+   transform is dropped. The matrix path in AnimGLData::recursiveUpdate
+   drops the animated scale as well. */
+struct DualQuat
+{
+	float real[4];
+	float dual[4];
+};
+
+/* Build a dual quaternion from a rotation and a translation.
+   dual = 0.5 * t * real, where t is the pure quaternion (tx, ty, tz, 0) */
+inline DualQuat dualQuatFromRotationTranslation(const aiQuaternion& rotation, const aiVector3D& translation)
+{
+	DualQuat dq;
+	float rx = rotation.x, ry = rotation.y, rz = rotation.z, rw = rotation.w;
+	float len = std::sqrt(rx*rx + ry*ry + rz*rz + rw*rw);
+	if(len > 0.0f){
+		float inv = 1.0f / len;
+		rx *= inv; ry *= inv; rz *= inv; rw *= inv;
+	}
+	float tx = translation.x, ty = translation.y, tz = translation.z;
+
+	dq.real[0] = rx;
+	dq.real[1] = ry;
+	dq.real[2] = rz;
+	dq.real[3] = rw;
+	dq.dual[0] = 0.5f * ( tx*rw + ty*rz - tz*ry);
+	dq.dual[1] = 0.5f * (-tx*rz + ty*rw + tz*rx);
+	dq.dual[2] = 0.5f * ( tx*ry - ty*rx + tz*rw);
+	dq.dual[3] = 0.5f * (-tx*rx - ty*ry - tz*rz);
+	return dq;
+}
+
+/* Convert the rigid part of an affine matrix to a dual quaternion.
+   The columns of the upper 3x3 are normalized first so a scaled
+   matrix still gives a valid rotation. */
+inline DualQuat dualQuatFromMatrix(const aiMatrix4x4& m)
+{
+	aiMatrix3x3 r(m);
+	for(int c = 0; c < 3; ++c){
+		float len = std::sqrt(r[0][c]*r[0][c] + r[1][c]*r[1][c] + r[2][c]*r[2][c]);
+		if(len > 0.0f){
+			r[0][c] /= len;
+			r[1][c] /= len;
+			r[2][c] /= len;
+		}
+	}
+	aiQuaternion rotation(r);
+	aiVector3D translation(m.a4, m.b4, m.c4);
+	return dualQuatFromRotationTranslation(rotation, translation);
+}
+
+#endif
@@ -1,7 +1,19 @@
 #include "glstuff.h"
+#include "program_cache.h"
+#include "pack.h"
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <set>
 
 std::string readTextFile(const std::string& path)
 {
+	const char* data;
+	size_t size;
+	std::vector<char> buffer;
+	if(PackFiles::shared().read(path, data, size, buffer))
+		return std::string(data, size);
+
 	std::ifstream strm(path.c_str());
 	if(!strm.is_open()) return "";
 
@@ -42,26 +54,78 @@ void printProgramLog(GLuint program)
 
 
 GLuint createShaderProgram()
+{
+	return createShaderProgram("assimp_wrapper/shader.vs", "assimp_wrapper/shader.fs");
+}
+
+GLuint createShaderProgram(const std::string& vertexPath, const std::string& fragmentPath)
+{
+	return createShaderProgram(vertexPath, fragmentPath, "");
+}
+
+//Insert 'defines' right after the #version line, which has to come first
+std::string addShaderDefines(const std::string& src, const std::string& defines)
+{
+	if(defines.empty()) return src;
+	size_t pos = 0;
+	if(src.compare(0, 8, "#version") == 0){
+		pos = src.find('\n');
+		pos = (pos == std::string::npos) ? src.size() : pos + 1;
+	}
+	return src.substr(0, pos) + defines + src.substr(pos);
+}
+
+GLuint createShaderProgram(const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines)
+{
+	return ProgramCache::shared().program(vertexPath, fragmentPath, defines);
+}
+
+GLuint compileShaderProgram(const std::string& vertexSrc, const std::string& fragmentSrc, bool retrievable)
+{
+	GLuint shaders[2];
+	GLuint program = startShaderProgram(vertexSrc, fragmentSrc, retrievable, shaders);
+	finishShaderProgram(program, shaders);
+	return program;
+}
+
+GLuint startShaderProgram(const std::string& vertexSrc, const std::string& fragmentSrc, bool retrievable, GLuint* shaders)
 {
 	GLuint program = glCreateProgram();
 	GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fragmt = glCreateShader(GL_FRAGMENT_SHADER);
 
-	std::string vertexSrc = readTextFile("assimp_wrapper/shader.vs");
-	std::string fragmtSrc = readTextFile("assimp_wrapper/shader.fs");
-
 	const char* str_v = vertexSrc.c_str();
-	const char* str_f = fragmtSrc.c_str();
+	const char* str_f = fragmentSrc.c_str();
 	
 	glShaderSource(vertex, 1, &str_v, 0);
 	glShaderSource(fragmt, 1, &str_f, 0);
 
+	//No status queries here, they would wait for the driver
 	glCompileShader(vertex);
 	glCompileShader(fragmt);
 	glAttachShader(program, vertex);
 	glAttachShader(program, fragmt);
+	if(retrievable)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
+	shaders[0] = vertex;
+	shaders[1] = fragmt;
+	return program;
+}
 
+bool isShaderProgramDone(GLuint program)
+{
+	if(!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+		return true;
+	int done = GL_TRUE;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+bool finishShaderProgram(GLuint program, const GLuint* shaders)
+{
+	GLuint vertex = shaders[0];
+	GLuint fragmt = shaders[1];
 	int vstatus, fstatus, lstatus;
 	glGetShaderiv(vertex, GL_COMPILE_STATUS, &vstatus);
 	printf("Vertex shader compile status: %s\n", (vstatus==GL_TRUE)?"true":"false");
@@ -83,10 +147,306 @@ GLuint createShaderProgram()
 		printf("Program link log: \n");
 		printProgramLog(program);
 	}
-	
-	return program;
+	//The program keeps what it needs
+	glDetachShader(program, vertex);
+	glDetachShader(program, fragmt);
+	glDeleteShader(vertex);
+	glDeleteShader(fragmt);
+	return lstatus == GL_TRUE;
+}
+
+/* Compile one program per bone influence count, with NUM_INFLUENCES
+   defined as 0 to count - 1. programs[n] draws MeshGLData range 'n' */
+void createSkinningPrograms(const std::string& vertexPath, const std::string& fragmentPath, GLuint* programs, int count)
+{
+	for(int i = 0; i < count; ++i){
+		std::string defines = "#define NUM_INFLUENCES " + std::to_string(i) + "\n";
+		programs[i] = createShaderProgram(vertexPath, fragmentPath, defines);
+	}
+}
+
+/****************************************************************************************
+ ********************************* GL state shadow **************************************
+ ****************************************************************************************/
+/* Everything we know about the currently bound GL state. Only state
+   changed through the functions in this file is tracked. */
+static const int MAX_SHADOW_ATTRIBS = 16;
+static const int MAX_SHADOW_TEXTURE_UNITS = 32;
+
+/* Vertex attribute setup and the element buffer are stored in the VAO,
+   so they are tracked per VAO */
+struct VAOShadow
+{
+	GLuint elementBuffer;
+	unsigned int enabled; //bitmask of enabled attribute locations
+	GLuint attribBuffer[MAX_SHADOW_ATTRIBS];
+	int attribSize[MAX_SHADOW_ATTRIBS];
+	GLenum attribType[MAX_SHADOW_ATTRIBS];
+};
+
+struct CStrLess
+{
+	bool operator()(const char* a, const char* b) const { return std::strcmp(a, b) < 0; }
+};
+
+struct ProgramShadow
+{
+	//cached glGetAttribLocation()/glGetUniformLocation() results.
+	//Keys point into g_InternedNames, so a lookup allocates nothing
+	std::map<const char*, int, CStrLess> attribLocations;
+	std::map<const char*, int, CStrLess> uniformLocations;
+	//last value uploaded to each uniform location
+	std::map<int, std::vector<float> > uniforms;
+};
+
+struct GLStateShadow
+{
+	bool valid;
+	GLuint program;
+	GLuint vao;
+	GLuint arrayBuffer;
+	GLenum activeTexture;
+	GLenum textureTarget[MAX_SHADOW_TEXTURE_UNITS];
+	GLuint texture[MAX_SHADOW_TEXTURE_UNITS];
+	std::map<GLuint, VAOShadow> vaos;
+	std::map<GLuint, ProgramShadow> programs;
+	GLStateStats stats;
+};
+
+static GLStateShadow g_State = GLStateShadow();
+
+static VAOShadow& currentVAO()
+{
+	std::map<GLuint, VAOShadow>::iterator it = g_State.vaos.find(g_State.vao);
+	if(it == g_State.vaos.end()){
+		VAOShadow vs;
+		vs.elementBuffer = 0;
+		vs.enabled = 0;
+		std::fill(vs.attribBuffer, vs.attribBuffer + MAX_SHADOW_ATTRIBS, ~0u);
+		std::fill(vs.attribSize, vs.attribSize + MAX_SHADOW_ATTRIBS, 0);
+		std::fill(vs.attribType, vs.attribType + MAX_SHADOW_ATTRIBS, 0);
+		it = g_State.vaos.insert(std::make_pair(g_State.vao, vs)).first;
+	}
+	return it->second;
+}
+
+static void initShadow()
+{
+	if(g_State.valid) return;
+	g_State.valid = true;
+	g_State.program = ~0u;
+	g_State.vao = ~0u;
+	g_State.arrayBuffer = ~0u;
+	g_State.activeTexture = 0;
+	std::fill(g_State.textureTarget, g_State.textureTarget + MAX_SHADOW_TEXTURE_UNITS, 0);
+	std::fill(g_State.texture, g_State.texture + MAX_SHADOW_TEXTURE_UNITS, ~0u);
+	g_State.vaos.clear();
+	//Uniform values are part of the program object and survive
+	//external state changes, so g_State.programs is kept. Deleted
+	//programs are dropped by forgetProgram()
+}
+
+void invalidateGLState()
+{
+	g_State.valid = false;
+}
+
+void forgetProgram(GLuint program)
+{
+	g_State.programs.erase(program);
+	if(g_State.program == program)
+		g_State.program = ~0u;
+}
+
+const GLStateStats& getGLStateStats()
+{
+	return g_State.stats;
+}
+
+void resetGLStateStats()
+{
+	g_State.stats.issued = 0;
+	g_State.stats.skipped = 0;
+}
+
+void useProgram(GLuint program)
+{
+	initShadow();
+	if(g_State.program == program){
+		++g_State.stats.skipped;
+		return;
+	}
+	++g_State.stats.issued;
+	glUseProgram(program);
+	g_State.program = program;
+}
+
+void bindBuffer(GLenum target, GLuint buffer)
+{
+	initShadow();
+	if(target == GL_ELEMENT_ARRAY_BUFFER){
+		VAOShadow& vs = currentVAO();
+		if(vs.elementBuffer == buffer){
+			++g_State.stats.skipped;
+			return;
+		}
+		vs.elementBuffer = buffer;
+	} else if(target == GL_ARRAY_BUFFER){
+		if(g_State.arrayBuffer == buffer){
+			++g_State.stats.skipped;
+			return;
+		}
+		g_State.arrayBuffer = buffer;
+	}
+	++g_State.stats.issued;
+	glBindBuffer(target, buffer);
+}
+
+void bindTexture(GLenum unit, GLenum target, GLuint texture)
+{
+	initShadow();
+	int idx = unit - GL_TEXTURE0;
+	assert(idx >= 0 && idx < MAX_SHADOW_TEXTURE_UNITS);
+	if(g_State.textureTarget[idx] == target && g_State.texture[idx] == texture){
+		++g_State.stats.skipped;
+		return;
+	}
+	if(g_State.activeTexture != unit){
+		++g_State.stats.issued;
+		glActiveTexture(unit);
+		g_State.activeTexture = unit;
+	}
+	++g_State.stats.issued;
+	glBindTexture(target, texture);
+	g_State.textureTarget[idx] = target;
+	g_State.texture[idx] = texture;
+}
+
+static void enableVertexAttrib(int loc, bool enable)
+{
+	VAOShadow& vs = currentVAO();
+	unsigned int bit = 1u << loc;
+	if(((vs.enabled & bit) != 0) == enable){
+		++g_State.stats.skipped;
+		return;
+	}
+	++g_State.stats.issued;
+	if(enable){
+		glEnableVertexAttribArray(loc);
+		vs.enabled |= bit;
+	} else {
+		glDisableVertexAttribArray(loc);
+		vs.enabled &= ~bit;
+	}
+}
+
+//Set up attribute 'loc' to read from 'vbo', unless the VAO already does
+static void vertexAttribPointer(int loc, GLuint vbo, int numComponents, GLenum type)
+{
+	VAOShadow& vs = currentVAO();
+	if(vs.attribBuffer[loc] == vbo && vs.attribSize[loc] == numComponents
+	   && vs.attribType[loc] == type){
+		g_State.stats.skipped += 2; //glBindBuffer and glVertexAttrib*Pointer
+		return;
+	}
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
+	++g_State.stats.issued;
+	if(type == GL_FLOAT)
+		glVertexAttribPointer(loc, numComponents, type, GL_FALSE, 0, 0);
+	else
+		glVertexAttribIPointer(loc, numComponents, type, 0, 0);
+	vs.attribBuffer[loc] = vbo;
+	vs.attribSize[loc] = numComponents;
+	vs.attribType[loc] = type;
+}
+
+static ProgramShadow& programShadow(GLuint program)
+{
+	return g_State.programs[program];
+}
+
+//Names passed to the location caches, kept alive for their keys
+static std::set<std::string> g_InternedNames;
+
+static const char* internName(const char* name)
+{
+	return g_InternedNames.insert(name).first->c_str();
+}
+
+int getAttribLocation(GLuint program, const char* name)
+{
+	std::map<const char*, int, CStrLess>& lut = programShadow(program).attribLocations;
+	std::map<const char*, int, CStrLess>::const_iterator it = lut.find(name);
+	if(it != lut.end()) return it->second;
+	int loc = glGetAttribLocation(program, name);
+	if(loc >= MAX_SHADOW_ATTRIBS){
+		printf("Attribute %s has location %d, only %d are supported.\n", name, loc, MAX_SHADOW_ATTRIBS);
+		loc = -1;
+	}
+	lut[internName(name)] = loc;
+	return loc;
 }
 
+int getUniformLocation(GLuint program, const char* name)
+{
+	std::map<const char*, int, CStrLess>& lut = programShadow(program).uniformLocations;
+	std::map<const char*, int, CStrLess>::const_iterator it = lut.find(name);
+	if(it != lut.end()) return it->second;
+	int loc = glGetUniformLocation(program, name);
+	lut[internName(name)] = loc;
+	return loc;
+}
+
+/* Returns true if 'data' differs from what was last uploaded to 'loc',
+   and remembers the new value */
+static bool uniformChanged(GLuint program, int loc, const float* data, int numFloats)
+{
+	std::vector<float>& cached = programShadow(program).uniforms[loc];
+	if(cached.size() == (size_t)numFloats &&
+	   std::memcmp(&cached[0], data, numFloats * sizeof(float)) == 0){
+		++g_State.stats.skipped;
+		return false;
+	}
+	cached.assign(data, data + numFloats);
+	++g_State.stats.issued;
+	return true;
+}
+
+bool setUniformMatrix4(GLuint program, int loc, int count, bool transpose, const float* data)
+{
+	if(loc == -1) return false;
+	useProgram(program);
+	//Fold the transpose flag into the cached value. Matrices are never
+	//uploaded to the same location with both flags
+	if(!uniformChanged(program, loc, data, count * 16)) return false;
+	glUniformMatrix4fv(loc, count, transpose ? GL_TRUE : GL_FALSE, data);
+	return true;
+}
+
+bool setUniform4fv(GLuint program, int loc, int count, const float* data)
+{
+	if(loc == -1) return false;
+	useProgram(program);
+	if(!uniformChanged(program, loc, data, count * 4)) return false;
+	glUniform4fv(loc, count, data);
+	return true;
+}
+
+void setUniform1i(GLuint program, int loc, int value)
+{
+	if(loc == -1) return;
+	useProgram(program);
+	//Store the int bit pattern in the float cache
+	float f;
+	std::memcpy(&f, &value, sizeof(float));
+	if(uniformChanged(program, loc, &f, 1))
+		glUniform1i(loc, value);
+}
+
+
+/****************************************************************************************
+ ********************************* Buffers and bindings *********************************
+ ****************************************************************************************/
 GLuint createVAO()
 {
 	GLuint vao;
@@ -99,7 +459,7 @@ GLuint createVBO(const aiVector2D* data, unsigned int len)
 	GLuint vbo;
 	if(!len) return ~0u;
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, len * sizeof(aiVector2D),
 				 data, GL_STATIC_DRAW);
 	return vbo;
@@ -110,7 +470,7 @@ GLuint createVBO(const aiVector3D* data, unsigned int len)
 	GLuint vbo;
 	if(!len) return ~0u;
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, len * sizeof(aiVector3D),
 				 data, GL_STATIC_DRAW);
 	return vbo;
@@ -121,7 +481,7 @@ GLuint createVBO(const int* data, unsigned int len)
 	GLuint vbo;
 	if(!len) return ~0u;
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, len * sizeof(int),
 				 data, GL_STATIC_DRAW);
 	return vbo;
@@ -132,7 +492,7 @@ GLuint createVBO(const unsigned int* data, unsigned int len)
 	GLuint vbo;
 	if(!len) return ~0u;
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, len * sizeof(unsigned int),
 				 data, GL_STATIC_DRAW);
 	return vbo;
@@ -143,55 +503,85 @@ GLuint createVBO(const float* data, unsigned int len)
 	GLuint vbo;
 	if(!len) return ~0u;
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, len * sizeof(float),
 				 data, GL_STATIC_DRAW);
 	return vbo;
 }
 
+GLuint createStreamVBO(const float* data, unsigned int len)
+{
+	GLuint vbo;
+	if(!len) return ~0u;
+	glGenBuffers(1, &vbo);
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, len * sizeof(float), data, GL_STREAM_DRAW);
+	return vbo;
+}
+
+void updateVBO(GLuint vbo, const float* data, unsigned int len)
+{
+	if(vbo == ~0u) return;
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, len * sizeof(float), data);
+}
+
+void deleteVBO(GLuint vbo)
+{
+	if(vbo == ~0u) return;
+	glDeleteBuffers(1, &vbo);
+	//The name may be handed out again, so forget what was bound
+	invalidateGLState();
+}
+
 void bindVAO(GLuint vao)
 {
 	if(vao == ~0u){
 		printf("Tried to bind invalid VAO.\n");
 		return;
 	}
+	initShadow();
+	if(g_State.vao == vao){
+		++g_State.stats.skipped;
+		return;
+	}
+	++g_State.stats.issued;
 	glBindVertexArray(vao);
+	g_State.vao = vao;
 }
 
-void bindVBOFloat(GLuint program, const std::string& name, GLuint vbo, int numComponents)
+void bindVBOFloat(GLuint program, const char* name, GLuint vbo, int numComponents)
 {
-	int loc = glGetAttribLocation(program, name.c_str());
+	int loc = getAttribLocation(program, name);
 	if(loc == -1){
-		//printf("Didn't find vbo named %s\n", name.c_str());
+		//printf("Didn't find vbo named %s\n", name);
 		return;
 	}
 	
-	glEnableVertexAttribArray(loc);
 	if(vbo == ~0u){
-		printf("Tried to bind invalid Float VBO with name %s.\n", name.c_str());
-		glDisableVertexAttribArray(loc);
+		printf("Tried to bind invalid Float VBO with name %s.\n", name);
+		enableVertexAttrib(loc, false);
 		return;
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glVertexAttribPointer(loc, numComponents, GL_FLOAT, GL_FALSE, 0, 0);
+	enableVertexAttrib(loc, true);
+	vertexAttribPointer(loc, vbo, numComponents, GL_FLOAT);
 }
 
-void bindVBOUint(GLuint program, const std::string& name, GLuint vbo, int numComponents)
+void bindVBOUint(GLuint program, const char* name, GLuint vbo, int numComponents)
 {
-	int loc = glGetAttribLocation(program, name.c_str());
+	int loc = getAttribLocation(program, name);
 	if(loc == -1){
-		//printf("Didn't find vbo named %s\n", name.c_str());
+		//printf("Didn't find vbo named %s\n", name);
 		return;
 	}
 	
-	glEnableVertexAttribArray(loc);
 	if(vbo == ~0u){
-		printf("Tried to bind invalid Uint VBO with name %s.\n", name.c_str());
-		glDisableVertexAttribArray(loc);
+		printf("Tried to bind invalid Uint VBO with name %s.\n", name);
+		enableVertexAttrib(loc, false);
 		return;
 	}	
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glVertexAttribIPointer(loc, numComponents, GL_UNSIGNED_INT, 0, 0);
+	enableVertexAttrib(loc, true);
+	vertexAttribPointer(loc, vbo, numComponents, GL_UNSIGNED_INT);
 }
 
 void bindVBOIndices(GLuint program, GLuint vbo)
@@ -200,50 +590,74 @@ void bindVBOIndices(GLuint program, GLuint vbo)
 		printf("Tried to bind invalid element index VBO.\n");
 		return;	
 	}
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+	bindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
 }
 
-void bindUniformMatrix4(GLuint program, const std::string& name, const 
+void bindUniformMatrix4(GLuint program, const char* name, const 
 aiMatrix4x4& matrix)
 {
-	int loc = glGetUniformLocation(program, name.c_str());
+	int loc = getUniformLocation(program, name);
 	if(loc == -1){
-		//printf("Didn't find uniform named %s\n", name.c_str());
+		//printf("Didn't find uniform named %s\n", name);
 		return;
 	}
-	glUniformMatrix4fv(loc, 1, GL_TRUE, matrix[0]);
+	setUniformMatrix4(program, loc, 1, true, matrix[0]);
 }
 
-void bindUniformMatrix4Array(GLuint program, const std::string& name, int count, const aiMatrix4x4* matrix)
+bool bindUniformMatrix4Array(GLuint program, const char* name, int count, const aiMatrix4x4* matrix)
 {
-	int loc = glGetUniformLocation(program, name.c_str());
+	int loc = getUniformLocation(program, name);
 	if(loc == -1){
-		//printf("Didn't find uniform named %s\n", name.c_str());
-		return;
+		//printf("Didn't find uniform named %s\n", name);
+		return false;
 	}
-	glUniformMatrix4fv(loc, count, GL_TRUE, (*matrix)[0]);
+	return setUniformMatrix4(program, loc, count, true, (*matrix)[0]);
 }
 
-void bindUniformSampler(GLuint program, const std::string& name, GLuint sampler)
+bool bindUniformVec4Array(GLuint program, const char* name, int count, const float* data)
 {
-	int loc = glGetUniformLocation(program, name.c_str());
+	int loc = getUniformLocation(program, name);
 	if(loc == -1){
-		//printf("Didn't find uniform sampler named %s\n", name.c_str());
+		//printf("Didn't find uniform named %s\n", name);
+		return false;
+	}
+	return setUniform4fv(program, loc, count, data);
+}
+
+void bindUniformSampler(GLuint program, const char* name, GLuint sampler)
+{
+	int loc = getUniformLocation(program, name);
+	if(loc == -1){
+		//printf("Didn't find uniform sampler named %s\n", name);
 		return;
 	}
-	glUniform1i(loc, sampler - GL_TEXTURE0);
+	setUniform1i(program, loc, sampler - GL_TEXTURE0);
 }
 
-void bindVBOEmpty(GLuint program, const std::string& name)
+void bindVBOEmpty(GLuint program, const char* name)
 {
-	int loc = glGetAttribLocation(program, name.c_str());
+	int loc = getAttribLocation(program, name);
 	if(loc == -1){
-		printf("Didn't find vbo named %s\n", name.c_str());
+		printf("Didn't find vbo named %s\n", name);
 		return;
 	}
 	glVertexAttrib4f(loc, 0.0f, 0.0f, 0.0f, 0.0f);
 }
 
+void bindVBOInstanced(GLuint program, const char* name, GLuint vbo, int numComponents, int stride, int offset)
+{
+	int loc = getAttribLocation(program, name);
+	if(loc == -1) return;
+	enableVertexAttrib(loc, true);
+	bindBuffer(GL_ARRAY_BUFFER, vbo);
+	++g_State.stats.issued;
+	glVertexAttribPointer(loc, numComponents, GL_FLOAT, GL_FALSE, stride, (const void*)(size_t)offset);
+	glVertexAttribDivisor(loc, 1);
+	//The shadow only knows tightly packed attributes, so make sure the
+	//next vertexAttribPointer() for this location isn't skipped
+	currentVAO().attribBuffer[loc] = ~0u;
+}
+
 #if 0
 bool checkFrameBuffer(GLuint fbuffer)
 {
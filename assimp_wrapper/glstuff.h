@@ -20,21 +20,79 @@ void printShaderLog(GLuint shader);
 void printProgramLog(GLuint program);
 GLuint createShader(const std::string& path);
 GLuint createShaderProgram();
+GLuint createShaderProgram(const std::string& vertexPath, const std::string& fragmentPath);
+//Programs come from ProgramCache::shared(): built once per sources and
+//defines, shared by every caller, and not to be deleted
+GLuint createShaderProgram(const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines);
+//Compile and link the given sources, ready to use. 'retrievable' lets
+//glGetProgramBinary() read the result
+GLuint compileShaderProgram(const std::string& vertexSrc, const std::string& fragmentSrc, bool retrievable = false);
+/* compileShaderProgram() in two halves. startShaderProgram() submits
+   the work and returns without asking for any status, so the driver can
+   compile in the background; 'shaders' receives the two shader objects.
+   isShaderProgramDone() never blocks where KHR_parallel_shader_compile
+   is available, and is always true elsewhere. finishShaderProgram()
+   prints the logs, frees the shaders and returns the link status,
+   waiting for the driver if it isn't done */
+GLuint startShaderProgram(const std::string& vertexSrc, const std::string& fragmentSrc, bool retrievable, GLuint* shaders);
+bool isShaderProgramDone(GLuint program);
+bool finishShaderProgram(GLuint program, const GLuint* shaders);
+std::string addShaderDefines(const std::string& src, const std::string& defines);
+void createSkinningPrograms(const std::string& vertexPath, const std::string& fragmentPath, GLuint* programs, int count);
 GLuint createVAO();
 GLuint createVBO(const aiVector2D* data, unsigned int len);
 GLuint createVBO(const aiVector3D* data, unsigned int len);
 GLuint createVBO(const int*        data, unsigned int len);
 GLuint createVBO(const unsigned int* data, unsigned int len);
 GLuint createVBO(const float* data, unsigned int len);
+//Vertex buffer rewritten every frame, e.g. morphed positions. 'len'
+//floats, initialized from 'data'
+GLuint createStreamVBO(const float* data, unsigned int len);
+void updateVBO(GLuint vbo, const float* data, unsigned int len);
+void deleteVBO(GLuint vbo);
 void bindVAO(GLuint vao);
-void bindVBOFloat(GLuint program, const std::string& name, GLuint vbo, int numComponents);
-void bindVBOUint(GLuint program, const std::string& name, GLuint vbo, int numComponents);
+void bindVBOFloat(GLuint program, const char* name, GLuint vbo, int numComponents);
+void bindVBOUint(GLuint program, const char* name, GLuint vbo, int numComponents);
 void bindVBOIndices(GLuint program, GLuint vbo);
-void bindUniformMatrix4(GLuint program, const std::string& name, const 
+void bindUniformMatrix4(GLuint program, const char* name, const 
 aiMatrix4x4& matrix);
-void bindUniformMatrix4Array(GLuint program, const std::string& name, int count, const aiMatrix4x4* matrix);
-void bindUniformSampler(GLuint program, const std::string& name, GLuint sampler);
-void bindVBOEmpty(GLuint program, const std::string& name);
+//The array binders return true if the data reached GL, false if the
+//uniform doesn't exist or already held it
+bool bindUniformMatrix4Array(GLuint program, const char* name, int count, const aiMatrix4x4* matrix);
+bool bindUniformVec4Array(GLuint program, const char* name, int count, const float* data);
+void bindUniformSampler(GLuint program, const char* name, GLuint sampler);
+void bindVBOEmpty(GLuint program, const char* name);
+//Per-instance float attribute: 'numComponents' floats at byte 'offset'
+//of every 'stride' byte record in 'vbo', advancing once per instance.
+//The divisor stays with the VAO, so use a VAO of its own for these
+void bindVBOInstanced(GLuint program, const char* name, GLuint vbo, int numComponents, int stride, int offset);
+
+/* GL state shadow. The helpers above and the functions below remember
+   the bound program, VAO, buffers, textures, enabled attributes and
+   uniform values per program, and skip GL calls that wouldn't change
+   anything. Call invalidateGLState() after touching that state with
+   plain GL calls. */
+struct GLStateStats
+{
+	unsigned long issued;  //GL calls passed on to the driver
+	unsigned long skipped; //redundant GL calls that were dropped
+};
+
+void useProgram(GLuint program);
+void bindBuffer(GLenum target, GLuint buffer);
+void bindTexture(GLenum unit, GLenum target, GLuint texture);
+int getAttribLocation(GLuint program, const char* name);
+int getUniformLocation(GLuint program, const char* name);
+//Return true if the value was passed on to GL
+bool setUniformMatrix4(GLuint program, int loc, int count, bool transpose, const float* data);
+bool setUniform4fv(GLuint program, int loc, int count, const float* data);
+void setUniform1i(GLuint program, int loc, int value);
+void invalidateGLState();
+//Drop what the shadow knows about 'program'. Call before deleting it,
+//GL hands the name out again
+void forgetProgram(GLuint program);
+const GLStateStats& getGLStateStats();
+void resetGLStateStats();
 
 
 #endif
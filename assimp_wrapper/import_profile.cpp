@@ -0,0 +1,70 @@
+#include "import_profile.h"
+#include <assimp/config.h>
+#include "scene.h"
+
+//Steps every preset needs, as Scene only draws triangles and skins
+//with a fixed number of bones
+static const unsigned int REQUIRED_STEPS =
+	aiProcess_Triangulate       |
+	aiProcess_SortByPType       |
+	aiProcess_LimitBoneWeights  |
+	aiProcess_SplitByBoneCount;
+
+ImportProfile::ImportProfile(ImportPreset preset)
+{
+	m_Properties = aiCreatePropertyStore();
+	aiSetImportPropertyInteger(m_Properties, AI_CONFIG_PP_LBW_MAX_WEIGHTS, Scene::MAXBONESPERVERTEX);
+	aiSetImportPropertyInteger(m_Properties, AI_CONFIG_PP_SBBC_MAX_BONES, Scene::MAXBONESPERMESH);
+	switch(preset){
+	case IMPORT_FAST_LOAD:
+		m_Flags = REQUIRED_STEPS;
+		break;
+	case IMPORT_FAST_RENDER:
+		m_Flags = REQUIRED_STEPS                     |
+				  aiProcess_CalcTangentSpace         |
+				  aiProcess_JoinIdenticalVertices    |
+				  aiProcess_RemoveRedundantMaterials |
+				  aiProcess_OptimizeMeshes           |
+				  aiProcess_OptimizeGraph            |
+				  aiProcess_ImproveCacheLocality;
+		break;
+	default:
+		m_Flags = REQUIRED_STEPS                  |
+				  aiProcess_CalcTangentSpace      |
+				  aiProcess_JoinIdenticalVertices;
+		break;
+	}
+}
+
+ImportProfile::~ImportProfile()
+{
+	aiReleasePropertyStore(m_Properties);
+}
+
+void ImportProfile::setInteger(const char* name, int value)
+{
+	aiSetImportPropertyInteger(m_Properties, name, value);
+}
+
+void ImportProfile::setFloat(const char* name, float value)
+{
+	aiSetImportPropertyFloat(m_Properties, name, value);
+}
+
+const aiScene* ImportProfile::import(const std::string& path, aiFileIO* io) const
+{
+	return aiImportFileExWithProperties(path.c_str(), m_Flags, io, m_Properties);
+}
+
+bool ImportProfile::parsePreset(const std::string& name, ImportPreset& preset)
+{
+	if(name == "default")
+		preset = IMPORT_DEFAULT;
+	else if(name == "fastload")
+		preset = IMPORT_FAST_LOAD;
+	else if(name == "fastrender")
+		preset = IMPORT_FAST_RENDER;
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,54 @@
+#ifndef IMPORT_PROFILE_H
+#define IMPORT_PROFILE_H
+
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <string>
+
+/* Post-processing presets for ImportProfile.
+   IMPORT_DEFAULT: tangents, triangles, shared vertices, at most
+   Scene::MAXBONESPERVERTEX weights per vertex and Scene::MAXBONESPERMESH
+   bones per mesh, so every mesh can be skinned by shader.vs.
+   IMPORT_FAST_LOAD: only what Scene can't do without. Vertices aren't
+   joined and tangents aren't computed, so meshes are bigger.
+   IMPORT_FAST_RENDER: IMPORT_DEFAULT, then meshes sharing a material
+   are merged, nodes nothing refers to are collapsed, and triangles are
+   reordered for the post-transform vertex cache. Fewer draw calls, at
+   a slower load */
+enum ImportPreset
+{
+	IMPORT_DEFAULT,
+	IMPORT_FAST_LOAD,
+	IMPORT_FAST_RENDER
+};
+
+/* Assimp post-process flags and import properties, e.g.
+   AI_CONFIG_PP_ICL_PTCACHE_SIZE from <assimp/config.h>, for loading a
+   Scene. Start from a preset and adjust */
+struct ImportProfile
+{
+	explicit ImportProfile(ImportPreset preset = IMPORT_DEFAULT);
+	~ImportProfile();
+
+	unsigned int getFlags() const { return m_Flags; }
+	void setFlags(unsigned int flags) { m_Flags = flags; }
+	void addFlags(unsigned int flags) { m_Flags |= flags; }
+	void removeFlags(unsigned int flags) { m_Flags &= ~flags; }
+	void setInteger(const char* name, int value);
+	void setFloat(const char* name, float value);
+
+	//Import 'path', or return 0. Free the result with aiReleaseImport().
+	//Files are opened through 'io', or stdio if 0
+	const aiScene* import(const std::string& path, aiFileIO* io = 0) const;
+
+	//Preset by name: "default", "fastload" or "fastrender"
+	static bool parsePreset(const std::string& name, ImportPreset& preset);
+
+private:
+	ImportProfile(const ImportProfile&);
+	ImportProfile& operator=(const ImportProfile&);
+	unsigned int m_Flags;
+	aiPropertyStore* m_Properties;
+};
+
+#endif
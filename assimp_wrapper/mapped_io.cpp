@@ -0,0 +1,190 @@
+#include "mapped_io.h"
+#include "pack.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* One open file. 'data' is the mapping, a file in a mounted pack, or 0
+   when 'fp' reads the file through stdio. Assimp only sees 'file',
+   whose UserData points back here */
+struct MappedFile
+{
+	MappedFile() : data(0), size(0), pos(0), fp(0), mapped(false)
+	{
+		memset(&file, 0, sizeof(file));
+	}
+	aiFile file;
+	const char* data;
+	size_t size;
+	size_t pos;
+	FILE* fp;
+	bool mapped;              //'data' is our own mapping
+	std::vector<char> buffer; //decompressed pack entry
+};
+
+static MappedFile* mappedFile(aiFile* file)
+{
+	return (MappedFile*)file->UserData;
+}
+
+static size_t mappedRead(aiFile* file, char* buffer, size_t size, size_t count)
+{
+	MappedFile* f = mappedFile(file);
+	if(!size) return 0;
+	//Whole elements only, like fread()
+	size_t n = std::min(count, (f->size - f->pos) / size);
+	memcpy(buffer, f->data + f->pos, n * size);
+	f->pos += n * size;
+	return n;
+}
+
+static size_t mappedWrite(aiFile*, const char*, size_t, size_t)
+{
+	return 0;
+}
+
+static size_t mappedTell(aiFile* file)
+{
+	return mappedFile(file)->pos;
+}
+
+static size_t mappedSize(aiFile* file)
+{
+	return mappedFile(file)->size;
+}
+
+static aiReturn mappedSeek(aiFile* file, size_t offset, aiOrigin origin)
+{
+	MappedFile* f = mappedFile(file);
+	size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? f->pos : f->size;
+	//Offsets are unsigned, so seeking backwards wraps around. Ok as
+	//long as the sum lands inside the file
+	size_t pos = base + offset;
+	if(pos > f->size) return aiReturn_FAILURE;
+	f->pos = pos;
+	return aiReturn_SUCCESS;
+}
+
+static void mappedFlush(aiFile*)
+{
+}
+
+static size_t streamRead(aiFile* file, char* buffer, size_t size, size_t count)
+{
+	return fread(buffer, size, count, mappedFile(file)->fp);
+}
+
+static size_t streamWrite(aiFile* file, const char* buffer, size_t size, size_t count)
+{
+	return fwrite(buffer, size, count, mappedFile(file)->fp);
+}
+
+static size_t streamTell(aiFile* file)
+{
+	return ftell(mappedFile(file)->fp);
+}
+
+static size_t streamSize(aiFile* file)
+{
+	FILE* fp = mappedFile(file)->fp;
+	long pos = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, pos, SEEK_SET);
+	return size < 0 ? 0 : size;
+}
+
+static aiReturn streamSeek(aiFile* file, size_t offset, aiOrigin origin)
+{
+	static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+	return fseek(mappedFile(file)->fp, (long)offset, whence[origin]) ? aiReturn_FAILURE : aiReturn_SUCCESS;
+}
+
+static void streamFlush(aiFile* file)
+{
+	fflush(mappedFile(file)->fp);
+}
+
+MappedFileIO::MappedFileIO()
+{
+	m_IO.OpenProc = open;
+	m_IO.CloseProc = close;
+	m_IO.UserData = (aiUserData)this;
+	m_Stats.mapped = 0;
+	m_Stats.streamed = 0;
+	m_Stats.packed = 0;
+	m_Stats.bytesMapped = 0;
+}
+
+aiFile* MappedFileIO::open(aiFileIO* io, const char* path, const char* mode)
+{
+	MappedFileIO* self = (MappedFileIO*)io->UserData;
+	MappedFile* f = new MappedFile;
+	f->file.UserData = (aiUserData)f;
+	bool readOnly = !strpbrk(mode, "wa+");
+	if(readOnly && PackFiles::shared().read(path, f->data, f->size, f->buffer)){
+		++self->m_Stats.packed;
+	} else {
+		f->data = 0;
+		f->size = 0;
+	}
+#ifndef WIN32
+	int fd = readOnly && !f->data ? ::open(path, O_RDONLY) : -1;
+	struct stat st;
+	if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+		void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED){
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			f->data = (const char*)data;
+			f->size = st.st_size;
+			f->mapped = true;
+			++self->m_Stats.mapped;
+			self->m_Stats.bytesMapped += f->size;
+		}
+	}
+	//The mapping stays valid without the descriptor
+	if(fd >= 0) ::close(fd);
+#endif
+	if(f->data){
+		f->file.ReadProc = mappedRead;
+		f->file.WriteProc = mappedWrite;
+		f->file.TellProc = mappedTell;
+		f->file.FileSizeProc = mappedSize;
+		f->file.SeekProc = mappedSeek;
+		f->file.FlushProc = mappedFlush;
+		return &f->file;
+	}
+	f->fp = fopen(path, mode);
+	if(!f->fp){
+		delete f;
+		return 0;
+	}
+	f->file.ReadProc = streamRead;
+	f->file.WriteProc = streamWrite;
+	f->file.TellProc = streamTell;
+	f->file.FileSizeProc = streamSize;
+	f->file.SeekProc = streamSeek;
+	f->file.FlushProc = streamFlush;
+	++self->m_Stats.streamed;
+	return &f->file;
+}
+
+void MappedFileIO::close(aiFileIO*, aiFile* file)
+{
+	if(!file) return;
+	MappedFile* f = mappedFile(file);
+#ifndef WIN32
+	if(f->mapped)
+		munmap((void*)f->data, f->size);
+#endif
+	if(f->fp)
+		fclose(f->fp);
+	delete f;
+}
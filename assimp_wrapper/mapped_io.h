@@ -0,0 +1,42 @@
+#ifndef MAPPED_IO_H
+#define MAPPED_IO_H
+
+#include <assimp/cfileio.h>
+#include <cstddef>
+
+struct MappedFileIOStats
+{
+	unsigned long mapped;   //files read through mmap()
+	unsigned long streamed; //files read or written through stdio
+	unsigned long packed;   //files read from a mounted pack
+	size_t bytesMapped;
+};
+
+/* aiFileIO for aiImportFileEx() and friends that maps files instead of
+   reading them through stdio, so a large model isn't copied through
+   Assimp's buffered reads. Mappings are advised MADV_SEQUENTIAL, which
+   lets the kernel read ahead and drop the pages behind the parser.
+
+   Assimp opens every file of an import through it, e.g. the .mtl of an
+   OBJ. Files in a pack mounted with PackFiles are read from the pack.
+   Files that can't be mapped (pipes, empty files, anything opened
+   for writing, and every file on Windows) fall back to stdio. Only
+   valid while importing; one instance per thread */
+struct MappedFileIO
+{
+	MappedFileIO();
+
+	aiFileIO* get() { return &m_IO; }
+	const MappedFileIOStats& getStats() const { return m_Stats; }
+
+private:
+	MappedFileIO(const MappedFileIO&);
+	MappedFileIO& operator=(const MappedFileIO&);
+	static aiFile* open(aiFileIO* io, const char* path, const char* mode);
+	static void close(aiFileIO* io, aiFile* file);
+
+	aiFileIO m_IO;
+	MappedFileIOStats m_Stats;
+};
+
+#endif
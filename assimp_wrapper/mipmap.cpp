@@ -0,0 +1,294 @@
+#include "mipmap.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "glstuff.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+/* Linear values are encoded to sRGB through a table indexed by the value
+   scaled to ENCODE_SIZE - 1. 14 bits keep the table error under 0.2 of
+   an 8 bit step, even in the steep part near black */
+static const int ENCODE_BITS = 14;
+static const int ENCODE_SIZE = 1 << ENCODE_BITS;
+
+static float srgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSRGB(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+struct MipTables
+{
+	float decode[256];    //8 bit color to linear
+	float decodeAlpha[256];
+	unsigned char encode[ENCODE_SIZE];
+	float scale[4];       //index scale for r, g, b, a
+	bool srgb;
+
+	explicit MipTables(bool sRGB) : srgb(sRGB)
+	{
+		for(int i = 0; i < 256; ++i){
+			decodeAlpha[i] = i / 255.0f;
+			decode[i] = srgb ? srgbToLinear(i / 255.0f) : i / 255.0f;
+		}
+		for(int i = 0; i < ENCODE_SIZE; ++i)
+			encode[i] = (unsigned char)(linearToSRGB(i / (float)(ENCODE_SIZE - 1)) * 255.0f + 0.5f);
+		float color = srgb ? (float)(ENCODE_SIZE - 1) : 255.0f;
+		scale[0] = scale[1] = scale[2] = color * 0.25f;
+		scale[3] = 255.0f * 0.25f;
+	}
+};
+
+static const MipTables& mipTables(bool srgb)
+{
+	static const MipTables linear(false);
+	static const MipTables gamma(true);
+	return srgb ? gamma : linear;
+}
+
+/* One destination row from two source rows. 'row1' is 'row0' again
+   for the last row of an odd height */
+typedef void (*MipRowFunc)(const unsigned char* row0, const unsigned char* row1, unsigned char* dst,
+						   unsigned int width, const MipTables& t);
+
+static inline void storePixel(unsigned char* dst, const int* v, const MipTables& t)
+{
+	for(int c = 0; c < 3; ++c)
+		dst[c] = t.srgb ? t.encode[v[c]] : (unsigned char)v[c];
+	dst[3] = (unsigned char)v[3];
+}
+
+static void mipRowScalar(const unsigned char* row0, const unsigned char* row1, unsigned char* dst,
+						 unsigned int width, const MipTables& t)
+{
+	for(unsigned int x = 0; x < width; ++x, row0 += 8, row1 += 8, dst += 4){
+		int v[4];
+		for(int c = 0; c < 4; ++c){
+			const float* decode = c == 3 ? t.decodeAlpha : t.decode;
+			float sum = decode[row0[c]] + decode[row0[4 + c]] + decode[row1[c]] + decode[row1[4 + c]];
+			v[c] = (int)(sum * t.scale[c] + 0.5f);
+		}
+		storePixel(dst, v, t);
+	}
+}
+
+#ifdef MATRIX4_SIMD_X86
+__attribute__((target("sse2")))
+static inline __m128 decodePixelSSE(const unsigned char* p, const MipTables& t)
+{
+	return _mm_set_ps(t.decodeAlpha[p[3]], t.decode[p[2]], t.decode[p[1]], t.decode[p[0]]);
+}
+
+/* One pixel per register, the channels side by side */
+__attribute__((target("sse2")))
+static void mipRowSSE(const unsigned char* row0, const unsigned char* row1, unsigned char* dst,
+					  unsigned int width, const MipTables& t)
+{
+	const __m128 scale = _mm_loadu_ps(t.scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for(unsigned int x = 0; x < width; ++x, row0 += 8, row1 += 8, dst += 4){
+		__m128 sum = _mm_add_ps(_mm_add_ps(decodePixelSSE(row0, t), decodePixelSSE(row0 + 4, t)),
+								_mm_add_ps(decodePixelSSE(row1, t), decodePixelSSE(row1 + 4, t)));
+		int v[4];
+		_mm_storeu_si128((__m128i*)v, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), half)));
+		storePixel(dst, v, t);
+	}
+}
+
+/* Without sRGB the average is exact in integers: (sum + 2) / 4 per
+   channel, four destination pixels per iteration */
+__attribute__((target("sse2")))
+static void mipRowLinearSSE(const unsigned char* row0, const unsigned char* row1, unsigned char* dst,
+							unsigned int width, const MipTables& t)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	unsigned int x = 0;
+	for(; x + 4 <= width; x += 4, row0 += 32, row1 += 32, dst += 16){
+		__m128i d[2];
+		for(int i = 0; i < 2; ++i){
+			__m128i a = _mm_loadu_si128((const __m128i*)(row0 + i * 16));
+			__m128i b = _mm_loadu_si128((const __m128i*)(row1 + i * 16));
+			//Columns summed, two source pixels per register
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			//Then the neighbours, leaving one destination pixel in each low half
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			d[i] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+		}
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(d[0], d[1]));
+	}
+	if(x < width)
+		mipRowScalar(row0, row1, dst, width - x, t);
+}
+
+__attribute__((target("avx")))
+static inline __m256 decodePixelsAVX(const unsigned char* p, const MipTables& t)
+{
+	return _mm256_set_ps(t.decodeAlpha[p[11]], t.decode[p[10]], t.decode[p[9]], t.decode[p[8]],
+						 t.decodeAlpha[p[3]], t.decode[p[2]], t.decode[p[1]], t.decode[p[0]]);
+}
+
+/* Two destination pixels per register. The left and right source
+   pixels of each come from two loads 4 bytes apart */
+__attribute__((target("avx")))
+static void mipRowAVX(const unsigned char* row0, const unsigned char* row1, unsigned char* dst,
+					  unsigned int width, const MipTables& t)
+{
+	const __m256 scale = _mm256_set_ps(t.scale[3], t.scale[2], t.scale[1], t.scale[0],
+									   t.scale[3], t.scale[2], t.scale[1], t.scale[0]);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	unsigned int x = 0;
+	for(; x + 2 <= width; x += 2, row0 += 16, row1 += 16, dst += 8){
+		__m256 sum = _mm256_add_ps(_mm256_add_ps(decodePixelsAVX(row0, t), decodePixelsAVX(row0 + 4, t)),
+								   _mm256_add_ps(decodePixelsAVX(row1, t), decodePixelsAVX(row1 + 4, t)));
+		int v[8];
+		_mm256_storeu_si256((__m256i*)v, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(sum, scale), half)));
+		storePixel(dst, v, t);
+		storePixel(dst + 4, v + 4, t);
+	}
+	if(x < width)
+		mipRowSSE(row0, row1, dst, width - x, t);
+}
+#endif
+
+static MipRowFunc mipRowFunc(SimdLevel level, bool srgb)
+{
+#ifdef MATRIX4_SIMD_X86
+	//Integer work, AVX has nothing wider for it
+	if(level != SIMD_SCALAR && !srgb) return mipRowLinearSSE;
+	if(level == SIMD_AVX) return mipRowAVX;
+	if(level == SIMD_SSE) return mipRowSSE;
+#endif
+	return mipRowScalar;
+}
+
+/* Sizes and offsets of every level, and room for all of them */
+static void layoutMipChain(unsigned int width, unsigned int height, MipChain& chain)
+{
+	chain.levels.clear();
+	size_t offset = 0;
+	for(;;){
+		MipLevel level = { width, height, offset };
+		chain.levels.push_back(level);
+		offset += (size_t)width * height * 4;
+		if(width == 1 && height == 1) break;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	chain.data.resize(offset);
+}
+
+struct MipJob
+{
+	const unsigned char* src;
+	unsigned int srcWidth;
+	unsigned int srcHeight;
+	unsigned char* dst;
+	unsigned int dstWidth;
+	MipRowFunc func;
+	const MipTables* tables;
+};
+
+static void mipRows(void* context, size_t begin, size_t end)
+{
+	const MipJob& job = *(const MipJob*)context;
+	size_t srcPitch = (size_t)job.srcWidth * 4;
+	for(size_t y = begin; y < end; ++y){
+		//A level 1 pixel high averages its single row with itself
+		size_t y0 = std::min<size_t>(y * 2, job.srcHeight - 1);
+		size_t y1 = std::min<size_t>(y * 2 + 1, job.srcHeight - 1);
+		unsigned char* dst = job.dst + y * job.dstWidth * 4;
+		if(job.srcWidth == 1){
+			//Same for a level 1 pixel wide: widen it to two source pixels
+			unsigned char row0[8], row1[8];
+			memcpy(row0, job.src + y0 * srcPitch, 4);
+			memcpy(row0 + 4, row0, 4);
+			memcpy(row1, job.src + y1 * srcPitch, 4);
+			memcpy(row1 + 4, row1, 4);
+			job.func(row0, row1, dst, 1, *job.tables);
+		} else {
+			job.func(job.src + y0 * srcPitch, job.src + y1 * srcPitch, dst, job.dstWidth, *job.tables);
+		}
+	}
+}
+
+void buildMipChain(const unsigned char* rgba, unsigned int width, unsigned int height, MipChain& chain,
+				   bool srgb, ThreadPool* pool, SimdLevel simd)
+{
+	PROFILE_SCOPE("buildMipChain");
+	if(!width || !height) return;
+	layoutMipChain(width, height, chain);
+	memcpy(&chain.data[0], rgba, (size_t)width * height * 4);
+	const MipTables& tables = mipTables(srgb);
+	MipRowFunc func = mipRowFunc(simd, srgb);
+	//Levels depend on each other, so only the rows of one level run in
+	//parallel. Chunks of about 64K pixels are worth handing out
+	for(size_t i = 1; i < chain.levels.size(); ++i){
+		const MipLevel& src = chain.levels[i - 1];
+		const MipLevel& dst = chain.levels[i];
+		MipJob job = { &chain.data[src.offset], src.width, src.height, &chain.data[dst.offset],
+					   dst.width, func, &tables };
+		size_t grain = std::max<size_t>(1, 65536 / dst.width);
+		if(pool)
+			pool->parallelFor(dst.height, grain, mipRows, &job);
+		else
+			mipRows(&job, 0, dst.height);
+	}
+}
+
+void buildMipChainReference(const unsigned char* rgba, unsigned int width, unsigned int height,
+							MipChain& chain, bool srgb)
+{
+	if(!width || !height) return;
+	layoutMipChain(width, height, chain);
+	memcpy(&chain.data[0], rgba, (size_t)width * height * 4);
+	for(size_t i = 1; i < chain.levels.size(); ++i){
+		const MipLevel& src = chain.levels[i - 1];
+		const MipLevel& dst = chain.levels[i];
+		const unsigned char* s = &chain.data[src.offset];
+		unsigned char* d = &chain.data[dst.offset];
+		for(unsigned int y = 0; y < dst.height; ++y){
+			for(unsigned int x = 0; x < dst.width; ++x){
+				unsigned int xs[2] = { std::min(x * 2, src.width - 1), std::min(x * 2 + 1, src.width - 1) };
+				unsigned int ys[2] = { std::min(y * 2, src.height - 1), std::min(y * 2 + 1, src.height - 1) };
+				for(int c = 0; c < 4; ++c){
+					float sum = 0.0f;
+					for(int j = 0; j < 2; ++j)
+						for(int k = 0; k < 2; ++k){
+							float v = s[((size_t)ys[j] * src.width + xs[k]) * 4 + c] / 255.0f;
+							sum += (srgb && c < 3) ? srgbToLinear(v) : v;
+						}
+					float avg = sum * 0.25f;
+					if(srgb && c < 3) avg = linearToSRGB(avg);
+					d[((size_t)y * dst.width + x) * 4 + c] = (unsigned char)(avg * 255.0f + 0.5f);
+				}
+			}
+		}
+	}
+}
+
+void uploadMipChain(const MipChain& chain, GLuint texture)
+{
+	if(chain.levels.empty()) return;
+	bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	size_t bytes = 0;
+	for(size_t i = 0; i < chain.levels.size(); ++i){
+		const MipLevel& level = chain.levels[i];
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+					 &chain.data[level.offset]);
+		bytes += (size_t)level.width * level.height * 4;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	PROFILE_COUNT(PROFILE_BYTES_UPLOADED, bytes);
+}
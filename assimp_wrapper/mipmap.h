@@ -0,0 +1,50 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+#include "../include/matrix4_simd.h"
+
+struct ThreadPool;
+
+/* Mip chains for RGBA8 images, built on the CPU, so they need no GL
+   context and can be made gamma-correct.
+
+   Each level is a 2x2 box filter of the one above it, down to 1x1. The
+   last row or column of an odd sized level is dropped, as with
+   glGenerateMipmap(). With sRGB on, color is averaged in linear light
+   and encoded again, so a checkerboard doesn't fade to a too-dark grey;
+   alpha is always linear. */
+
+struct MipLevel
+{
+	unsigned int width;
+	unsigned int height;
+	size_t offset; //into MipChain::data
+};
+
+struct MipChain
+{
+	std::vector<MipLevel> levels; //level 0 is the source image
+	std::vector<unsigned char> data;
+};
+
+/* Build the chain for 'width' x 'height' pixels at 'rgba' (like
+   LoadImagePNG() produces). Rows of a level are split among the threads
+   of 'pool', or run on the calling thread if 'pool' is 0. 'simd' picks
+   the kernel set, by default the best one for the CPU. 'chain' keeps its
+   memory, so reusing one doesn't allocate */
+void buildMipChain(const unsigned char* rgba, unsigned int width, unsigned int height, MipChain& chain,
+				   bool srgb = true, ThreadPool* pool = 0, SimdLevel simd = detectSimdLevel());
+
+/* Same result from plain per-pixel math with pow(). Slow; the reference
+   the kernels are checked against (they may differ by 1) */
+void buildMipChainReference(const unsigned char* rgba, unsigned int width, unsigned int height,
+							MipChain& chain, bool srgb = true);
+
+/* Upload every level of 'chain' to 'texture', bound on GL_TEXTURE0, and
+   set trilinear filtering */
+void uploadMipChain(const MipChain& chain, GLuint texture);
+
+#endif
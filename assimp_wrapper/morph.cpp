@@ -0,0 +1,129 @@
+#include "morph.h"
+#include <algorithm>
+
+void buildMeshMorph(Arena& arena, const aiMesh* mesh, const std::vector<unsigned int>& order,
+					MeshMorph& morph, float epsilon)
+{
+	unsigned int numVertices = order.empty() ? mesh->mNumVertices : order.size();
+	bool normals = mesh->mNormals != 0;
+	morph.targets.clear();
+	morph.defaultWeights.clear();
+	morph.numDeltas = 0;
+	morph.basePositions.resize(numVertices * 3);
+	morph.baseNormals.resize(normals ? numVertices * 3 : 0);
+	for(unsigned int i = 0; i < numVertices; ++i){
+		unsigned int src = order.empty() ? i : order[i];
+		for(int c = 0; c < 3; ++c){
+			morph.basePositions[i * 3 + c] = mesh->mVertices[src][c];
+			if(normals) morph.baseNormals[i * 3 + c] = mesh->mNormals[src][c];
+		}
+	}
+
+	std::vector<unsigned int> vertices;
+	std::vector<unsigned short> deltas;
+	for(unsigned int t = 0; t < mesh->mNumAnimMeshes; ++t){
+		const aiAnimMesh* target = mesh->mAnimMeshes[t];
+		MorphTarget mt;
+		mt.stride = normals ? 6 : 3;
+		vertices.clear();
+		deltas.clear();
+		bool targetNormals = normals && target->mNormals;
+		for(unsigned int i = 0; target->mVertices && i < numVertices; ++i){
+			unsigned int src = order.empty() ? i : order[i];
+			if(src >= target->mNumVertices) continue;
+			aiVector3D dp = target->mVertices[src] - mesh->mVertices[src];
+			aiVector3D dn;
+			if(targetNormals) dn = target->mNormals[src] - mesh->mNormals[src];
+			if(dp.Length() < epsilon && dn.Length() < epsilon) continue;
+			vertices.push_back(i);
+			for(int c = 0; c < 3; ++c) deltas.push_back(floatToHalf(dp[c]));
+			if(normals)
+				for(int c = 0; c < 3; ++c) deltas.push_back(floatToHalf(dn[c]));
+		}
+		//Memory grows with the vertices the target moves, not the mesh
+		mt.numDeltas = vertices.size();
+		unsigned int* v = (unsigned int*)arena.allocate(sizeof(unsigned int) * vertices.size(), 16);
+		unsigned short* d = (unsigned short*)arena.allocate(sizeof(unsigned short) * deltas.size(), 16);
+		std::copy(vertices.begin(), vertices.end(), v);
+		std::copy(deltas.begin(), deltas.end(), d);
+		mt.vertices = v;
+		mt.deltas = d;
+		morph.targets.push_back(mt);
+		morph.defaultWeights.push_back(target->mWeight);
+		morph.numDeltas += mt.numDeltas;
+	}
+}
+
+void evaluateMorphWeights(const aiMeshMorphAnim* channel, float time, float* weights, unsigned int numTargets)
+{
+	for(unsigned int i = 0; i < numTargets; ++i)
+		weights[i] = 0.0f;
+	if(!channel || !channel->mNumKeys) return;
+
+	//Keys around 'time', snapping to the first or last key outside
+	unsigned int k1 = 0, k2 = 0;
+	float t = 0.0f;
+	const aiMeshMorphKey* keys = channel->mKeys;
+	unsigned int last = channel->mNumKeys - 1;
+	if(time >= keys[last].mTime){
+		k1 = k2 = last;
+	} else if(time > keys[0].mTime){
+		unsigned int first = 0, end = last;
+		while(end - first > 1){
+			unsigned int mid = (first + end) / 2;
+			if(keys[mid].mTime <= time) first = mid;
+			else end = mid;
+		}
+		k1 = first;
+		k2 = end;
+		float tDelta = keys[k2].mTime - keys[k1].mTime;
+		t = (tDelta > 0.0f) ? (time - keys[k1].mTime) / tDelta : 0.0f;
+	}
+
+	const aiMeshMorphKey& key1 = keys[k1];
+	for(unsigned int i = 0; i < key1.mNumValuesAndWeights; ++i)
+		if(key1.mValues[i] < numTargets)
+			weights[key1.mValues[i]] += (1.0f - t) * (float)key1.mWeights[i];
+	if(t > 0.0f){
+		const aiMeshMorphKey& key2 = keys[k2];
+		for(unsigned int i = 0; i < key2.mNumValuesAndWeights; ++i)
+			if(key2.mValues[i] < numTargets)
+				weights[key2.mValues[i]] += t * (float)key2.mWeights[i];
+	}
+}
+
+bool applyMorphTargets(const MeshMorph& morph, const float* previous, const float* weights,
+					   float* positions, float* normals)
+{
+	bool hasNormals = !morph.baseNormals.empty();
+	//Put back what the last pose moved
+	for(size_t t = 0; t < morph.targets.size(); ++t){
+		if(previous[t] == 0.0f) continue;
+		const MorphTarget& mt = morph.targets[t];
+		for(unsigned int i = 0; i < mt.numDeltas; ++i){
+			unsigned int v = mt.vertices[i] * 3;
+			for(int c = 0; c < 3; ++c){
+				positions[v + c] = morph.basePositions[v + c];
+				if(hasNormals) normals[v + c] = morph.baseNormals[v + c];
+			}
+		}
+	}
+
+	bool active = false;
+	for(size_t t = 0; t < morph.targets.size(); ++t){
+		float w = weights[t];
+		if(w == 0.0f) continue;
+		active = true;
+		const MorphTarget& mt = morph.targets[t];
+		const unsigned short* d = mt.deltas;
+		for(unsigned int i = 0; i < mt.numDeltas; ++i, d += mt.stride){
+			unsigned int v = mt.vertices[i] * 3;
+			for(int c = 0; c < 3; ++c)
+				positions[v + c] += w * halfToFloat(d[c]);
+			if(hasNormals)
+				for(int c = 0; c < 3; ++c)
+					normals[v + c] += w * halfToFloat(d[3 + c]);
+		}
+	}
+	return active;
+}
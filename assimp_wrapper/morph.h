@@ -0,0 +1,109 @@
+#ifndef MORPH_H
+#define MORPH_H
+
+#include <assimp/mesh.h>
+#include <assimp/anim.h>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include "arena.h"
+
+/* Morph targets (aiMesh::mAnimMeshes) stored as sparse deltas.
+
+   Each target keeps only the vertices it moves, as the index of the
+   vertex in the mesh's VBOs and the difference to the base mesh in half
+   precision: position x, y, z, then normal x, y, z if the mesh has
+   normals. Assimp's morphing methods all come down to
+   base + sum(weight * (target - base)), so that is what
+   applyMorphTargets() computes. */
+
+/* IEEE 754 binary16 conversion, round to nearest even. Values too small
+   for a half become subnormal or zero, too large ones infinity */
+inline unsigned short floatToHalf(float f)
+{
+	unsigned int x;
+	std::memcpy(&x, &f, sizeof(x));
+	unsigned int sign = (x >> 16) & 0x8000;
+	int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+	unsigned int mant = x & 0x7fffff;
+	if(((x >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0); //inf, nan
+	if(exp >= 31)
+		return sign | 0x7c00;
+	if(exp <= 0){
+		if(exp < -10) return sign;
+		mant |= 0x800000;
+		unsigned int shift = 14 - exp;
+		unsigned int h = mant >> shift;
+		unsigned int rem = mant & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if(rem > halfway || (rem == halfway && (h & 1))) ++h;
+		return sign | h;
+	}
+	unsigned int h = ((unsigned int)exp << 10) | (mant >> 13);
+	unsigned int rem = mant & 0x1fff;
+	//A carry out of the mantissa correctly bumps the exponent
+	if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+	return sign | h;
+}
+
+inline float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	unsigned int exp = (h >> 10) & 0x1f;
+	unsigned int mant = h & 0x3ff;
+	if(exp == 0){
+		float f = std::ldexp((float)mant, -24);
+		return sign ? -f : f;
+	}
+	unsigned int x;
+	if(exp == 31)
+		x = sign | 0x7f800000 | (mant << 13);
+	else
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+struct MorphTarget
+{
+	unsigned int numDeltas;
+	unsigned int stride;           //halves per delta, 3 or 6
+	const unsigned int* vertices;  //ascending VBO vertex indices
+	const unsigned short* deltas;  //'stride' halves per vertex
+};
+
+/* Morph targets of one mesh. The base attributes are kept in VBO order,
+   so vertices moved by a target can be put back */
+struct MeshMorph
+{
+	std::vector<MorphTarget> targets;
+	std::vector<float> basePositions; //x, y, z per vertex
+	std::vector<float> baseNormals;   //empty without normals
+	//aiAnimMesh::mWeight of every target, for clips without a channel
+	//for the mesh
+	std::vector<float> defaultWeights;
+	//Total number of deltas, for statistics
+	size_t numDeltas;
+};
+
+/* Pack the targets of 'mesh'. Vertex 'i' in the VBOs is vertex order[i]
+   of the aiMesh, or 'i' if 'order' is empty. Deltas are stored from
+   'arena'; vertices that move less than 'epsilon' are left out */
+void buildMeshMorph(Arena& arena, const aiMesh* mesh, const std::vector<unsigned int>& order,
+					MeshMorph& morph, float epsilon = 1e-6f);
+
+/* Target weights of 'channel' at 'time' in ticks, interpolated linearly
+   between the keys around it. 'weights' has one entry per target */
+void evaluateMorphWeights(const aiMeshMorphAnim* channel, float time, float* weights, unsigned int numTargets);
+
+/* Move 'positions' and 'normals' (VBO order, both may start out as the
+   base mesh or as the result of the last call) from the pose given by
+   'previous' to the one given by 'weights'. Only vertices of targets
+   with a non-zero weight in either are touched. 'normals' is ignored
+   if the mesh has none. Returns false if no target is active */
+bool applyMorphTargets(const MeshMorph& morph, const float* previous, const float* weights,
+					   float* positions, float* normals);
+
+#endif
@@ -0,0 +1,315 @@
+#include "pack.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+static const char PACK_MAGIC[4] = { 'A', 'P', 'A', 'K' };
+static const unsigned int PACK_VERSION = 1;
+
+//64 bit FNV-1a
+static unsigned long long hashName(const std::string& name)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < name.size(); ++i){
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool entryLess(const PackEntry& a, const PackEntry& b)
+{
+	return a.hash < b.hash;
+}
+
+std::string normalizePackPath(const std::string& path)
+{
+	std::string result(path);
+	std::replace(result.begin(), result.end(), '\\', '/');
+	size_t pos;
+	while((pos = result.find("/./")) != std::string::npos)
+		result.erase(pos, 2);
+	while(result.compare(0, 2, "./") == 0)
+		result.erase(0, 2);
+	return result;
+}
+
+/****************************************************************************************
+ ************************************* PackArchive **************************************
+ ****************************************************************************************/
+PackArchive::PackArchive()
+	: m_Data(0), m_Size(0), m_Mapped(false), m_Header(0), m_Entries(0), m_Names(0)
+{
+}
+
+PackArchive::~PackArchive()
+{
+	close();
+}
+
+bool PackArchive::open(const std::string& path)
+{
+	close();
+#ifndef WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat st;
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+		void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED){
+			m_Data = (const char*)data;
+			m_Size = st.st_size;
+			m_Mapped = true;
+		}
+	}
+	::close(fd);
+#else
+	FILE* fp = fopen(path.c_str(), "rb");
+	if(!fp) return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if(size > 0){
+		char* data = new char[size];
+		if(fread(data, 1, size, fp) == (size_t)size){
+			m_Data = data;
+			m_Size = size;
+		} else {
+			delete[] data;
+		}
+	}
+	fclose(fp);
+#endif
+	if(!m_Data) return false;
+
+	//Check everything once, so lookups can trust the table
+	const PackHeader* header = (const PackHeader*)m_Data;
+	bool ok = m_Size >= sizeof(PackHeader) && !memcmp(header->magic, PACK_MAGIC, 4) &&
+			  header->version == PACK_VERSION && header->tocOffset <= m_Size &&
+			  header->entryCount <= (m_Size - header->tocOffset) / sizeof(PackEntry) &&
+			  header->namesOffset <= m_Size && header->tocOffset % 8 == 0;
+	if(ok){
+		const PackEntry* entries = (const PackEntry*)(m_Data + header->tocOffset);
+		size_t namesSize = m_Size - header->namesOffset;
+		for(unsigned int i = 0; ok && i < header->entryCount; ++i){
+			const PackEntry& e = entries[i];
+			//LZ4 takes int sizes, and a bad rawSize must not size the buffer
+			ok = e.offset <= m_Size && e.size <= m_Size - e.offset && e.rawSize <= INT_MAX &&
+				 e.nameOffset <= namesSize && e.nameLength <= namesSize - e.nameOffset &&
+				 (i == 0 || entries[i - 1].hash <= e.hash);
+		}
+		m_Header = header;
+		m_Entries = entries;
+		m_Names = m_Data + header->namesOffset;
+	}
+	if(!ok){
+		printf("Not a valid pack file: %s\n", path.c_str());
+		close();
+		return false;
+	}
+	return true;
+}
+
+void PackArchive::close()
+{
+	if(m_Data){
+#ifndef WIN32
+		if(m_Mapped)
+			munmap((void*)m_Data, m_Size);
+#else
+		delete[] m_Data;
+#endif
+	}
+	m_Data = 0;
+	m_Size = 0;
+	m_Mapped = false;
+	m_Header = 0;
+	m_Entries = 0;
+	m_Names = 0;
+}
+
+const PackEntry* PackArchive::find(const std::string& name) const
+{
+	if(!m_Header) return 0;
+	PackEntry key;
+	key.hash = hashName(name);
+	const PackEntry* end = m_Entries + m_Header->entryCount;
+	//Names with the same hash sit next to each other
+	for(const PackEntry* e = std::lower_bound(m_Entries, end, key, entryLess); e != end && e->hash == key.hash; ++e)
+		if(e->nameLength == name.size() && !memcmp(m_Names + e->nameOffset, name.c_str(), name.size()))
+			return e;
+	return 0;
+}
+
+std::string PackArchive::name(const PackEntry* entry) const
+{
+	return std::string(m_Names + entry->nameOffset, entry->nameLength);
+}
+
+bool PackArchive::read(const PackEntry* entry, const char*& data, size_t& size, std::vector<char>& buffer) const
+{
+	const char* stored = m_Data + entry->offset;
+	if(!(entry->flags & PACK_LZ4)){
+		data = stored;
+		size = entry->size;
+		return true;
+	}
+#ifdef HAVE_LZ4
+	buffer.resize(entry->rawSize);
+	if(entry->rawSize > 0 && LZ4_decompress_safe(stored, &buffer[0], (int)entry->size, (int)entry->rawSize) != (int)entry->rawSize)
+		return false;
+	data = buffer.empty() ? stored : &buffer[0];
+	size = buffer.size();
+	return true;
+#else
+	(void)buffer;
+	printf("%s is LZ4 compressed, rebuild with HAVE_LZ4 to read it\n", name(entry).c_str());
+	return false;
+#endif
+}
+
+/****************************************************************************************
+ ************************************** PackFiles ***************************************
+ ****************************************************************************************/
+PackFiles::~PackFiles()
+{
+	unmountAll();
+}
+
+PackFiles& PackFiles::shared()
+{
+	static PackFiles packs;
+	return packs;
+}
+
+bool PackFiles::mount(const std::string& path)
+{
+	PackArchive* pack = new PackArchive;
+	if(!pack->open(path)){
+		delete pack;
+		return false;
+	}
+	m_Packs.push_back(pack);
+	return true;
+}
+
+void PackFiles::unmountAll()
+{
+	for(size_t i = 0; i < m_Packs.size(); ++i)
+		delete m_Packs[i];
+	m_Packs.clear();
+}
+
+bool PackFiles::read(const std::string& path, const char*& data, size_t& size, std::vector<char>& buffer) const
+{
+	if(m_Packs.empty()) return false;
+	std::string name = normalizePackPath(path);
+	for(size_t i = m_Packs.size(); i-- > 0;){
+		const PackEntry* entry = m_Packs[i]->find(name);
+		if(entry)
+			return m_Packs[i]->read(entry, data, size, buffer);
+	}
+	return false;
+}
+
+/****************************************************************************************
+ ************************************** PackWriter **************************************
+ ****************************************************************************************/
+PackWriter::PackWriter(unsigned int alignment)
+	: m_Alignment(std::max(alignment, 8u)), m_RawBytes(0)
+{
+}
+
+bool PackWriter::add(const std::string& path, const char* data, size_t size, bool compress)
+{
+	std::string name = normalizePackPath(path);
+	if(!m_Taken.insert(name).second)
+		return false;
+	PackEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.hash = hashName(name);
+	entry.rawSize = size;
+	entry.nameOffset = m_Names.size();
+	entry.nameLength = name.size();
+	m_Names += name;
+	m_RawBytes += size;
+
+	//Pad to the alignment, relative to the data start, which write()
+	//puts on an alignment boundary as well
+	m_Data.resize((m_Data.size() + m_Alignment - 1) / m_Alignment * m_Alignment);
+	entry.offset = m_Data.size();
+#ifdef HAVE_LZ4
+	if(compress && size > 0 && size < 0x7E000000){
+		std::vector<char> packed(LZ4_compressBound((int)size));
+		int packedSize = LZ4_compress_default(data, &packed[0], (int)size, (int)packed.size());
+		if(packedSize > 0 && (size_t)packedSize <= size - size / 8){
+			entry.flags = PACK_LZ4;
+			entry.size = packedSize;
+			m_Data.insert(m_Data.end(), packed.begin(), packed.begin() + packedSize);
+			m_Entries.push_back(entry);
+			return true;
+		}
+	}
+#else
+	(void)compress;
+#endif
+	entry.size = size;
+	m_Data.insert(m_Data.end(), data, data + size);
+	m_Entries.push_back(entry);
+	return true;
+}
+
+bool PackWriter::write(const std::string& path) const
+{
+	PackHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_MAGIC, 4);
+	header.version = PACK_VERSION;
+	header.alignment = m_Alignment;
+	header.entryCount = m_Entries.size();
+	size_t dataStart = (sizeof(PackHeader) + m_Alignment - 1) / m_Alignment * m_Alignment;
+	header.tocOffset = (dataStart + m_Data.size() + 7) / 8 * 8;
+	header.namesOffset = header.tocOffset + m_Entries.size() * sizeof(PackEntry);
+
+	std::vector<PackEntry> entries(m_Entries);
+	for(size_t i = 0; i < entries.size(); ++i)
+		entries[i].offset += dataStart;
+	std::stable_sort(entries.begin(), entries.end(), entryLess);
+
+	//Written under a temporary name, so a crash never leaves half a file
+	std::string temp = path + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if(!fp) return false;
+	static const char zeros[64] = { 0 };
+	size_t pad = dataStart - sizeof(PackHeader);
+	size_t tocPad = header.tocOffset - dataStart - m_Data.size();
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	while(ok && pad > 0){
+		size_t n = std::min(pad, sizeof(zeros));
+		ok = fwrite(zeros, 1, n, fp) == n;
+		pad -= n;
+	}
+	ok = ok && (m_Data.empty() || fwrite(&m_Data[0], 1, m_Data.size(), fp) == m_Data.size()) &&
+		 fwrite(zeros, 1, tocPad, fp) == tocPad &&
+		 (entries.empty() || fwrite(&entries[0], sizeof(PackEntry), entries.size(), fp) == entries.size()) &&
+		 fwrite(m_Names.c_str(), 1, m_Names.size(), fp) == m_Names.size();
+	ok = fclose(fp) == 0 && ok;
+#ifdef WIN32
+	if(ok) remove(path.c_str());
+#endif
+	if(!ok || rename(temp.c_str(), path.c_str()) != 0){
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,132 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstddef>
+#include <string>
+#include <set>
+#include <vector>
+
+/* Pack files: many small assets (models, textures, shaders) in one
+   file, so loading a level opens one file instead of thousands.
+
+   Layout, all integers in native byte order:
+     PackHeader
+     entry data, each entry starting on a PackHeader::alignment boundary
+     PackEntry[entryCount], sorted by hash
+     names, not NUL terminated
+   An entry is found by the 64 bit FNV-1a hash of its name and a binary
+   search of the table, then the name is compared. Names are paths with
+   '/' separators, e.g. "data/model.dae"; lookups normalize '\' and
+   "./" the same way.
+
+   Entries flagged PACK_LZ4 are LZ4 blocks, readable only when built
+   with HAVE_LZ4. The others are used straight from the mapping. */
+
+enum
+{
+	PACK_LZ4 = 1
+};
+
+struct PackHeader
+{
+	char magic[4]; //"APAK"
+	unsigned int version;
+	unsigned int alignment;
+	unsigned int entryCount;
+	unsigned long long tocOffset;
+	unsigned long long namesOffset;
+};
+
+struct PackEntry
+{
+	unsigned long long hash;
+	unsigned long long offset;  //from the start of the file
+	unsigned long long size;    //bytes stored
+	unsigned long long rawSize; //bytes once decompressed
+	unsigned int nameOffset;    //into the names
+	unsigned int nameLength;
+	unsigned int flags;
+	unsigned int reserved;
+};
+
+//'path' the way pack names are stored
+std::string normalizePackPath(const std::string& path);
+
+/* One pack, mapped read-only while open */
+struct PackArchive
+{
+	PackArchive();
+	~PackArchive();
+
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return m_Data != 0; }
+
+	size_t size() const { return m_Header ? m_Header->entryCount : 0; }
+	const PackEntry* entry(size_t i) const { return &m_Entries[i]; }
+	//Entry named 'name' (already normalized), or 0
+	const PackEntry* find(const std::string& name) const;
+	std::string name(const PackEntry* entry) const;
+	/* Contents of 'entry'. Stored entries point 'data' into the mapping
+	   and leave 'buffer' alone; compressed ones are decompressed into
+	   'buffer'. Returns false for corrupt entries, or LZ4 ones without
+	   HAVE_LZ4 */
+	bool read(const PackEntry* entry, const char*& data, size_t& size, std::vector<char>& buffer) const;
+
+private:
+	PackArchive(const PackArchive&);
+	PackArchive& operator=(const PackArchive&);
+	const char* m_Data;
+	size_t m_Size;
+	bool m_Mapped;
+	const PackHeader* m_Header;
+	const PackEntry* m_Entries;
+	const char* m_Names;
+};
+
+/* Packs mounted for the whole program. readTextFile(), LoadImagePNG(),
+   LoadImageCompressed() and Scene (through MappedFileIO) look here
+   before the file system, so an asset is loaded the same way from a
+   pack or a loose file. The last pack mounted wins. Mount before
+   loading; lookups may come from any thread, mounting may not */
+struct PackFiles
+{
+	~PackFiles();
+
+	bool mount(const std::string& path);
+	void unmountAll();
+	//Like PackArchive::read(), for the file opened as 'path'
+	bool read(const std::string& path, const char*& data, size_t& size, std::vector<char>& buffer) const;
+	bool empty() const { return m_Packs.empty(); }
+
+	//Packs of the whole program
+	static PackFiles& shared();
+
+private:
+	std::vector<PackArchive*> m_Packs;
+};
+
+/* Builds a pack. Entries are kept in memory until write() */
+struct PackWriter
+{
+	PackWriter(unsigned int alignment = 16);
+
+	/* Add 'size' bytes as 'name'. With 'compress', the entry is stored
+	   as LZ4 if that saves at least an eighth; without HAVE_LZ4 it is
+	   always stored as is. Returns false if the name is taken */
+	bool add(const std::string& name, const char* data, size_t size, bool compress);
+	bool write(const std::string& path) const;
+
+	size_t getRawBytes() const { return m_RawBytes; }
+	size_t getStoredBytes() const { return m_Data.size(); }
+
+private:
+	unsigned int m_Alignment;
+	std::vector<PackEntry> m_Entries; //offsets relative to m_Data
+	std::string m_Names;
+	std::set<std::string> m_Taken;
+	std::vector<char> m_Data;
+	size_t m_RawBytes;
+};
+
+#endif
@@ -1,78 +1,142 @@
 #include "png_loader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "pack.h"
 
-bool LoadImagePNG(const std::string& name, std::vector<unsigned int>& buffer, unsigned int& width, unsigned int& height)
+//A file from a pack, read by libpng from memory
+struct PNGMemorySource
+{
+    const char* data;
+    size_t size;
+    size_t pos;
+};
+
+static void readPNGMemory(png_structp png_ptr, png_bytep out, png_size_t count)
+{
+    PNGMemorySource* source = (PNGMemorySource*)png_get_io_ptr(png_ptr);
+    if(count > source->size - source->pos)
+        png_error(png_ptr, "unexpected end of file");
+    memcpy(out, source->data + source->pos, count);
+    source->pos += count;
+}
+
+bool LoadImagePNG(const std::string& name, PNGDestination destination, void* context,
+                  unsigned int& width, unsigned int& height)
 {
     png_structp png_ptr;
     png_infop info_ptr;
-    unsigned int sig_read = 0;
-    int bit_depth, color_type, pass_num;
-    png_bytep *row_pointers;
-    FILE *fp;
-
+    png_uint_32 w, h;
+    int bit_depth, color_type, interlace_type, passes;
+    //Only touched after setjmp(), so volatile to survive the longjmp
+    unsigned char* volatile scratch = 0;
+    FILE *fp = NULL;
+    //Packed files are decoded straight from the pack's mapping
+    PNGMemorySource source = { 0, 0, 0 };
+    std::vector<char> packed;
+    if(!PackFiles::shared().read(name, source.data, source.size, packed)){
 #ifdef WIN32
-    if ((fp = fopen(name.c_str(), "rb")) == NULL)
-        return false;
+        if ((fp = fopen(name.c_str(), "rb")) == NULL)
+            return false;
 #else
-    if ((fp = fopen(name.c_str(), "r")) == NULL)
-        return false;
+        if ((fp = fopen(name.c_str(), "r")) == NULL)
+            return false;
 #endif
+    }
 
     png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if(!png_ptr){
-        fclose(fp);
+        if(fp) fclose(fp);
         return false;
     }
-    
+
     info_ptr = png_create_info_struct(png_ptr);
     if(!info_ptr){
-        fclose(fp);
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        if(fp) fclose(fp);
         return false;
     }
     if (setjmp(png_jmpbuf(png_ptr))){
-        fclose(fp);
+        free(scratch);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        if(fp) fclose(fp);
         return false;
     }
-    
-    png_init_io(png_ptr, fp);
+
+    if(fp)
+        png_init_io(png_ptr, fp);
+    else
+        png_set_read_fn(png_ptr, &source, readPNGMemory);
     png_read_info(png_ptr, info_ptr);
-    
-    width = info_ptr->width;
-    height = info_ptr->height;
-    color_type = info_ptr->color_type;
-    bit_depth = info_ptr->bit_depth;
+    png_get_IHDR(png_ptr, info_ptr, &w, &h, &bit_depth, &color_type, &interlace_type, NULL, NULL);
 
-    //ASSERT(color_type == PNG_COLOR_TYPE_RGBA);
- 
-    row_pointers = new png_bytep[height];
-    for (int y=0; y<height; y++)
-        row_pointers[y] = new png_byte[info_ptr->rowbytes];
-    
-    pass_num = png_set_interlace_handling(png_ptr);
+    //Let libpng expand everything to 8 bit RGBA while it unfilters
+    if(color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png_ptr);
+    if(color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    bool alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+    if(png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)){
+        png_set_tRNS_to_alpha(png_ptr);
+        alpha = true;
+    }
+    if(bit_depth == 16){
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+        png_set_scale_16(png_ptr);
+#else
+        png_set_strip_16(png_ptr);
+#endif
+    }
+    if(!(color_type & PNG_COLOR_MASK_COLOR))
+        png_set_gray_to_rgb(png_ptr);
+    if(!alpha)
+        png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+    passes = png_set_interlace_handling(png_ptr);
     png_read_update_info(png_ptr, info_ptr);
-    png_read_image(png_ptr, row_pointers);
-    png_read_end(png_ptr, info_ptr);   
-    png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
-    fclose(fp);
-    unsigned char r,g,b,a;
-    for(int y=0; y<height; y++){
-        for(int x=0; x<width; x++){
-	    	if(color_type == PNG_COLOR_TYPE_RGBA){
-				r = row_pointers[y][(x*4) + 0];
-				g = row_pointers[y][(x*4) + 1];
-				b = row_pointers[y][(x*4) + 2];
-				a = row_pointers[y][(x*4) + 3];
-			
-			} else {
-				r = row_pointers[y][(x*3) + 0];
-				g = row_pointers[y][(x*3) + 1];
-				b = row_pointers[y][(x*3) + 2];
-				a = 255;
-	    	}
-			
-            buffer.push_back((unsigned int)((a<<24) | (b<<16) | (g<<8) | r));
-        }
-        delete[] row_pointers[y];
+
+    size_t pitch = (size_t)w * 4;
+    unsigned char* dest = 0;
+    if(png_get_rowbytes(png_ptr, info_ptr) == pitch)
+        dest = (unsigned char*)destination(context, w, h);
+    if(!dest){
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        if(fp) fclose(fp);
+        return false;
     }
-    delete[] row_pointers;
-	return true;
+
+    if(passes == 1){
+        //Decode row by row straight into the destination
+        for(png_uint_32 y = 0; y < h; ++y)
+            png_read_row(png_ptr, dest + y * pitch, NULL);
+    } else {
+        //Later passes merge into the rows of earlier ones, so interlaced
+        //images need memory that can be read back
+        scratch = (unsigned char*)malloc(pitch * h);
+        if(!scratch)
+            png_error(png_ptr, "out of memory");
+        for(int pass = 0; pass < passes; ++pass)
+            for(png_uint_32 y = 0; y < h; ++y)
+                png_read_row(png_ptr, scratch + y * pitch, NULL);
+        memcpy(dest, scratch, pitch * h);
+        free(scratch);
+        scratch = 0;
+    }
+    png_read_end(png_ptr, NULL);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    if(fp) fclose(fp);
+    width = w;
+    height = h;
+    return true;
+}
+
+static void* vectorDestination(void* context, unsigned int width, unsigned int height)
+{
+    std::vector<unsigned int>& buffer = *(std::vector<unsigned int>*)context;
+    buffer.resize((size_t)width * height);
+    return buffer.empty() ? 0 : &buffer[0];
+}
+
+bool LoadImagePNG(const std::string& name, std::vector<unsigned int>& buffer, unsigned int& width, unsigned int& height)
+{
+    return LoadImagePNG(name, vectorDestination, &buffer, width, height);
 }
@@ -4,6 +4,17 @@
 #include <string>
 #include <vector>
 
+/* Every PNG (palette, grayscale, 1 to 16 bits, with or without alpha or
+   tRNS) is decoded to RGBA8, rows of width * 4 bytes, top row first. */
+
+/* Called once the size is known. Return where the width * height * 4
+   bytes of pixels go, or 0 to stop loading. Rows are written in order
+   and the memory is never read back, so it may be a mapped buffer */
+typedef void* (*PNGDestination)(void* context, unsigned int width, unsigned int height);
+
+bool LoadImagePNG(const std::string& name, PNGDestination destination, void* context,
+				  unsigned int& width, unsigned int& height);
+//One unsigned int per pixel, R in the lowest byte on little endian
 bool LoadImagePNG(const std::string& name, std::vector<unsigned int>& buffer, unsigned int& width, unsigned int& height);
 
 #endif
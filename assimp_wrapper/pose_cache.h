@@ -0,0 +1,115 @@
+#ifndef POSE_CACHE_H
+#define POSE_CACHE_H
+
+#include <cstddef>
+#include <vector>
+
+struct PoseCacheStats
+{
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/* Maps a pose key (clip, quantized time, palette format) to the palette
+   slot of the instance that evaluated it. Each instance owns at most
+   one entry, so the table never needs more than twice as many buckets
+   as there are instances. Open addressing with linear probing; lookups
+   and updates don't allocate. */
+struct PoseCache
+{
+	PoseCache() : m_Count(0) { m_Stats.hits = m_Stats.misses = 0; }
+
+	//Make room for 'instances' entries. Only grows, keeps the entries
+	void reserve(size_t instances)
+	{
+		size_t capacity = 16;
+		while(capacity < instances * 2) capacity *= 2;
+		if(capacity <= m_Entries.size()) return;
+		std::vector<Entry> old;
+		old.swap(m_Entries);
+		m_Entries.resize(capacity);
+		m_Count = 0;
+		for(size_t i = 0; i < old.size(); ++i)
+			if(old[i].used) insert(old[i].key, old[i].slot);
+	}
+
+	bool find(unsigned long long key, unsigned int& slot) const
+	{
+		if(m_Entries.empty()) return false;
+		for(size_t i = bucket(key); m_Entries[i].used; i = next(i)){
+			if(m_Entries[i].key == key){
+				slot = m_Entries[i].slot;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void insert(unsigned long long key, unsigned int slot)
+	{
+		size_t i = bucket(key);
+		for(; m_Entries[i].used; i = next(i)){
+			if(m_Entries[i].key == key){
+				m_Entries[i].slot = slot;
+				return;
+			}
+		}
+		m_Entries[i].key = key;
+		m_Entries[i].slot = slot;
+		m_Entries[i].used = true;
+		++m_Count;
+	}
+
+	//Remove 'key' if it still points to 'slot'
+	void erase(unsigned long long key, unsigned int slot)
+	{
+		if(m_Entries.empty()) return;
+		size_t i = bucket(key);
+		for(; m_Entries[i].used; i = next(i))
+			if(m_Entries[i].key == key) break;
+		if(!m_Entries[i].used || m_Entries[i].slot != slot) return;
+		//Backward shift, so probe chains stay unbroken without tombstones
+		m_Entries[i].used = false;
+		--m_Count;
+		for(size_t j = next(i); m_Entries[j].used; j = next(j)){
+			size_t home = bucket(m_Entries[j].key);
+			//Move j into the hole at i unless its home lies in (i, j]
+			bool between = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+			if(between) continue;
+			m_Entries[i] = m_Entries[j];
+			m_Entries[j].used = false;
+			i = j;
+		}
+	}
+
+	void hit() { ++m_Stats.hits; }
+	void miss() { ++m_Stats.misses; }
+	const PoseCacheStats& stats() const { return m_Stats; }
+	void resetStats() { m_Stats.hits = m_Stats.misses = 0; }
+	size_t size() const { return m_Count; }
+
+private:
+	struct Entry
+	{
+		Entry() : key(0), slot(0), used(false) {}
+		unsigned long long key;
+		unsigned int slot;
+		bool used;
+	};
+
+	size_t bucket(unsigned long long key) const
+	{
+		//splitmix64 finalizer, keys differ in only a few bits
+		key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+		key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+		key ^= key >> 31;
+		return (size_t)key & (m_Entries.size() - 1);
+	}
+	size_t next(size_t i) const { return (i + 1) & (m_Entries.size() - 1); }
+
+	std::vector<Entry> m_Entries;
+	size_t m_Count;
+	PoseCacheStats m_Stats;
+};
+
+#endif
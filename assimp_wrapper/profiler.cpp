@@ -0,0 +1,218 @@
+#include "profiler.h"
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+
+Profiler& Profiler::get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() : m_TraceNext(0), m_ActiveGPUScope(0)
+{
+	m_Epoch = now();
+	for(int i = 0; i < PROFILE_NUM_COUNTERS; ++i){
+		m_Counters[i] = History();
+		m_FrameCounters[i] = 0;
+	}
+}
+
+unsigned long long Profiler::now()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::push(History& h, double value)
+{
+	h.values[h.next] = value;
+	h.next = (h.next + 1) % HISTORY;
+	if(h.count < HISTORY) ++h.count;
+}
+
+ProfileStats Profiler::makeStats(const History& h)
+{
+	ProfileStats stats = ProfileStats();
+	stats.samples = h.count;
+	if(!h.count) return stats;
+	stats.last = h.values[(h.next + HISTORY - 1) % HISTORY];
+	stats.min = stats.max = stats.last;
+	double sum = 0.0;
+	for(unsigned int i = 0; i < h.count; ++i){
+		double v = h.values[i];
+		sum += v;
+		stats.min = std::min(stats.min, v);
+		stats.max = std::max(stats.max, v);
+	}
+	stats.average = sum / h.count;
+	return stats;
+}
+
+void Profiler::addEvent(const char* name, unsigned long long start, unsigned long long duration, TraceKind kind)
+{
+	//Ring buffer, so a long running session keeps the latest events
+	TraceEvent e;
+	e.name = name;
+	e.start = start - m_Epoch;
+	e.duration = duration;
+	e.thread = (kind == TRACE_CPU) ? (std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xffff) + 1 : 0;
+	e.kind = kind;
+	if(m_Trace.size() < MAX_TRACE_EVENTS)
+		m_Trace.push_back(e);
+	else
+		m_Trace[m_TraceNext] = e;
+	m_TraceNext = (m_TraceNext + 1) % MAX_TRACE_EVENTS;
+}
+
+void Profiler::beginCPU(const char* name, unsigned long long& start)
+{
+	start = now();
+}
+
+void Profiler::endCPU(const char* name, unsigned long long start)
+{
+	unsigned long long end = now();
+	std::lock_guard<std::mutex> lock(m_Lock);
+	History& h = m_Scopes[name];
+	h.current += (end - start) * 1e-6;
+	h.touched = true;
+	addEvent(name, start, end - start, TRACE_CPU);
+}
+
+bool Profiler::beginGPU(const char* name)
+{
+	if(!GLEW_ARB_timer_query || m_ActiveGPUScope) return false;
+	std::lock_guard<std::mutex> lock(m_Lock);
+	std::map<const char*, QueryRing, CStrLess>::iterator it = m_Queries.find(name);
+	if(it == m_Queries.end()){
+		QueryRing ring = QueryRing();
+		glGenQueries(QUERY_RING, ring.queries);
+		it = m_Queries.insert(std::make_pair(name, ring)).first;
+	}
+	QueryRing& ring = it->second;
+	//All queries still in flight, drop this measurement rather than
+	//waiting for the GPU
+	if(ring.pending[ring.next]) return false;
+	glBeginQuery(GL_TIME_ELAPSED, ring.queries[ring.next]);
+	ring.issuedAt[ring.next] = now();
+	ring.pending[ring.next] = true;
+	ring.next = (ring.next + 1) % QUERY_RING;
+	m_ActiveGPUScope = name;
+	return true;
+}
+
+void Profiler::endGPU()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	m_ActiveGPUScope = 0;
+}
+
+void Profiler::pollQueries()
+{
+	std::map<const char*, QueryRing, CStrLess>::iterator it;
+	for(it = m_Queries.begin(); it != m_Queries.end(); ++it){
+		QueryRing& ring = it->second;
+		for(int i = 0; i < QUERY_RING; ++i){
+			if(!ring.pending[i]) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(ring.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available) continue;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(ring.queries[i], GL_QUERY_RESULT, &elapsed);
+			ring.pending[i] = false;
+			push(m_GPUScopes[it->first], elapsed * 1e-6);
+			addEvent(it->first, ring.issuedAt[i], elapsed, TRACE_GPU);
+		}
+	}
+}
+
+void Profiler::count(ProfileCounter counter, unsigned long n)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_FrameCounters[counter] += n;
+}
+
+void Profiler::endFrame()
+{
+	static const char* counterNames[PROFILE_NUM_COUNTERS] = {
+		"draws", "triangles", "bytes uploaded"
+	};
+	std::lock_guard<std::mutex> lock(m_Lock);
+	unsigned long long t = now();
+	std::map<const char*, History, CStrLess>::iterator it;
+	for(it = m_Scopes.begin(); it != m_Scopes.end(); ++it){
+		History& h = it->second;
+		if(!h.touched) continue;
+		push(h, h.current);
+		h.current = 0.0;
+		h.touched = false;
+	}
+	for(int i = 0; i < PROFILE_NUM_COUNTERS; ++i){
+		push(m_Counters[i], m_FrameCounters[i]);
+		addEvent(counterNames[i], t, m_FrameCounters[i], TRACE_COUNTER);
+		m_FrameCounters[i] = 0;
+	}
+	if(GLEW_ARB_timer_query)
+		pollQueries();
+}
+
+bool Profiler::getStats(const char* name, ProfileStats& stats) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	std::map<const char*, History, CStrLess>::const_iterator it = m_Scopes.find(name);
+	if(it == m_Scopes.end()) return false;
+	stats = makeStats(it->second);
+	return true;
+}
+
+bool Profiler::getGPUStats(const char* name, ProfileStats& stats) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	std::map<const char*, History, CStrLess>::const_iterator it = m_GPUScopes.find(name);
+	if(it == m_GPUScopes.end()) return false;
+	stats = makeStats(it->second);
+	return true;
+}
+
+ProfileStats Profiler::getCounterStats(ProfileCounter counter) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return makeStats(m_Counters[counter]);
+}
+
+std::vector<std::string> Profiler::getScopeNames() const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	std::vector<std::string> names;
+	std::map<const char*, History, CStrLess>::const_iterator it;
+	for(it = m_Scopes.begin(); it != m_Scopes.end(); ++it)
+		names.push_back(it->first);
+	return names;
+}
+
+bool Profiler::exportChromeTrace(const std::string& path) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	std::ofstream strm(path.c_str());
+	if(!strm.is_open()) return false;
+
+	//Timestamps are in microseconds. GPU events go on their own track
+	strm << "{\"traceEvents\":[\n";
+	strm << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+	for(size_t i = 0; i < m_Trace.size(); ++i){
+		//Oldest event first
+		const TraceEvent& e = m_Trace[(m_TraceNext + i) % m_Trace.size()];
+		if(e.kind == TRACE_COUNTER){
+			strm << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"C\",\"pid\":0,\"ts\":" << e.start / 1000.0
+				 << ",\"args\":{\"value\":" << e.duration << "}}";
+		} else {
+			strm << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << (e.kind == TRACE_GPU ? "gpu" : "cpu")
+				 << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+				 << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0 << "}";
+		}
+	}
+	strm << "\n]}\n";
+	return true;
+}
@@ -0,0 +1,148 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <mutex>
+
+/* Per-frame instrumentation.
+
+   PROFILE_SCOPE("name") measures the CPU time until the end of the
+   enclosing block. PROFILE_GPU_SCOPE("name") measures the GPU time of
+   the GL commands issued in the block with a GL_TIME_ELAPSED query.
+   GPU results are read back a few frames later, without stalling.
+   PROFILE_COUNT() adds to one of the per-frame counters, and
+   PROFILE_FRAME() closes the current frame.
+
+   Everything compiles to nothing unless ASSIMP_GL_PROFILE is defined
+   (cmake -DENABLE_PROFILING=ON). Scope names must be string literals. */
+
+enum ProfileCounter
+{
+	PROFILE_DRAWS,
+	PROFILE_TRIANGLES,
+	PROFILE_BYTES_UPLOADED,
+	PROFILE_NUM_COUNTERS
+};
+
+/* Rolling statistics over the last Profiler::HISTORY frames, in
+   milliseconds for scopes and in units for counters */
+struct ProfileStats
+{
+	double last;
+	double average;
+	double min;
+	double max;
+	unsigned int samples;
+};
+
+struct Profiler
+{
+	static const int HISTORY = 120;   //frames kept for ProfileStats
+	static const int QUERY_RING = 4;  //GL queries per GPU scope
+	static const size_t MAX_TRACE_EVENTS = 1 << 16;
+
+	static Profiler& get();
+
+	void beginCPU(const char* name, unsigned long long& start);
+	void endCPU(const char* name, unsigned long long start);
+	bool beginGPU(const char* name);
+	void endGPU();
+	void count(ProfileCounter counter, unsigned long n);
+	void endFrame();
+
+	bool getStats(const char* name, ProfileStats& stats) const;
+	bool getGPUStats(const char* name, ProfileStats& stats) const;
+	ProfileStats getCounterStats(ProfileCounter counter) const;
+	//Names of all scopes measured so far
+	std::vector<std::string> getScopeNames() const;
+	//Write the recorded events in Chrome's trace event format
+	//(load in chrome://tracing or Perfetto)
+	bool exportChromeTrace(const std::string& path) const;
+
+private:
+	Profiler();
+	struct CStrLess
+	{
+		bool operator()(const char* a, const char* b) const { return std::strcmp(a, b) < 0; }
+	};
+	struct History
+	{
+		double values[HISTORY];
+		unsigned int count;
+		unsigned int next;
+		double current; //accumulated during the current frame
+		bool touched;
+	};
+	struct QueryRing
+	{
+		GLuint queries[QUERY_RING];
+		unsigned long long issuedAt[QUERY_RING]; //CPU time of glBeginQuery
+		bool pending[QUERY_RING];
+		unsigned int next;
+	};
+	enum TraceKind { TRACE_CPU, TRACE_GPU, TRACE_COUNTER };
+	struct TraceEvent
+	{
+		const char* name;
+		unsigned long long start; //ns
+		unsigned long long duration; //ns, or the value of a counter
+		unsigned int thread;
+		TraceKind kind;
+	};
+
+	static unsigned long long now();
+	static void push(History& h, double value);
+	static ProfileStats makeStats(const History& h);
+	void addEvent(const char* name, unsigned long long start, unsigned long long duration, TraceKind kind);
+	void pollQueries();
+
+	mutable std::mutex m_Lock;
+	unsigned long long m_Epoch;
+	std::map<const char*, History, CStrLess> m_Scopes;
+	std::map<const char*, History, CStrLess> m_GPUScopes;
+	std::map<const char*, QueryRing, CStrLess> m_Queries;
+	History m_Counters[PROFILE_NUM_COUNTERS];
+	unsigned long m_FrameCounters[PROFILE_NUM_COUNTERS];
+	std::vector<TraceEvent> m_Trace;
+	size_t m_TraceNext;
+	const char* m_ActiveGPUScope;
+};
+
+struct ProfileScope
+{
+	ProfileScope(const char* name) : m_Name(name) { Profiler::get().beginCPU(name, m_Start); }
+	~ProfileScope() { Profiler::get().endCPU(m_Name, m_Start); }
+private:
+	const char* m_Name;
+	unsigned long long m_Start;
+};
+
+/* GL_TIME_ELAPSED queries can't nest, so only the outermost GPU scope
+   is measured */
+struct GPUProfileScope
+{
+	GPUProfileScope(const char* name) { m_Active = Profiler::get().beginGPU(name); }
+	~GPUProfileScope() { if(m_Active) Profiler::get().endGPU(); }
+private:
+	bool m_Active;
+};
+
+#ifdef ASSIMP_GL_PROFILE
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GPUProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) Profiler::get().count(counter, n)
+#define PROFILE_FRAME() Profiler::get().endFrame()
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+#include "program_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+#include "glstuff.h"
+#include "profiler.h"
+
+//64 bit FNV-1a, continuing from 'hash'
+static unsigned long long hashBytes(const void* data, size_t size,
+									unsigned long long hash = 14695981039346656037ULL)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for(size_t i = 0; i < size; ++i){
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static std::string glString(GLenum name)
+{
+	const char* s = (const char*)glGetString(name);
+	return s ? s : "";
+}
+
+/* Binary file layout: "GLPB", the format, the length of the driver
+   string and of the binary (all 32 bit, native byte order), then the
+   driver string and the binary */
+static const char BINARY_MAGIC[4] = { 'G', 'L', 'P', 'B' };
+
+ProgramCache::ProgramCache()
+{
+	m_Stats.requests = 0;
+	m_Stats.compiled = 0;
+	m_Stats.binaries = 0;
+	m_Stats.rejected = 0;
+	m_Stats.failed = 0;
+	m_ThreadsSet = false;
+}
+
+ProgramCache::~ProgramCache()
+{
+}
+
+ProgramCache& ProgramCache::shared()
+{
+	static ProgramCache cache;
+	return cache;
+}
+
+void ProgramCache::setBinaryDirectory(const std::string& directory)
+{
+	m_Directory = directory;
+	if(m_Directory.empty()) return;
+	if(m_Directory[m_Directory.size() - 1] != '/')
+		m_Directory += '/';
+#ifdef WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+const std::string& ProgramCache::source(const std::string& path)
+{
+	std::map<std::string, std::string>::iterator it = m_Sources.find(path);
+	if(it == m_Sources.end())
+		it = m_Sources.insert(std::make_pair(path, readTextFile(path))).first;
+	return it->second;
+}
+
+GLuint ProgramCache::program(const std::string& vertexPath, const std::string& fragmentPath,
+							 const std::string& defines)
+{
+	return wait(submit(vertexPath, fragmentPath, defines));
+}
+
+ProgramTicket ProgramCache::submit(const std::string& vertexPath, const std::string& fragmentPath,
+								   const std::string& defines)
+{
+	++m_Stats.requests;
+	std::string vertexSrc = addShaderDefines(source(vertexPath), defines);
+	std::string fragmentSrc = addShaderDefines(source(fragmentPath), defines);
+	//The driver is part of the key, as binaries only fit the driver that
+	//made them. The zero bytes keep "ab" + "c" apart from "a" + "bc"
+	std::string driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+	ProgramTicket key = hashBytes(vertexSrc.c_str(), vertexSrc.size() + 1);
+	key = hashBytes(fragmentSrc.c_str(), fragmentSrc.size() + 1, key);
+	key = hashBytes(driver.c_str(), driver.size(), key);
+	if(m_Programs.count(key) || m_Pending.count(key))
+		return key;
+
+	PROFILE_SCOPE("ProgramCache::submit");
+	bool binaries = !m_Directory.empty() && GLEW_ARB_get_program_binary;
+	std::string file;
+	if(binaries){
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", key);
+		file = m_Directory + name;
+		//Loading a binary is quick, no need to queue it
+		GLuint program = loadBinary(file, driver);
+		if(program){
+			m_Programs[key] = program;
+			return key;
+		}
+	}
+	//Let the driver use as many threads as it likes
+	if(!m_ThreadsSet){
+		m_ThreadsSet = true;
+		if(GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if(GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+	PendingProgram& pending = m_Pending[key];
+	pending.program = startShaderProgram(vertexSrc, fragmentSrc, binaries, pending.shaders);
+	pending.binaryFile = file;
+	pending.driver = driver;
+	return key;
+}
+
+GLuint ProgramCache::resolve(ProgramTicket ticket, GLuint fallback) const
+{
+	std::map<ProgramTicket, GLuint>::const_iterator it = m_Programs.find(ticket);
+	if(it == m_Programs.end() || m_Failed.count(ticket))
+		return fallback;
+	return it->second;
+}
+
+GLuint ProgramCache::wait(ProgramTicket ticket)
+{
+	if(m_Pending.count(ticket))
+		finish(ticket);
+	std::map<ProgramTicket, GLuint>::const_iterator it = m_Programs.find(ticket);
+	return it == m_Programs.end() ? 0 : it->second;
+}
+
+void ProgramCache::poll()
+{
+	std::map<ProgramTicket, PendingProgram>::iterator it = m_Pending.begin();
+	bool parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+	while(it != m_Pending.end()){
+		ProgramTicket ticket = it->first;
+		bool done = isShaderProgramDone(it->second.program);
+		++it;
+		if(!done) continue;
+		finish(ticket);
+		if(!parallel) break;
+	}
+}
+
+void ProgramCache::finish(ProgramTicket ticket)
+{
+	PROFILE_SCOPE("ProgramCache::finish");
+	PendingProgram& pending = m_Pending[ticket];
+	++m_Stats.compiled;
+	if(finishShaderProgram(pending.program, pending.shaders)){
+		if(!pending.binaryFile.empty())
+			saveBinary(pending.program, pending.binaryFile, pending.driver);
+	} else {
+		//Kept like a working one, so it isn't built over and over
+		m_Failed.insert(ticket);
+		++m_Stats.failed;
+	}
+	m_Programs[ticket] = pending.program;
+	m_Pending.erase(ticket);
+}
+
+GLuint ProgramCache::loadBinary(const std::string& file, const std::string& driver)
+{
+	FILE* fp = fopen(file.c_str(), "rb");
+	if(!fp) return 0;
+	char magic[4];
+	unsigned int header[3]; //format, driver length, binary length
+	std::vector<char> data;
+	bool ok = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, BINARY_MAGIC, 4) &&
+			  fread(header, sizeof(header), 1, fp) == 1 && header[1] == driver.size() && header[2] > 0;
+	if(ok){
+		data.resize(header[1] + header[2]);
+		ok = fread(&data[0], 1, data.size(), fp) == data.size() &&
+			 !memcmp(&data[0], driver.c_str(), header[1]);
+	}
+	fclose(fp);
+	if(!ok) return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header[0], &data[header[1]], header[2]);
+	int status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if(status != GL_TRUE){
+		forgetProgram(program);
+		glDeleteProgram(program);
+		++m_Stats.rejected;
+		return 0;
+	}
+	++m_Stats.binaries;
+	return program;
+}
+
+void ProgramCache::saveBinary(GLuint program, const std::string& file, const std::string& driver)
+{
+	int status = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(status != GL_TRUE || length <= 0) return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	if(length <= 0) return;
+
+	//Written under a temporary name, so a crash never leaves half a file
+	std::string temp = file + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if(!fp) return;
+	unsigned int header[3] = { format, (unsigned int)driver.size(), (unsigned int)length };
+	bool ok = fwrite(BINARY_MAGIC, 1, 4, fp) == 4 &&
+			  fwrite(header, sizeof(header), 1, fp) == 1 &&
+			  fwrite(driver.c_str(), 1, driver.size(), fp) == driver.size() &&
+			  fwrite(&binary[0], 1, length, fp) == (size_t)length;
+	ok = fclose(fp) == 0 && ok;
+#ifdef WIN32
+	if(ok) remove(file.c_str());
+#endif
+	if(!ok || rename(temp.c_str(), file.c_str()) != 0)
+		remove(temp.c_str());
+}
+
+void ProgramCache::releaseGL()
+{
+	for(std::map<ProgramTicket, PendingProgram>::iterator it = m_Pending.begin(); it != m_Pending.end(); ++it){
+		glDeleteShader(it->second.shaders[0]);
+		glDeleteShader(it->second.shaders[1]);
+		forgetProgram(it->second.program);
+		glDeleteProgram(it->second.program);
+	}
+	m_Pending.clear();
+	m_Failed.clear();
+	for(std::map<ProgramTicket, GLuint>::iterator it = m_Programs.begin(); it != m_Programs.end(); ++it){
+		forgetProgram(it->second);
+		glDeleteProgram(it->second);
+	}
+	m_Programs.clear();
+	invalidateGLState();
+}
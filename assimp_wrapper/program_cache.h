@@ -0,0 +1,100 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <map>
+#include <set>
+
+struct ProgramCacheStats
+{
+	unsigned long requests; //program() and submit() calls
+	unsigned long compiled; //programs built from source
+	unsigned long binaries; //programs loaded from the binary cache
+	unsigned long rejected; //binaries the driver refused, built again
+	unsigned long failed;   //programs that didn't compile or link
+};
+
+//Identifies a program submitted to ProgramCache
+typedef unsigned long long ProgramTicket;
+
+/* Linked shader programs, one per (vertex source, fragment source,
+   defines) for the whole process.
+
+   program() returns the program already built for the same sources, so
+   asking again is cheap and the result must not be deleted. With a
+   binary directory set and ARB_get_program_binary available, new
+   programs are first looked up on disk, keyed by a hash of the final
+   sources and the GL vendor, renderer and version strings, and loaded
+   with glProgramBinary(). Programs compiled from source are written
+   there for the next run. A binary the driver rejects, e.g. after a
+   driver update that kept the version string, is compiled from source
+   and replaced.
+
+   submit() starts a program without waiting for it: every program a
+   scene needs can be handed to the driver up front, and compile in
+   parallel where KHR_parallel_shader_compile is supported. poll() once
+   a frame finishes those the driver is done with, and resolve() gives
+   a fallback until then, so frames keep coming. Only use it from the
+   thread owning the GL context. */
+struct ProgramCache
+{
+	ProgramCache();
+	//Leaves GL objects alone, the context may be gone. See releaseGL()
+	~ProgramCache();
+
+	//Build or look up a program, waiting until it is linked
+	GLuint program(const std::string& vertexPath, const std::string& fragmentPath,
+				   const std::string& defines = "");
+	ProgramTicket submit(const std::string& vertexPath, const std::string& fragmentPath,
+						 const std::string& defines = "");
+	//Program of 'ticket' if it is built and linked, or 'fallback'.
+	//Never blocks
+	GLuint resolve(ProgramTicket ticket, GLuint fallback) const;
+	//Program of 'ticket', finishing it first if needed
+	GLuint wait(ProgramTicket ticket);
+	/* Finish submitted programs the driver is done with. Without
+	   KHR_parallel_shader_compile that can't be told without waiting,
+	   so only one is finished per call */
+	void poll();
+	size_t pendingCount() const { return m_Pending.size(); }
+	//Directory for program binaries, created if missing. Empty (the
+	//default) turns the disk cache off
+	void setBinaryDirectory(const std::string& directory);
+	//Delete every program. Later calls build them again
+	void releaseGL();
+
+	const ProgramCacheStats& getStats() const { return m_Stats; }
+
+	//Cache shared by the whole program, created on first use
+	static ProgramCache& shared();
+
+private:
+	ProgramCache(const ProgramCache&);
+	ProgramCache& operator=(const ProgramCache&);
+	const std::string& source(const std::string& path);
+	GLuint loadBinary(const std::string& file, const std::string& driver);
+	void saveBinary(GLuint program, const std::string& file, const std::string& driver);
+
+	struct PendingProgram
+	{
+		GLuint program;
+		GLuint shaders[2];
+		std::string binaryFile; //empty if not saved
+		std::string driver;
+	};
+	void finish(ProgramTicket ticket);
+
+	//Built programs by the hash of their final sources and the driver
+	//string, which is also their ticket
+	std::map<ProgramTicket, GLuint> m_Programs;
+	std::map<ProgramTicket, PendingProgram> m_Pending;
+	std::set<ProgramTicket> m_Failed;
+	bool m_ThreadsSet;
+	//Shader files read so far, by path
+	std::map<std::string, std::string> m_Sources;
+	std::string m_Directory;
+	ProgramCacheStats m_Stats;
+};
+
+#endif
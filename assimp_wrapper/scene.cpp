@@ -1,22 +1,88 @@
 #include <assert.h>
 #include <stdexcept>
+#include <limits>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "scene.h"
 #include "png_loader.h"
 #include "glstuff.h"
+#include "profiler.h"
+#include "threadpool.h"
+#include "texture_cache.h"
+#include "mapped_io.h"
 
-Scene::Scene(const std::string& path)
+Scene::Scene(const std::string& path, bool uploadGL)
+	: Scene(path, ImportProfile(), uploadGL)
 {
-	m_Scene = importScene(path);
+}
+
+Scene::Scene(const std::string& path, const ImportProfile& profile, bool uploadGL)
+{
+	PROFILE_SCOPE("Scene::load");
+	m_UploadGL = uploadGL;
+	m_PoseCacheEnabled = true;
+	m_PoseQuantum = 0.0f;
+	AnimLOD full = { 0.0f, 1, -1 };
+	m_LODs.assign(1, full);
+	m_NextLODPhase = 0;
+	m_LODScale = 1.0f;
+	m_LODBudgetMs = 0.0f;
+	m_ParallelThreshold = 2048;
+	m_OwnsScene = true;
+	size_t slash = path.find_last_of("/\\");
+	if(slash != std::string::npos)
+		m_Directory = path.substr(0, slash + 1);
+	//Model files can be hundreds of megabytes, map them instead of
+	//copying them through stdio
+	MappedFileIO io;
+	m_Scene = profile.import(path, io.get());
 	if(!m_Scene){
 		std::runtime_error e("Couldn't load model file.");
 		throw e;
 	}
 	
 	initGLModelData();
+	initNodeData();
+	initPackedChannels();
+}
+
+Scene::Scene(const aiScene* scene, bool uploadGL)
+{
+	PROFILE_SCOPE("Scene::load");
+	m_UploadGL = uploadGL;
+	m_PoseCacheEnabled = true;
+	m_PoseQuantum = 0.0f;
+	AnimLOD full = { 0.0f, 1, -1 };
+	m_LODs.assign(1, full);
+	m_NextLODPhase = 0;
+	m_LODScale = 1.0f;
+	m_LODBudgetMs = 0.0f;
+	m_ParallelThreshold = 2048;
+	m_OwnsScene = false;
+	m_Scene = scene;
+	if(!m_Scene){
+		std::runtime_error e("No scene given.");
+		throw e;
+	}
+
+	initGLModelData();
+	initNodeData();
+	initPackedChannels();
 }
+
 Scene::~Scene()
 {
-	aiReleaseImport(m_Scene);
+	//Instances own their renderer table, so run their destructors.
+	//The memory itself goes with m_AnimPool, m_Palettes and m_Arena
+	for(size_t i = 0; i < m_AnimData.size(); ++i)
+		m_AnimPool.destroy(m_AnimData[i]);
+	for(size_t i = 0; i < m_MeshData.size(); ++i)
+		for(int j = 0; j < MeshGLData::NUM_TEXTURES; ++j)
+			TextureCache::shared().release(m_MeshData[i]->textures[j]);
+	if(m_OwnsScene)
+		aiReleaseImport(m_Scene);
 }
 
 const aiScene* Scene::getScene() const 
@@ -39,29 +105,41 @@ const MeshGLData* Scene::getMeshGLData(int idx) const
 	return m_MeshData[idx];
 }
 	
-const aiScene* Scene::importScene(const std::string& path)
+//Copy a vertex attribute array in the order given by 'order'
+template<class T>
+static std::vector<T> reorderVertices(const T* data, const std::vector<unsigned int>& order)
+{
+	std::vector<T> result(order.size());
+	for(unsigned int i = 0; i < order.size(); ++i)
+		result[i] = data[order[i]];
+	return result;
+}
+
+//Upload a vertex attribute, in influence order if the mesh was sorted
+template<class T>
+static GLuint createVertexVBO(const T* data, unsigned int len, const std::vector<unsigned int>& order)
 {
-	const aiScene* assimpScene = 0;
-	assimpScene = aiImportFile( path.c_str(), 
-								aiProcess_CalcTangentSpace       | 
-								aiProcess_Triangulate            |
-								aiProcess_JoinIdenticalVertices  |
-								aiProcess_SortByPType); // aiProcess_FlipUVs
-	return assimpScene;
+	if(order.empty())
+		return createVBO(data, len);
+	std::vector<T> sorted = reorderVertices(data, order);
+	return createVBO(&sorted[0], len);
 }
 
 void Scene::initGLModelData()
 {
 	assert(m_Scene != 0);
+	m_VertexOrder.resize(m_Scene->mNumMeshes);
+	m_MeshMorphs.resize(m_Scene->mNumMeshes);
+	m_NumMorphMeshes = 0;
 	for(int i = 0; i < m_Scene->mNumMeshes; ++i){
-		MeshGLData* glData = new MeshGLData;
+		MeshGLData* glData = m_Arena.create<MeshGLData>();
 		const aiMesh* mesh = m_Scene->mMeshes[i];
 		std::string name(mesh->mName.C_Str());
 
 		//Assimp supports multiple primitives, but we only want
 		//triangles. So we have to convert it into a simple 1D array
 		unsigned int numVertexIndices = mesh->mNumFaces * 3;
-		unsigned int* indexArrayTmp = new unsigned int[numVertexIndices];
+		std::vector<unsigned int> indexArrayTmp(numVertexIndices);
 		for(int j = 0; j < mesh->mNumFaces; ++j){
 			const aiFace& face = mesh->mFaces[j];
 			//assert(face.mNumIndices == 3);
@@ -79,34 +157,18 @@ void Scene::initGLModelData()
 		glData->tcoord1    = ~0u;
 		glData->tcoord2    = ~0u;
 		glData->tcoord3    = ~0u;
-
-		glData->vao = createVAO();
-		glData->vertices   = createVBO(mesh->mVertices, mesh->mNumVertices);
-		if(mesh->HasNormals())
-			glData->normals    = createVBO(mesh->mNormals, mesh->mNumVertices);
-		if(mesh->HasTangentsAndBitangents()){
-			glData->tangents   = createVBO(mesh->mTangents, mesh->mNumVertices);
-			glData->bitangents = createVBO(mesh->mBitangents, mesh->mNumVertices);
+		for(int j = 0; j < MeshGLData::NUM_INFLUENCE_RANGES; ++j){
+			glData->influenceFirst[j] = 0;
+			glData->influenceCount[j] = 0;
 		}
-		glData->indices    = createVBO(indexArrayTmp, numVertexIndices);
-		//used by glDrawElements in the renderer
-		glData->numElements = numVertexIndices;
-
 
-		unsigned int numUVMaps = mesh->GetNumUVChannels();
-		if(numUVMaps > Scene::MAX_UVMAPS) numUVMaps = MAX_UVMAPS;
-		//assert(numUVMaps > 0);
-	
-		switch(numUVMaps){
-		case 4:	
-			glData->tcoord3 = createVBO(mesh->mTextureCoords[3], mesh->mNumVertices);
-		case 3:
-			glData->tcoord2 = createVBO(mesh->mTextureCoords[2], mesh->mNumVertices);
-		case 2:
-			glData->tcoord1 = createVBO(mesh->mTextureCoords[1], mesh->mNumVertices);
-		case 1:
-			glData->tcoord0 = createVBO(mesh->mTextureCoords[0], mesh->mNumVertices);
-		}
+		glData->vao = ~0u;
+		glData->vertices = ~0u;
+		glData->indices = ~0u;
+		for(int j = 0; j < MeshGLData::NUM_TEXTURES; ++j)
+			glData->textures[j] = ~0u;
+		if(m_UploadGL)
+			glData->vao = createVAO();
 
 		/* How to compute the indices to the matrices and the weights?
 		   We know that each mesh has its own skeleton, if any. It's
@@ -128,21 +190,103 @@ void Scene::initGLModelData()
 		   2.) When later computing bone matrices, associate 'j' with
 		   the node belonging to mBones[j]
 
+		   initGLBoneData() also sorts the vertices by influence count
+		   and remaps indexArrayTmp, so the other vertex attributes
+		   must be uploaded after it, in the order it chose.
 		 */
 		if(mesh->HasBones()){
-			initGLBoneData(glData, i);
+			initGLBoneData(glData, i, indexArrayTmp);
 		} else {
 			//0xffffffff means "no vbo"
 			glData->boneIndices = ~0u;
 			glData->weights = ~0u;
+			//Everything is drawn with the no-skinning variant
+			glData->influenceCount[0] = numVertexIndices;
 		}
-
+		//used by glDrawElements in the renderer
+		glData->numElements = numVertexIndices;
+		AttribSignature& signature = glData->signature;
+		signature.normals = mesh->HasNormals();
+		signature.tangents = mesh->HasTangentsAndBitangents();
+		signature.numUVMaps = std::min(mesh->GetNumUVChannels(), (unsigned int)Scene::MAX_UVMAPS);
+		signature.bonesPerVertex = 0;
+		for(int j = 1; j < MeshGLData::NUM_INFLUENCE_RANGES; ++j)
+			if(glData->influenceCount[j]) signature.bonesPerVertex = j;
+		//Morph targets need the final vertex order, so after the bones
+		if(mesh->mNumAnimMeshes){
+			buildMeshMorph(m_Arena, mesh, m_VertexOrder[i], m_MeshMorphs[i]);
+			++m_NumMorphMeshes;
+		}
+		//Only registers the paths, files are read on first draw
+		initMaterialTextures(glData, mesh);
 		//Add new GL mesh data to list
 		m_MeshData.push_back(glData);
+		if(!m_UploadGL)
+			continue;
+
+		const std::vector<unsigned int>& order = m_VertexOrder[i];
+
+		glData->vertices   = createVertexVBO(mesh->mVertices, mesh->mNumVertices, order);
+		if(mesh->HasNormals())
+			glData->normals    = createVertexVBO(mesh->mNormals, mesh->mNumVertices, order);
+		if(mesh->HasTangentsAndBitangents()){
+			glData->tangents   = createVertexVBO(mesh->mTangents, mesh->mNumVertices, order);
+			glData->bitangents = createVertexVBO(mesh->mBitangents, mesh->mNumVertices, order);
+		}
+		glData->indices    = createVBO(&indexArrayTmp[0], numVertexIndices);
+
+
+		switch(signature.numUVMaps){
+		case 4:	
+			glData->tcoord3 = createVertexVBO(mesh->mTextureCoords[3], mesh->mNumVertices, order);
+		case 3:
+			glData->tcoord2 = createVertexVBO(mesh->mTextureCoords[2], mesh->mNumVertices, order);
+		case 2:
+			glData->tcoord1 = createVertexVBO(mesh->mTextureCoords[1], mesh->mNumVertices, order);
+		case 1:
+			glData->tcoord0 = createVertexVBO(mesh->mTextureCoords[0], mesh->mNumVertices, order);
+		}
 	}	
 }
 
-void Scene::initGLBoneData(MeshGLData* gldata, int meshID)
+//Texture path from a material, relative to the model's directory.
+//Returns an empty string for textures embedded in the file ("*0")
+static std::string resolveTexturePath(const std::string& directory, const aiString& file)
+{
+	std::string path(file.C_Str());
+	if(path.empty() || path[0] == '*')
+		return std::string();
+	std::replace(path.begin(), path.end(), '\\', '/');
+	while(path.compare(0, 2, "./") == 0)
+		path.erase(0, 2);
+	bool absolute = path[0] == '/' || (path.size() > 1 && path[1] == ':');
+	return absolute ? path : directory + path;
+}
+
+void Scene::initMaterialTextures(MeshGLData* gldata, const aiMesh* mesh)
+{
+	if(mesh->mMaterialIndex >= m_Scene->mNumMaterials) return;
+	const aiMaterial* material = m_Scene->mMaterials[mesh->mMaterialIndex];
+	//Height maps stand in for normal maps, as OBJ files call them bump
+	static const aiTextureType types[MeshGLData::NUM_TEXTURES][2] = {
+		{ aiTextureType_DIFFUSE, aiTextureType_DIFFUSE },
+		{ aiTextureType_NORMALS, aiTextureType_HEIGHT },
+		{ aiTextureType_SPECULAR, aiTextureType_SPECULAR }
+	};
+	for(int i = 0; i < MeshGLData::NUM_TEXTURES; ++i){
+		for(int j = 0; j < 2 && gldata->textures[i] == ~0u; ++j){
+			aiString file;
+			if(material->GetTexture(types[i][j], 0, &file) != AI_SUCCESS)
+				continue;
+			std::string path = resolveTexturePath(m_Directory, file);
+			//Only the diffuse map holds color, the others linear data
+			if(!path.empty())
+				gldata->textures[i] = TextureCache::shared().acquire(path, i == MeshGLData::TEXTURE_DIFFUSE);
+		}
+	}
+}
+
+void Scene::initGLBoneData(MeshGLData* gldata, int meshID, std::vector<unsigned int>& indices)
 {
 	std::vector<std::vector<float> > weightArray; //one weight per bone
 	std::vector<std::vector<unsigned int> > boneArray; //one index per bone found
@@ -197,19 +341,74 @@ void Scene::initGLBoneData(MeshGLData* gldata, int meshID)
 	
 #endif
 
+	/* Sort the vertices by influence count, so every range can be
+	   drawn with a shader variant compiled for exactly that many bones.
+	   Vertices without any weights still go through the one-bone
+	   variant, just like they did through the generic shader. */
+	std::vector<unsigned int> influences(mesh->mNumVertices);
+	for(int i = 0; i < mesh->mNumVertices; ++i){
+		int count = std::min<int>(boneArray[i].size(), Scene::MAXBONESPERVERTEX);
+		influences[i] = std::max(count, 1);
+	}
+	std::vector<unsigned int>& order = m_VertexOrder[meshID];
+	order.resize(mesh->mNumVertices);
+	for(unsigned int i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(),
+		[&influences](unsigned int v1, unsigned int v2) -> bool {
+			return influences[v1] < influences[v2];
+		});
+	std::vector<unsigned int> remap(mesh->mNumVertices);
+	for(unsigned int i = 0; i < order.size(); ++i)
+		remap[order[i]] = i;
+
+	/* Then sort the triangles by the largest influence count among
+	   their vertices, and record one index range per count */
+	unsigned int numTriangles = indices.size() / 3;
+	std::vector<unsigned int> triangleInfluences(numTriangles);
+	std::vector<unsigned int> triangleOrder(numTriangles);
+	for(unsigned int i = 0; i < numTriangles; ++i){
+		unsigned int n = 0;
+		for(int j = 0; j < 3; ++j){
+			unsigned int& idx = indices[i*3 + j];
+			n = std::max(n, influences[idx]);
+			idx = remap[idx];
+		}
+		triangleInfluences[i] = n;
+		triangleOrder[i] = i;
+	}
+	std::stable_sort(triangleOrder.begin(), triangleOrder.end(),
+		[&triangleInfluences](unsigned int t1, unsigned int t2) -> bool {
+			return triangleInfluences[t1] < triangleInfluences[t2];
+		});
+	std::vector<unsigned int> sortedIndices(indices.size());
+	for(unsigned int i = 0; i < numTriangles; ++i){
+		unsigned int t = triangleOrder[i];
+		sortedIndices[i*3 + 0] = indices[t*3 + 0];
+		sortedIndices[i*3 + 1] = indices[t*3 + 1];
+		sortedIndices[i*3 + 2] = indices[t*3 + 2];
+		gldata->influenceCount[triangleInfluences[t]] += 3;
+	}
+	indices.swap(sortedIndices);
+	unsigned int first = 0;
+	for(int i = 0; i < MeshGLData::NUM_INFLUENCE_RANGES; ++i){
+		gldata->influenceFirst[i] = first;
+		first += gldata->influenceCount[i];
+	}
+
 	std::vector<unsigned int> boneArrayFinal;
 	std::vector<float> weightArrayFinal;
 
 	boneArrayFinal.resize(mesh->mNumVertices * Scene::MAXBONESPERVERTEX);
 	weightArrayFinal.resize(mesh->mNumVertices * Scene::MAXBONESPERVERTEX);
 
-	/* Finally, create a flat array for OpenGL
+	/* Finally, create a flat array for OpenGL, in sorted vertex order
 	   OBS: Currently this code expects Scene::MAXBONESPERVERTEX to be 4!
 	*/
 	for(int i = 0; i < mesh->mNumVertices; ++i){
 		int idx = i*Scene::MAXBONESPERVERTEX;
-		const std::vector<unsigned int>& ba = boneArray[i];
-		const std::vector<float>& wa = weightArray[i];
+		const std::vector<unsigned int>& ba = boneArray[order[i]];
+		const std::vector<float>& wa = weightArray[order[i]];
 		assert(ba.size() <= Scene::MAXBONESPERVERTEX);
 		assert(wa.size() <= Scene::MAXBONESPERVERTEX);
 		assert(ba.size() == wa.size());
@@ -224,82 +423,377 @@ void Scene::initGLBoneData(MeshGLData* gldata, int meshID)
 			weightArrayFinal[idx + j] = wa[j];
 		}
 	}
+	gldata->boneIndices = ~0u;
+	gldata->weights = ~0u;
+	if(!m_UploadGL)
+		return;
 	gldata->boneIndices = createVBO(&boneArrayFinal[0], mesh->mNumVertices * 4);
 	gldata->weights = createVBO(&weightArrayFinal[0], mesh->mNumVertices * 4);
 }
 
 AnimGLData* Scene::createAnimation(const std::string& name, const aiMatrix4x4& camera)
 {
-	AnimGLData* animation = new AnimGLData;
-	animation->m_Scene = this;
-	animation->m_Animation = 0;
-	//animation->m_Renderer = 0;
-	animation->m_Bones.resize(m_Scene->mNumMeshes);
-	animation->m_ModelView.resize(m_Scene->mNumMeshes);
-	animation->m_Time = 0.0f;
-	animation->m_Camera = camera;
-	
-	
 	/* Linear search for animation name */
 	for(int i = 0; i < m_Scene->mNumAnimations; ++i){
-		std::string animName(m_Scene->mAnimations[i]->mName.C_Str());
-		if(animName == name){
-			animation->m_Animation = m_Scene->mAnimations[i];
-			break;
-		}
+		if(name == m_Scene->mAnimations[i]->mName.C_Str())
+			return createAnimation((unsigned int)i, camera);
 	}
-	if(!animation->m_Animation)
-		return 0;
-	assert(animation->m_Animation != 0);
-	
-
-	/* Resize bone array for each model properly */
-	for(int i = 0; i < m_Scene->mNumMeshes; ++i){
-		//Set the number of bones to the max limit
-		//GLSL requires an array of constant size
-		int numBones = Scene::MAXBONESPERMESH; //m_Scene->mMeshes[i]->mNumBones;
-		animation->m_Bones[i].resize(numBones);
-	}	
-	
-	//Initial update of all the matrices in the node structure, so the
-	//first rendered frame works. Implicitly reads animation->m_Time,
-	//which starts at 0.0f
-	aiMatrix4x4 rootMatrix;
-	animation->recursiveUpdate(m_Scene->mRootNode, rootMatrix);
-	return animation;
+	return 0;
 }
 
 
 AnimGLData* Scene::createAnimation(unsigned int anim, const aiMatrix4x4& camera)
 {
-	AnimGLData* animation = new AnimGLData;
+	if(anim >= m_Scene->mNumAnimations)
+		return 0;
+
+	AnimGLData* animation = m_AnimPool.create();
+	animation->m_InstanceIndex = m_AnimData.size();
+	m_AnimData.push_back(animation);
 	animation->m_Scene = this;
-	animation->m_Animation = 0;
-	//animation->m_Renderer = 0;
-	animation->m_Bones.resize(m_Scene->mNumMeshes);
-	animation->m_ModelView.resize(m_Scene->mNumMeshes);
+	animation->m_Animation = m_Scene->mAnimations[anim];
+	animation->m_AnimIndex = anim;
+	animation->m_NodeChannels = &m_NodeChannels[anim];
+	animation->m_AnimatedNodes = &m_AnimatedNodes[anim];
+	animation->m_NodeLanes = &m_NodeLanes[anim];
+	animation->m_PackedChannels = &m_PackedChannels[anim];
+	animation->m_MorphChannels = &m_MorphChannels[anim];
+	animation->m_Morphs.resize(m_Scene->mNumMeshes);
+	for(unsigned int i = 0; i < m_Scene->mNumMeshes; ++i){
+		const MeshMorph& morph = m_MeshMorphs[i];
+		if(morph.targets.empty()) continue;
+		AnimMorphState& ms = animation->m_Morphs[i];
+		ms.weights.assign(morph.targets.size(), 0.0f);
+		ms.previous.assign(morph.targets.size(), 0.0f);
+		ms.positions = morph.basePositions;
+		ms.normals = morph.baseNormals;
+		ms.positionVBO = ms.normalVBO = ~0u;
+		ms.active = false;
+		if(m_UploadGL){
+			ms.positionVBO = createStreamVBO(&ms.positions[0], ms.positions.size());
+			if(!ms.normals.empty())
+				ms.normalVBO = createStreamVBO(&ms.normals[0], ms.normals.size());
+		}
+	}
+	animation->m_Batch.resize(m_AnimatedNodes[anim].size());
+	animation->setInterpolation(INTERPOLATE_SLERP);
+	animation->m_Renderer.resize(m_Scene->mNumMeshes, 0);
+	animation->m_PaletteSlot = m_Palettes.acquire();
+	animation->m_PoseSlot = animation->m_PaletteSlot;
+	animation->m_OwnsPoseKey = false;
+	animation->m_LOD = 0;
+	animation->m_LODPhase = m_NextLODPhase++;
+	animation->m_HasLODSlots = false;
+	animation->m_LODPrimed = false;
+	animation->m_LODStep = 0;
+	animation->m_LODUpdateStep = 0;
+	m_PoseCache.reserve(m_AnimData.size());
 	animation->m_Time = 0.0f;
 	animation->m_Camera = camera;
-	animation->m_Animation = m_Scene->mAnimations[anim];
+	if(m_NumNodes >= m_ParallelThreshold)
+		animation->m_NodeGlobals.resize(m_NumNodes);
 
 	assert(animation->m_Animation != 0);
 
-	/* Resize bone array for each model properly */
-	for(int i = 0; i < m_Scene->mNumMeshes; ++i){
-		//Set the number of bones to the max limit
-		//GLSL requires an array of constant size
-		int numBones = Scene::MAXBONESPERMESH; //m_Scene->mMeshes[i]->mNumBones;
-		animation->m_Bones[i].resize(numBones);
-	}	
+	//Every mesh gets the max number of bones, GLSL requires an
+	//array of constant size
+	animation->setSkinningMode(SKIN_LINEAR);
+	for(int i = 0; i < m_Scene->mNumMeshes; ++i)
+		animation->getModelView(i) = aiMatrix4x4();
 	
-	//Initial update of all the matrices in the node structure, so the
-	//first rendered frame works. Implicitly reads animation->m_Time,
-	//which starts at 0.0f
-	aiMatrix4x4 rootMatrix;
-	animation->recursiveUpdate(m_Scene->mRootNode, rootMatrix);
+	//Pose at time 0, so the first rendered frame works before the
+	//first step. Goes through the channel batch like a step does
+	animation->evaluatePose();
 	return animation;
 }
 
+void Scene::setPoseCache(bool enable, float quantum)
+{
+	m_PoseCacheEnabled = enable;
+	m_PoseQuantum = quantum;
+}
+
+const PoseCacheStats& Scene::getPoseCacheStats() const
+{
+	return m_PoseCache.stats();
+}
+
+void Scene::resetPoseCacheStats()
+{
+	m_PoseCache.resetStats();
+}
+
+static bool lodCloser(const AnimLOD& a, const AnimLOD& b)
+{
+	return a.distance < b.distance;
+}
+
+void Scene::setAnimationLODs(const std::vector<AnimLOD>& lods)
+{
+	m_LODs = lods;
+	std::stable_sort(m_LODs.begin(), m_LODs.end(), lodCloser);
+	//The level is part of the pose cache key, which has 8 bits for it
+	if(m_LODs.size() > 256) m_LODs.resize(256);
+	if(m_LODs.empty()){
+		AnimLOD full = { 0.0f, 1, -1 };
+		m_LODs.push_back(full);
+	}
+	m_LODs[0].distance = 0.0f;
+	for(size_t i = 0; i < m_LODs.size(); ++i)
+		if(m_LODs[i].interval < 1) m_LODs[i].interval = 1;
+	for(size_t i = 0; i < m_AnimData.size(); ++i){
+		AnimGLData* a = m_AnimData[i];
+		a->releasePose();
+		a->m_LOD = std::min(a->m_LOD, (unsigned int)m_LODs.size() - 1);
+		a->m_LODPrimed = false;
+	}
+}
+
+void Scene::setParallelThreshold(unsigned int nodes)
+{
+	m_ParallelThreshold = nodes;
+	//Instances need room for the node matrices before their next step
+	for(size_t i = 0; i < m_AnimData.size(); ++i)
+		if(m_NumNodes >= nodes)
+			m_AnimData[i]->m_NodeGlobals.resize(m_NumNodes);
+}
+
+void Scene::setAnimationBudget(float ms)
+{
+	m_LODBudgetMs = ms;
+	if(ms <= 0.0f) m_LODScale = 1.0f;
+}
+
+void Scene::updateLOD(const aiVector3D& eye, float frameMs)
+{
+	static const float MAX_LOD_SCALE = 16.0f;
+	//Step the scale a little each frame, so the levels don't flip back
+	//and forth around the budget
+	if(m_LODBudgetMs > 0.0f){
+		if(frameMs > m_LODBudgetMs)
+			m_LODScale = std::min(m_LODScale * 1.25f, MAX_LOD_SCALE);
+		else if(frameMs < m_LODBudgetMs * 0.8f)
+			m_LODScale = std::max(m_LODScale / 1.25f, 1.0f);
+	}
+
+	for(size_t i = 0; i < m_AnimData.size(); ++i){
+		AnimGLData* a = m_AnimData[i];
+		const aiMatrix4x4& w = a->m_World;
+		float distance = aiVector3D(w.a4 - eye.x, w.b4 - eye.y, w.c4 - eye.z).Length() * m_LODScale;
+		unsigned int level = 0;
+		while(level + 1 < m_LODs.size() && distance >= m_LODs[level + 1].distance)
+			++level;
+		if(level == a->m_LOD) continue;
+
+		//The blend history is only valid for the interval it was made at
+		if(m_LODs[level].interval != m_LODs[a->m_LOD].interval)
+			a->m_LODPrimed = false;
+		a->releasePose();
+		a->m_LOD = level;
+	}
+}
+
+/* Copy key times and values into separate float arrays from the arena.
+   'components' values per key are read from each key's mValue */
+template<typename Key>
+static void packKeys(Arena& arena, const Key* keys, unsigned int numKeys, int components,
+					 const float*& times, const float*& values)
+{
+	unsigned int padded = (numKeys + 3) & ~3u;
+	float* t = (float*)arena.allocate(sizeof(float) * padded, 16);
+	float* v = (float*)arena.allocate(sizeof(float) * numKeys * components, 16);
+	for(unsigned int i = 0; i < numKeys; ++i){
+		t[i] = (float)keys[i].mTime;
+		const float* value = (const float*)&keys[i].mValue;
+		for(int c = 0; c < components; ++c)
+			v[i * components + c] = value[c];
+	}
+	for(unsigned int i = numKeys; i < padded; ++i)
+		t[i] = std::numeric_limits<float>::infinity();
+	times = t;
+	values = v;
+}
+
+void Scene::initPackedChannels()
+{
+	m_PackedChannels.resize(m_Scene->mNumAnimations);
+	for(int a = 0; a < m_Scene->mNumAnimations; ++a){
+		const std::vector<unsigned int>& nodes = m_AnimatedNodes[a];
+		m_PackedChannels[a].resize(nodes.size());
+		for(unsigned int lane = 0; lane < nodes.size(); ++lane){
+			const aiNodeAnim* nodeAnim = m_NodeChannels[a][nodes[lane]];
+			PackedChannel& pc = m_PackedChannels[a][lane];
+			pc.numPositionKeys = nodeAnim->mNumPositionKeys;
+			pc.numRotationKeys = nodeAnim->mNumRotationKeys;
+			pc.numScalingKeys = nodeAnim->mNumScalingKeys;
+			//aiQuaternion is w, x, y, z, aiVector3D is x, y, z
+			packKeys(m_Arena, nodeAnim->mPositionKeys, pc.numPositionKeys, 3, pc.positionTimes, pc.positionValues);
+			packKeys(m_Arena, nodeAnim->mRotationKeys, pc.numRotationKeys, 4, pc.rotationTimes, pc.rotationValues);
+			packKeys(m_Arena, nodeAnim->mScalingKeys, pc.numScalingKeys, 3, pc.scalingTimes, pc.scalingValues);
+		}
+	}
+}
+
+void Scene::destroyAnimation(AnimGLData* animation)
+{
+	if(!animation) return;
+	//Swap with the last instance, so removal is O(1)
+	unsigned int idx = animation->m_InstanceIndex;
+	assert(idx < m_AnimData.size() && m_AnimData[idx] == animation);
+	m_AnimData[idx] = m_AnimData.back();
+	m_AnimData[idx]->m_InstanceIndex = idx;
+	m_AnimData.pop_back();
+	animation->releasePose();
+	if(m_UploadGL){
+		for(size_t i = 0; i < animation->m_Morphs.size(); ++i){
+			deleteVBO(animation->m_Morphs[i].positionVBO);
+			deleteVBO(animation->m_Morphs[i].normalVBO);
+		}
+	}
+	m_Palettes.release(animation->m_PaletteSlot);
+	if(animation->m_HasLODSlots){
+		m_Palettes.release(animation->m_LODSlots[0]);
+		m_Palettes.release(animation->m_LODSlots[1]);
+	}
+	m_AnimPool.destroy(animation);
+}
+
+/* Number the nodes in the order recursiveUpdate() visits them
+   (pre-order), so per-node data can be stored in flat arrays */
+static void collectNodes(const aiNode* node, unsigned int depth, std::vector<const aiNode*>& nodes,
+						 std::vector<unsigned int>& depths)
+{
+	nodes.push_back(node);
+	depths.push_back(depth);
+	for(int i = 0; i < node->mNumChildren; ++i)
+		collectNodes(node->mChildren[i], depth + 1, nodes, depths);
+}
+
+/* Parent index of every node, numbered like collectNodes() */
+static void collectParents(const aiNode* node, int parent, unsigned int& nodeIndex, std::vector<int>& parents)
+{
+	unsigned int index = nodeIndex++;
+	parents.push_back(parent);
+	for(int i = 0; i < node->mNumChildren; ++i)
+		collectParents(node->mChildren[i], index, nodeIndex, parents);
+}
+
+/* recursiveUpdate() writes a mesh's world matrix after visiting the
+   node's children, and a mesh referenced twice keeps the last write.
+   Replay that order, so the level by level path picks the same node */
+static void collectMeshNodes(const aiNode* node, unsigned int& nodeIndex, std::vector<int>& meshNodes)
+{
+	unsigned int index = nodeIndex++;
+	for(int i = 0; i < node->mNumChildren; ++i)
+		collectMeshNodes(node->mChildren[i], nodeIndex, meshNodes);
+	for(int i = 0; i < node->mNumMeshes; ++i)
+		meshNodes[node->mMeshes[i]] = index;
+}
+
+/* Meshes in the order recursiveUpdate() used to draw them: children
+   before their parent */
+static void collectMeshes(const aiNode* node, std::vector<unsigned int>& meshes)
+{
+	for(int i = 0; i < node->mNumChildren; ++i)
+		collectMeshes(node->mChildren[i], meshes);
+	for(int i = 0; i < node->mNumMeshes; ++i)
+		meshes.push_back(node->mMeshes[i]);
+}
+
+void Scene::initNodeData()
+{
+	std::vector<const aiNode*>& nodes = m_Nodes;
+	collectNodes(m_Scene->mRootNode, 0, nodes, m_NodeDepth);
+	m_NumNodes = nodes.size();
+	collectMeshes(m_Scene->mRootNode, m_MeshDrawOrder);
+
+	//Nodes grouped by depth, in pre-order within a level. A node only
+	//depends on its parent, so a level can be evaluated in any order
+	//once the one above it is done
+	unsigned int nodeIndex = 0;
+	collectParents(m_Scene->mRootNode, -1, nodeIndex, m_NodeParent);
+	unsigned int numLevels = 0;
+	for(unsigned int i = 0; i < m_NumNodes; ++i)
+		numLevels = std::max(numLevels, m_NodeDepth[i] + 1);
+	m_LevelStart.assign(numLevels + 1, 0);
+	for(unsigned int i = 0; i < m_NumNodes; ++i)
+		++m_LevelStart[m_NodeDepth[i] + 1];
+	for(unsigned int d = 0; d < numLevels; ++d)
+		m_LevelStart[d + 1] += m_LevelStart[d];
+	m_LevelNodes.resize(m_NumNodes);
+	std::vector<unsigned int> fill(m_LevelStart.begin(), m_LevelStart.end() - 1);
+	for(unsigned int i = 0; i < m_NumNodes; ++i)
+		m_LevelNodes[fill[m_NodeDepth[i]]++] = i;
+	m_MeshNode.assign(m_Scene->mNumMeshes, -1);
+	nodeIndex = 0;
+	collectMeshNodes(m_Scene->mRootNode, nodeIndex, m_MeshNode);
+
+	//Bones per node. Same content as m_LUTBone, but indexed by node
+	m_NodeBones.resize(m_NumNodes);
+	for(unsigned int i = 0; i < m_NumNodes; ++i){
+		std::map<const aiNode*, std::vector<NodeMeshBoneIndex> >::const_iterator it = m_LUTBone.find(nodes[i]);
+		if(it != m_LUTBone.end())
+			m_NodeBones[i] = it->second;
+	}
+
+	//Channel per node and animation. Like the old linear search in
+	//recursiveUpdate, the first channel with the node's name wins
+	m_NodeChannels.resize(m_Scene->mNumAnimations);
+	m_AnimatedNodes.resize(m_Scene->mNumAnimations);
+	m_NodeLanes.resize(m_Scene->mNumAnimations);
+	m_AnimRootDepth.resize(m_Scene->mNumAnimations, 0);
+	m_MorphChannels.resize(m_Scene->mNumAnimations);
+	//Morph channels name either the mesh or a node holding it
+	std::multimap<std::string, unsigned int> meshesByName;
+	for(unsigned int m = 0; m < m_Scene->mNumMeshes; ++m)
+		meshesByName.insert(std::make_pair(std::string(m_Scene->mMeshes[m]->mName.C_Str()), m));
+	for(unsigned int i = 0; i < m_NumNodes; ++i)
+		for(unsigned int m = 0; m < nodes[i]->mNumMeshes; ++m)
+			meshesByName.insert(std::make_pair(std::string(nodes[i]->mName.C_Str()), nodes[i]->mMeshes[m]));
+	for(int a = 0; a < m_Scene->mNumAnimations; ++a){
+		const aiAnimation* anim = m_Scene->mAnimations[a];
+		m_LUTAnimation.insert(std::make_pair(std::string(anim->mName.C_Str()), anim));
+
+		std::map<std::string, const aiNodeAnim*> channelByName;
+		for(int c = 0; c < anim->mNumChannels; ++c){
+			const aiNodeAnim* channel = anim->mChannels[c];
+			channelByName.insert(std::make_pair(std::string(channel->mNodeName.C_Str()), channel));
+		}
+		//First channel naming a mesh wins, like for nodes
+		m_MorphChannels[a].resize(m_Scene->mNumMeshes, 0);
+		for(unsigned int c = 0; c < anim->mNumMorphMeshChannels; ++c){
+			const aiMeshMorphAnim* channel = anim->mMorphMeshChannels[c];
+			typedef std::multimap<std::string, unsigned int>::const_iterator It;
+			std::pair<It, It> range = meshesByName.equal_range(std::string(channel->mName.C_Str()));
+			for(It it = range.first; it != range.second; ++it)
+				if(!m_MorphChannels[a][it->second])
+					m_MorphChannels[a][it->second] = channel;
+		}
+
+		std::vector<const aiNodeAnim*>& channels = m_NodeChannels[a];
+		channels.resize(m_NumNodes, 0);
+		m_NodeLanes[a].resize(m_NumNodes, -1);
+		for(unsigned int i = 0; i < m_NumNodes; ++i){
+			std::map<std::string, const aiNodeAnim*>::const_iterator it =
+				channelByName.find(std::string(nodes[i]->mName.C_Str()));
+			if(it == channelByName.end()) continue;
+			channels[i] = it->second;
+			m_NodeLanes[a][i] = m_AnimatedNodes[a].size();
+			if(m_AnimatedNodes[a].empty() || m_NodeDepth[i] < m_AnimRootDepth[a])
+				m_AnimRootDepth[a] = m_NodeDepth[i];
+			m_AnimatedNodes[a].push_back(i);
+		}
+	}
+	//One palette slot per animation instance: MAXBONESPERMESH matrices
+	//(or dual quaternions) for every mesh, then the mesh world matrices.
+	//Always sized for matrices, even if every instance skins with dual
+	//quaternions: the slab has one slot size for the whole scene, and
+	//setSkinningMode() switches an instance in place. A dual quaternion
+	//palette leaves half of its part unused, so the world matrices keep
+	//the same offset in both modes
+	m_Palettes.init(sizeof(aiMatrix4x4) * m_Scene->mNumMeshes * (MAXBONESPERMESH + 1));
+}
+
 
 
 /****************************************************************************************
@@ -398,42 +892,124 @@ void AnimRenderer::drawAllObjects(unsigned int shader)
 
 void AnimRenderer::drawBegin(unsigned int shader, int idx)
 {
-	glUseProgram(shader);
+	PROFILE_SCOPE("AnimRenderer::drawBegin");
+	useProgram(shader);
 	const aiScene* sceneData = m_Scene->m_Scene;
 	m_CurrentMesh = idx;
 	const MeshGLData* meshData = m_Scene->getMeshGLData(m_CurrentMesh);
 	bindVAO(meshData->vao);
-	bindVBOFloat(shader, "sc_vertex",     meshData->vertices,   3);
-	bindVBOFloat(shader, "sc_normal",     meshData->normals,    3);
-	bindVBOFloat(shader, "sc_tangent",    meshData->tangents,   3);
-	bindVBOFloat(shader, "sc_bitangent",  meshData->bitangents, 3);
-	bindVBOFloat(shader, "sc_tcoord0",    meshData->tcoord0,    3);
-	bindVBOFloat(shader, "sc_tcoord1",    meshData->tcoord1,    3);
-	bindVBOFloat(shader, "sc_tcoord2",    meshData->tcoord2,    3);
-	bindVBOFloat(shader, "sc_tcoord3",    meshData->tcoord3,    3);
-	bindVBOUint( shader, "sc_index",      meshData->boneIndices,4);
-	bindVBOFloat(shader, "sc_weight",     meshData->weights,    4);
+	//Meshes with active morph targets come from the instance's buffers
+	GLuint vertices = meshData->vertices;
+	GLuint normals = meshData->normals;
+	const AnimMorphState& morph = m_Parent->m_Morphs[m_CurrentMesh];
+	if(!morph.weights.empty() && morph.active){
+		vertices = morph.positionVBO;
+		if(morph.normalVBO != ~0u) normals = morph.normalVBO;
+	}
+	//Only what the mesh has. A shader asking for more reads the
+	//attribute's constant value
+	const AttribSignature& signature = meshData->signature;
+	const GLuint tcoords[Scene::MAX_UVMAPS] = {
+		meshData->tcoord0, meshData->tcoord1, meshData->tcoord2, meshData->tcoord3
+	};
+	static const char* tcoordNames[Scene::MAX_UVMAPS] = {
+		"sc_tcoord0", "sc_tcoord1", "sc_tcoord2", "sc_tcoord3"
+	};
+	bindVBOFloat(shader, "sc_vertex",     vertices,             3);
+	if(signature.normals)
+		bindVBOFloat(shader, "sc_normal",     normals,              3);
+	if(signature.tangents){
+		bindVBOFloat(shader, "sc_tangent",    meshData->tangents,   3);
+		bindVBOFloat(shader, "sc_bitangent",  meshData->bitangents, 3);
+	}
+	for(unsigned int i = 0; i < signature.numUVMaps; ++i)
+		bindVBOFloat(shader, tcoordNames[i], tcoords[i], 3);
+	if(signature.bonesPerVertex){
+		bindVBOUint( shader, "sc_index",      meshData->boneIndices,4);
+		bindVBOFloat(shader, "sc_weight",     meshData->weights,    4);
+	}
+
+	//Material textures, loaded by the cache on their first draw
+	static const char* samplers[MeshGLData::NUM_TEXTURES] = {
+		"sampler0", "sc_normalMap", "sc_specularMap"
+	};
+	for(int i = 0; i < MeshGLData::NUM_TEXTURES; ++i){
+		if(meshData->textures[i] == ~0u) continue;
+		GLuint texture = TextureCache::shared().texture(meshData->textures[i]);
+		bindTexture(GL_TEXTURE0 + i, GL_TEXTURE_2D, texture);
+		bindUniformSampler(shader, samplers[i], GL_TEXTURE0 + i);
+	}
 
 	//Bone uniform array changes every frame
-	//so it's stored in struct AnimGLData, this AnimRenderer's parent
-	int numBones = m_Parent->m_Bones[m_CurrentMesh].size();
-	const std::vector<aiMatrix4x4>& bones = m_Parent->m_Bones[m_CurrentMesh];
-	bindUniformMatrix4Array(shader, "sc_bones", numBones, &bones[0]);
-	bindUniformMatrix4(shader, "sc_modelview", m_Parent->m_ModelView[m_CurrentMesh]);
+	//so it's stored in struct AnimGLData, this AnimRenderer's parent.
+	//Static meshes have no palette to upload
+	if(signature.bonesPerVertex && m_Parent->m_SkinMode == SKIN_DUALQUAT){
+		PROFILE_SCOPE("AnimRenderer::paletteUpload");
+		//Two vec4s per bone: real part, then dual part
+		int numBones = Scene::MAXBONESPERMESH;
+		const DualQuat* bones = m_Parent->getDualQuats(m_CurrentMesh);
+		//Only count what the GL state shadow let through
+		if(bindUniformVec4Array(shader, "sc_dqbones", numBones * 2, bones[0].real))
+			PROFILE_COUNT(PROFILE_BYTES_UPLOADED, numBones * sizeof(DualQuat));
+	} else if(signature.bonesPerVertex){
+		PROFILE_SCOPE("AnimRenderer::paletteUpload");
+		int numBones = Scene::MAXBONESPERMESH;
+		const aiMatrix4x4* bones = m_Parent->getBones(m_CurrentMesh);
+		if(bindUniformMatrix4Array(shader, "sc_bones", numBones, bones))
+			PROFILE_COUNT(PROFILE_BYTES_UPLOADED, numBones * sizeof(aiMatrix4x4));
+	}
+	bindUniformMatrix4(shader, "sc_modelview", m_Parent->getModelView(m_CurrentMesh));
+	bindUniformMatrix4(shader, "sc_world", m_Parent->m_World);
 	bindUniformMatrix4(shader, "sc_camera", m_Parent->m_Camera);
 
 
-	const aiMatrix4x4& c = m_Parent->m_Camera;
-	
-	//Finally, bind the face indices
+	//Finally, bind the face indices. Drawing is left to drawEnd() or
+	//drawRange(), so the renderer can set its own uniforms first
 	bindVBOIndices(shader, meshData->indices);
-	glDrawElements(GL_TRIANGLES, meshData->numElements, GL_UNSIGNED_INT, 0);
+}
+
+unsigned int AttribSignature::pack() const
+{
+	return (normals ? 1 : 0) | (tangents ? 2 : 0) | (numUVMaps << 2) | (bonesPerVertex << 5);
+}
+
+std::string AttribSignature::defines() const
+{
+	std::string s;
+	s += normals ? "#define HAS_NORMALS 1\n" : "#define HAS_NORMALS 0\n";
+	s += tangents ? "#define HAS_TANGENTS 1\n" : "#define HAS_TANGENTS 0\n";
+	s += "#define NUM_UVMAPS " + std::to_string(numUVMaps) + "\n";
+	s += "#define NUM_INFLUENCES " + std::to_string(bonesPerVertex) + "\n";
+	return s;
 }
 
 void AnimRenderer::drawEnd(int idx)
 {
 	const MeshGLData* meshData = m_Scene->getMeshGLData(idx);
 	glDrawElements(GL_TRIANGLES, meshData->numElements, GL_UNSIGNED_INT, 0);
+	PROFILE_COUNT(PROFILE_DRAWS, 1);
+	PROFILE_COUNT(PROFILE_TRIANGLES, meshData->numElements / 3);
+}
+
+void AnimRenderer::drawRange(int idx, int influences)
+{
+	const MeshGLData* meshData = m_Scene->getMeshGLData(idx);
+	unsigned int count = meshData->influenceCount[influences];
+	if(!count) return;
+	size_t offset = meshData->influenceFirst[influences] * sizeof(unsigned int);
+	glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (const void*)offset);
+	PROFILE_COUNT(PROFILE_DRAWS, 1);
+	PROFILE_COUNT(PROFILE_TRIANGLES, count / 3);
+}
+
+unsigned int AnimRenderer::getRangeCount(int idx, int influences) const
+{
+	return m_Scene->getMeshGLData(idx)->influenceCount[influences];
+}
+
+const MeshGLData* AnimRenderer::getMeshGLData(int idx) const
+{
+	return m_Scene->getMeshGLData(idx);
 }
 
 void AnimRenderer::draw(int idx)
@@ -476,7 +1052,7 @@ int AnimGLData::addRenderer(AnimRenderer* renderer, int modelIndex)
 {
 	renderer->setParent(this);
 	renderer->setScene(m_Scene);
-	if(modelIndex < m_Renderer.size())
+	if(modelIndex >= 0 && modelIndex < m_Renderer.size())
 		m_Renderer[modelIndex] = renderer;
 	return modelIndex;
 }
@@ -498,14 +1074,14 @@ int AnimGLData::addRenderer(AnimRenderer* renderer, const std::string modelName)
 //Removes renderer attached to model with index 'modelIndex'
 void AnimGLData::removeRenderer(int modelIndex)
 {
-	m_Renderer[modelIndex] = 0;
-	//m_Renderer.erase(ModelIndex)
+	if(modelIndex >= 0 && modelIndex < m_Renderer.size())
+		m_Renderer[modelIndex] = 0;
 }
 
 
 void AnimGLData::stepAnimation(float t) //step one frame forwards
 {
-	const aiScene* sceneData = m_Scene->m_Scene;
+	PROFILE_SCOPE("AnimGLData::stepAnimation");
 	float step;
 	if(m_Animation->mTicksPerSecond != 0.0f)
 		step = m_Animation->mTicksPerSecond;
@@ -514,12 +1090,232 @@ void AnimGLData::stepAnimation(float t) //step one frame forwards
 
 	m_Time = t * step; //Used as time position by recursiveUpdate
 
-	//Run recursive node updates here, with current camera
-	recursiveUpdate(sceneData->mRootNode, m_Camera);
+	//Coarse levels evaluate now and then, and blend in between
+	if(m_Scene->m_LODs[m_LOD].interval > 1){
+		//Morph weights follow the blended pose, not m_Time
+		updateMorphs(stepLOD());
+		drawMeshes();
+		return;
+	}
+
+	//Poses are keyed by clip, time and palette format. If another
+	//instance already evaluated ours this frame, copy its palette. Only
+	//a copy is safe: the owner overwrites its slot on its next miss,
+	//and destroyAnimation() hands it to the next instance
+	unsigned long long key = 0;
+	PoseCache& cache = m_Scene->m_PoseCache;
+	if(m_Scene->m_PoseCacheEnabled){
+		unsigned int time;
+		if(m_Scene->m_PoseQuantum > 0.0f){
+			float steps = std::floor(m_Time / m_Scene->m_PoseQuantum + 0.5f);
+			m_Time = steps * m_Scene->m_PoseQuantum;
+			time = (unsigned int)(int)steps;
+		} else {
+			std::memcpy(&time, &m_Time, sizeof(time));
+		}
+		key = ((unsigned long long)m_LOD << 56) | ((unsigned long long)m_AnimIndex << 36)
+			| ((unsigned long long)m_SkinMode << 34)
+			| ((unsigned long long)m_Interpolation << 32) | time;
+		unsigned int slot;
+		if(m_OwnsPoseKey && m_PoseKey == key){
+			//Same pose as last step, our palette is still valid
+			cache.hit();
+			m_PoseSlot = m_PaletteSlot;
+			updateMorphs(m_Time);
+			drawMeshes();
+			return;
+		}
+		releasePose();
+		if(cache.find(key, slot)){
+			cache.hit();
+			const Slab& slab = m_Scene->m_Palettes;
+			std::memcpy(slab.get(m_PaletteSlot), slab.get(slot), slab.slotSize());
+			m_PoseSlot = m_PaletteSlot;
+			updateMorphs(m_Time);
+			drawMeshes();
+			return;
+		}
+		cache.miss();
+	}
+	m_PoseSlot = m_PaletteSlot;
+	evaluatePose();
+
+	if(m_Scene->m_PoseCacheEnabled){
+		cache.insert(key, m_PaletteSlot);
+		m_PoseKey = key;
+		m_OwnsPoseKey = true;
+	}
+	updateMorphs(m_Time);
+	drawMeshes();
+}
+
+/* Evaluate the pose at m_Time into the palettes at m_PoseSlot */
+void AnimGLData::evaluatePose()
+{
+	if(m_Interpolation != INTERPOLATE_CHANNEL){
+		PROFILE_SCOPE("AnimGLData::interpolate");
+		gatherChannels();
+		blendChannels(m_Batch, m_Interpolation == INTERPOLATE_NLERP ? BLEND_NLERP : BLEND_SLERP, m_NlerpCos);
+	}
+
+	//Run recursive node updates here. The camera and m_World are
+	//applied by the shader, so the pose stays in model space
+	if(m_NodeGlobals.size() == m_Scene->m_NumNodes && m_Scene->m_NumNodes >= m_Scene->m_ParallelThreshold){
+		updateLevels();
+		return;
+	}
+	unsigned int nodeIndex = 0;
+	recursiveUpdate(m_Scene->m_Scene->mRootNode, aiMatrix4x4(), nodeIndex);
+}
+
+/* stepAnimation() on a level with an interval > 1. Evaluates into the
+   older of m_LODSlots on the instance's update steps, then blends the
+   two into m_PaletteSlot by how far we are into the interval. The slots
+   are taken on the first coarse step, whichever way the instance got
+   onto the level (updateLOD(), setAnimationLODs(), or level 0).
+   Returns the animation time the blended pose stands for */
+float AnimGLData::stepLOD()
+{
+	unsigned int interval = m_Scene->m_LODs[m_LOD].interval;
+	if(!m_HasLODSlots){
+		m_LODSlots[0] = m_Scene->m_Palettes.acquire();
+		m_LODSlots[1] = m_Scene->m_Palettes.acquire();
+		m_HasLODSlots = true;
+		m_LODPrimed = false;
+	}
+	unsigned int step = ++m_LODStep;
+	releasePose();
+	if(!m_LODPrimed || (step + m_LODPhase) % interval == 0){
+		std::swap(m_LODSlots[0], m_LODSlots[1]);
+		m_LODTimes[0] = m_LODTimes[1];
+		m_PoseSlot = m_LODSlots[1];
+		m_LODTimes[1] = m_Time;
+		evaluatePose();
+		if(!m_LODPrimed){
+			//No history yet, start from a still pose
+			const Slab& slab = m_Scene->m_Palettes;
+			std::memcpy(slab.get(m_LODSlots[0]), slab.get(m_LODSlots[1]), slab.slotSize());
+			m_LODTimes[0] = m_LODTimes[1];
+			m_LODPrimed = true;
+		}
+		m_LODUpdateStep = step;
+	}
+	m_PoseSlot = m_PaletteSlot;
+	float alpha = std::min((float)(step - m_LODUpdateStep) / interval, 1.0f);
+	blendLODPalettes(alpha);
+	return m_LODTimes[0] + (m_LODTimes[1] - m_LODTimes[0]) * alpha;
+}
+
+static void lerpFloats(float* dst, const float* a, const float* b, size_t count, float alpha)
+{
+	for(size_t i = 0; i < count; ++i)
+		dst[i] = a[i] + (b[i] - a[i]) * alpha;
+}
+
+void AnimGLData::blendLODPalettes(float alpha)
+{
+	const Slab& slab = m_Scene->m_Palettes;
+	unsigned int numMeshes = m_Scene->m_Scene->mNumMeshes;
+	const float* a = (const float*)slab.get(m_LODSlots[0]);
+	const float* b = (const float*)slab.get(m_LODSlots[1]);
+	float* dst = (float*)slab.get(m_PaletteSlot);
+	const size_t matrixFloats = sizeof(aiMatrix4x4) / sizeof(float);
+	const size_t paletteFloats = Scene::MAXBONESPERMESH * matrixFloats;
+
+	if(m_SkinMode == SKIN_DUALQUAT){
+		//Dual quaternion linear blending: b into the hemisphere of a,
+		//then normalize by the length of the real part
+		for(unsigned int m = 0; m < numMeshes; ++m){
+			const DualQuat* qa = (const DualQuat*)(a + m * paletteFloats);
+			const DualQuat* qb = (const DualQuat*)(b + m * paletteFloats);
+			DualQuat* q = (DualQuat*)(dst + m * paletteFloats);
+			for(int j = 0; j < Scene::MAXBONESPERMESH; ++j){
+				const float* ra = qa[j].real;
+				const float* rb = qb[j].real;
+				float wb = alpha;
+				if(ra[0]*rb[0] + ra[1]*rb[1] + ra[2]*rb[2] + ra[3]*rb[3] < 0.0f) wb = -wb;
+				float wa = 1.0f - alpha;
+				for(int c = 0; c < 4; ++c){
+					q[j].real[c] = qa[j].real[c] * wa + qb[j].real[c] * wb;
+					q[j].dual[c] = qa[j].dual[c] * wa + qb[j].dual[c] * wb;
+				}
+				float* r = q[j].real;
+				float len = std::sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2] + r[3]*r[3]);
+				if(len > 0.0f){
+					float inv = 1.0f / len;
+					for(int c = 0; c < 4; ++c){
+						q[j].real[c] *= inv;
+						q[j].dual[c] *= inv;
+					}
+				}
+			}
+		}
+	} else {
+		//Matrices are lerped per element. Between poses this close the
+		//shrinking of rotations is invisible
+		lerpFloats(dst, a, b, numMeshes * paletteFloats, alpha);
+	}
+	size_t worldOffset = numMeshes * paletteFloats;
+	lerpFloats(dst + worldOffset, a + worldOffset, b + worldOffset, numMeshes * matrixFloats, alpha);
+}
+
+/* True if 'node' is too deep in the hierarchy to be animated at the
+   current level, see AnimLOD::maxDepth */
+bool AnimGLData::lodExcludes(unsigned int node) const
+{
+	int maxDepth = m_Scene->m_LODs[m_LOD].maxDepth;
+	return maxDepth >= 0 && m_Scene->m_NodeDepth[node] > m_Scene->m_AnimRootDepth[m_AnimIndex] + maxDepth;
+}
+
+/* Take our pose out of the cache, before our palette changes */
+void AnimGLData::releasePose()
+{
+	if(!m_OwnsPoseKey) return;
+	m_Scene->m_PoseCache.erase(m_PoseKey, m_PaletteSlot);
+	m_OwnsPoseKey = false;
+}
+
+/* Weigh the morph targets of every mesh at 'time', and upload the
+   meshes whose weights changed */
+void AnimGLData::updateMorphs(float time)
+{
+	if(!m_Scene->m_NumMorphMeshes) return;
+	PROFILE_SCOPE("AnimGLData::updateMorphs");
+	for(unsigned int i = 0; i < m_Morphs.size(); ++i){
+		const MeshMorph& morph = m_Scene->m_MeshMorphs[i];
+		if(morph.targets.empty()) continue;
+		AnimMorphState& ms = m_Morphs[i];
+		ms.previous.swap(ms.weights);
+		const aiMeshMorphAnim* channel = (*m_MorphChannels)[i];
+		if(channel)
+			evaluateMorphWeights(channel, time, &ms.weights[0], ms.weights.size());
+		else
+			std::copy(morph.defaultWeights.begin(), morph.defaultWeights.end(), ms.weights.begin());
+		if(ms.weights == ms.previous) continue;
+
+		const float* previous = &ms.previous[0];
+		ms.active = applyMorphTargets(morph, previous, &ms.weights[0], &ms.positions[0],
+									  ms.normals.empty() ? 0 : &ms.normals[0]);
+		if(ms.active){
+			updateVBO(ms.positionVBO, &ms.positions[0], ms.positions.size());
+			if(!ms.normals.empty())
+				updateVBO(ms.normalVBO, &ms.normals[0], ms.normals.size());
+		}
+	}
+}
+
+void AnimGLData::drawMeshes()
+{
+	const std::vector<unsigned int>& meshes = m_Scene->m_MeshDrawOrder;
+	for(unsigned int i = 0; i < meshes.size(); ++i){
+		AnimRenderer* a = m_Renderer[meshes[i]];
+		if(a) a->draw(meshes[i]);
+	}
 }
 
 void AnimGLData::render(float t)
 {
+	PROFILE_GPU_SCOPE("AnimGLData::render");
 	stepAnimation(t);
 	//if(m_Renderer)
 	//	m_Renderer->draw();
@@ -530,6 +1326,129 @@ void AnimGLData::setCamera(const aiMatrix4x4& camera)
 	m_Camera = camera;
 }
 
+void AnimGLData::setWorld(const aiMatrix4x4& world)
+{
+	m_World = world;
+}
+
+void AnimGLData::setSkinningMode(SkinningMode mode)
+{
+	const aiScene* sceneData = m_Scene->m_Scene;
+	m_SkinMode = mode;
+	releasePose();
+	m_LODPrimed = false;
+	m_PoseSlot = m_PaletteSlot;
+	//Both palettes live in the same slot, so start from identity
+	for(int i = 0; i < sceneData->mNumMeshes; ++i){
+		if(mode == SKIN_DUALQUAT){
+			DualQuat* bones = getDualQuats(i);
+			for(int j = 0; j < Scene::MAXBONESPERMESH; ++j)
+				bones[j] = dualQuatFromRotationTranslation(aiQuaternion(), aiVector3D());
+		} else {
+			aiMatrix4x4* bones = getBones(i);
+			for(int j = 0; j < Scene::MAXBONESPERMESH; ++j)
+				bones[j] = aiMatrix4x4();
+		}
+	}
+}
+
+void AnimGLData::setInterpolation(InterpolationMode mode, float maxError)
+{
+	m_Interpolation = mode;
+	m_NlerpCos = nlerpCosThreshold(maxError);
+}
+
+aiMatrix4x4* AnimGLData::getBones(int mesh) const
+{
+	aiMatrix4x4* palette = (aiMatrix4x4*)m_Scene->m_Palettes.get(m_PoseSlot);
+	return palette + mesh * Scene::MAXBONESPERMESH;
+}
+
+DualQuat* AnimGLData::getDualQuats(int mesh) const
+{
+	//Same memory as getBones(), packed twice as tight
+	return (DualQuat*)getBones(mesh);
+}
+
+aiMatrix4x4& AnimGLData::getModelView(int mesh) const
+{
+	aiMatrix4x4* palette = (aiMatrix4x4*)m_Scene->m_Palettes.get(m_PoseSlot);
+	return palette[m_Scene->m_Scene->mNumMeshes * Scene::MAXBONESPERMESH + mesh];
+}
+
+/* Index of the first key after 'time' in a PackedChannel time array,
+   so the keys around 'time' are the one before and this one. Short
+   channels are scanned four times at a time, long ones bisected */
+static unsigned int searchKeyTimes(const float* times, unsigned int numKeys, float time)
+{
+	static const unsigned int SCAN_LIMIT = 32;
+	unsigned int first = 0, last = numKeys;
+	//Narrow down to a short run, then scan that
+	while(last - first > SCAN_LIMIT){
+		unsigned int mid = (first + last) / 2;
+		if(times[mid] <= time) first = mid;
+		else last = mid;
+	}
+	first &= ~3u; //arrays are aligned to 4 keys
+#ifdef __SSE2__
+	__m128 t = _mm_set1_ps(time);
+	for(unsigned int i = first; i < numKeys; i += 4){
+		//Times are sorted, so lanes past 'time' are at the end
+		int after = _mm_movemask_ps(_mm_cmpgt_ps(_mm_load_ps(times + i), t));
+		if(after) return i + __builtin_ctz(after);
+	}
+#else
+	for(unsigned int i = first; i < numKeys; ++i)
+		if(times[i] > time) return i;
+#endif
+	return numKeys;
+}
+
+/* Pick the keys around 'time' and the blend factor between them, like
+   interpolateTranslation() and friends. Outside the channel's time
+   frame both keys are the first or the last one */
+static float findKeys(const float* times, unsigned int numKeys, float time, unsigned int& key1, unsigned int& key2)
+{
+	unsigned int next = searchKeyTimes(times, numKeys, time);
+	if(next == 0 || next == numKeys){
+		key1 = key2 = next ? numKeys - 1 : 0;
+		//Exactly on the last key is still inside the time frame
+		return 0.0f;
+	}
+	key1 = next - 1;
+	key2 = next;
+	float tDelta = times[key2] - times[key1];
+	return (tDelta > 0.0f) ? (time - times[key1]) / tDelta : 0.0f;
+}
+
+/* Fill one ChannelBatch lane per animated node with its current keys */
+void AnimGLData::gatherChannels()
+{
+	typedef ChannelBatch CB;
+	const std::vector<PackedChannel>& channels = *m_PackedChannels;
+	for(unsigned int lane = 0; lane < channels.size(); ++lane){
+		//Lanes of excluded nodes are left stale, recursiveUpdate skips them
+		if(lodExcludes((*m_AnimatedNodes)[lane])) continue;
+		const PackedChannel& pc = channels[lane];
+		unsigned int k1, k2;
+
+		m_Batch.field(CB::POS_T)[lane] = findKeys(pc.positionTimes, pc.numPositionKeys, m_Time, k1, k2);
+		for(int c = 0; c < 3; ++c){
+			m_Batch.field((CB::Field)(CB::POS0_X + c))[lane] = pc.positionValues[k1 * 3 + c];
+			m_Batch.field((CB::Field)(CB::POS1_X + c))[lane] = pc.positionValues[k2 * 3 + c];
+		}
+		m_Batch.field(CB::SCALE_T)[lane] = findKeys(pc.scalingTimes, pc.numScalingKeys, m_Time, k1, k2);
+		for(int c = 0; c < 3; ++c){
+			m_Batch.field((CB::Field)(CB::SCALE0_X + c))[lane] = pc.scalingValues[k1 * 3 + c];
+			m_Batch.field((CB::Field)(CB::SCALE1_X + c))[lane] = pc.scalingValues[k2 * 3 + c];
+		}
+		m_Batch.field(CB::ROT_T)[lane] = findKeys(pc.rotationTimes, pc.numRotationKeys, m_Time, k1, k2);
+		for(int c = 0; c < 4; ++c){
+			m_Batch.field((CB::Field)(CB::ROT0_W + c))[lane] = pc.rotationValues[k1 * 4 + c];
+			m_Batch.field((CB::Field)(CB::ROT1_W + c))[lane] = pc.rotationValues[k2 * 4 + c];
+		}
+	}
+}
 
 //For an animated node (an aiNodeAnim channel), get the interpolated position
 void AnimGLData::interpolateTranslation(const aiNodeAnim* nodeAnim, aiVector3D& translation)
@@ -658,75 +1577,126 @@ void AnimGLData::interpolateRotation(const aiNodeAnim* nodeAnim, aiQuaternion& r
 	}
 }
 
-/* Recursively update the coordinate systems of nodes, including bones */
-void AnimGLData::recursiveUpdate(aiNode* node, const aiMatrix4x4& parentMatrix)
+/* Local matrix of node 'node' at m_Time: the animated transform if the
+   node has a channel, its bind pose otherwise */
+aiMatrix4x4 AnimGLData::localMatrix(unsigned int node)
 {
-	std::string nodeName(node->mName.C_Str());
-	aiMatrix4x4 localMatrix = node->mTransformation;
-	
-	//find this current node in the animation
-	//TODO: Make this faster than O(n)
+	aiMatrix4x4 localMatrix = m_Scene->m_Nodes[node]->mTransformation;
+
+	//find this current node in the animation. The lookup table is
+	//built when the scene is loaded
 	//Note: setting the m_Animation pointer to 0 effectively disables animation
-	const aiNodeAnim* nodeAnim = 0;	
-	for(int i = 0; i < m_Animation->mNumChannels && m_Animation; ++i){
-		aiNodeAnim* anim = m_Animation->mChannels[i];
-		std::string animNodeName(anim->mNodeName.C_Str());
-		if(animNodeName == nodeName){
-			nodeAnim = anim;
-			break;
-		}		
-	}
+	const aiNodeAnim* nodeAnim = 0;
+	if(m_Animation && !lodExcludes(node))
+		nodeAnim = (*m_NodeChannels)[node];
 
 	// Animate this node if we found an animation channel for it earlier
 	// Replaces localMatrix
-	if(nodeAnim){		
+	if(nodeAnim){
 		aiVector3D translation;
 		aiVector3D scale;
 		aiQuaternion rotation;
 		aiMatrix4x4 scaleMat, rotMat, transMat;
-		//printf("Animated node: %s at time %f\n", node->mName.C_Str(), m_Time);
-		interpolateTranslation(nodeAnim, translation);
-		interpolateScale(nodeAnim, scale);
-		interpolateRotation(nodeAnim, rotation);
+		if(m_Interpolation == INTERPOLATE_CHANNEL){
+			interpolateTranslation(nodeAnim, translation);
+			interpolateScale(nodeAnim, scale);
+			interpolateRotation(nodeAnim, rotation);
+		} else {
+			//Already interpolated by stepAnimation()
+			typedef ChannelBatch CB;
+			int lane = (*m_NodeLanes)[node];
+			translation = aiVector3D(m_Batch.field(CB::POS_X)[lane], m_Batch.field(CB::POS_Y)[lane], m_Batch.field(CB::POS_Z)[lane]);
+			scale = aiVector3D(m_Batch.field(CB::SCALE_X)[lane], m_Batch.field(CB::SCALE_Y)[lane], m_Batch.field(CB::SCALE_Z)[lane]);
+			rotation = aiQuaternion(m_Batch.field(CB::ROT_W)[lane], m_Batch.field(CB::ROT_X)[lane],
+									m_Batch.field(CB::ROT_Y)[lane], m_Batch.field(CB::ROT_Z)[lane]);
+		}
 		rotMat = aiMatrix4x4(rotation.GetMatrix());
 		aiMatrix4x4::Scaling(scale, scaleMat);
 		aiMatrix4x4::Translation(translation, transMat);
 		localMatrix = transMat * rotMat; // * scaleMat;
 	}
+	return localMatrix;
+}
 
-	aiMatrix4x4 globalMatrix = parentMatrix * localMatrix;
-
-	/* Look up node in NMBI lookup table. If it is a bone, update the
-	i'th bone in the j'th mesh. The "bone" we update is the 2D matrix
-	array used by OpenGL as uniforms. Each array in the 2D array
-	belongs to a mesh. */
-	bool isBone = false;
+/* Look up node in NMBI lookup table. If it is a bone, update the
+   i'th bone in the j'th mesh. The "bone" we update is the 2D matrix
+   array used by OpenGL as uniforms. Each array in the 2D array
+   belongs to a mesh. */
+void AnimGLData::updateBones(unsigned int node, const aiMatrix4x4& globalMatrix)
+{
 	const aiScene* sceneData = m_Scene->m_Scene;
-	std::map<const aiNode*, std::vector<NodeMeshBoneIndex> >::const_iterator it = m_Scene->m_LUTBone.find(node);
-	isBone = (it != m_Scene->m_LUTBone.end());
-	if(isBone){
-		const std::vector<NodeMeshBoneIndex>& nmbi = it->second;
-		
-		for(unsigned int i = 0; i < nmbi.size(); ++i){
-			const NodeMeshBoneIndex& idx = nmbi[i];
-			const aiMatrix4x4& offsetMatrix = sceneData->mMeshes[idx.meshIndex]->mBones[idx.boneIndex]->mOffsetMatrix;
-			aiMatrix4x4 boneMatrix = globalMatrix * offsetMatrix;
-			//Update the 'nmbi.meshIndex'th mesh, bone number 'nmbi.boneIndex' 
-			//OpenGL uses one uniform array for each mesh as bone matrices
-			//Now we support that a bone can be shared by multiple meshes
-			
-			m_Bones[idx.meshIndex][idx.boneIndex] = boneMatrix;
-		}
-		
+	const std::vector<NodeMeshBoneIndex>& nmbi = m_Scene->m_NodeBones[node];
+	for(unsigned int i = 0; i < nmbi.size(); ++i){
+		const NodeMeshBoneIndex& idx = nmbi[i];
+		const aiMatrix4x4& offsetMatrix = sceneData->mMeshes[idx.meshIndex]->mBones[idx.boneIndex]->mOffsetMatrix;
+		aiMatrix4x4 boneMatrix = globalMatrix * offsetMatrix;
+		//Update the 'nmbi.meshIndex'th mesh, bone number 'nmbi.boneIndex'
+		//OpenGL uses one uniform array for each mesh as bone matrices
+		//Now we support that a bone can be shared by multiple meshes
+		if(m_SkinMode == SKIN_DUALQUAT)
+			getDualQuats(idx.meshIndex)[idx.boneIndex] = dualQuatFromMatrix(boneMatrix);
+		else
+			getBones(idx.meshIndex)[idx.boneIndex] = boneMatrix;
 	}
+}
+
+/* Recursively update the coordinate systems of nodes, including bones.
+   'nodeIndex' is the pre-order index of 'node', see Scene::initNodeData() */
+void AnimGLData::recursiveUpdate(aiNode* node, const aiMatrix4x4& parentMatrix, unsigned int& nodeIndex)
+{
+	unsigned int index = nodeIndex++;
+	aiMatrix4x4 globalMatrix = parentMatrix * localMatrix(index);
+	updateBones(index, globalMatrix);
+
 	for(int i = 0; i < node->mNumChildren; ++i)
-		recursiveUpdate(node->mChildren[i], globalMatrix);
+		recursiveUpdate(node->mChildren[i], globalMatrix, nodeIndex);
 
 	for(int i = 0; i < node->mNumMeshes; ++i){
-        /* Global world transform for meshes in pose mode (no animation running) */
-		m_ModelView[node->mMeshes[i]]  = globalMatrix;
-		AnimRenderer* a = m_Renderer[node->mMeshes[i]];
-		if(a) a->draw(node->mMeshes[i]);
-	}	
+		/* Model space transform for meshes in pose mode (no animation running) */
+		getModelView(node->mMeshes[i]) = globalMatrix;
+	}
+}
+
+/* Nodes of one level, for ThreadPool::parallelFor() */
+struct LevelJob
+{
+	AnimGLData* anim;
+	const unsigned int* nodes;
+};
+
+void AnimGLData::updateNodeRange(void* context, size_t begin, size_t end)
+{
+	LevelJob* job = (LevelJob*)context;
+	job->anim->updateNodes(job->nodes + begin, end - begin);
+}
+
+/* Same result as recursiveUpdate(), but a level at a time, with the
+   nodes of a level spread over the thread pool. Every node writes only
+   its own global matrix and bones, so a level needs no locking */
+void AnimGLData::updateLevels()
+{
+	PROFILE_SCOPE("AnimGLData::updateLevels");
+	static const size_t GRAIN = 128; //nodes per task
+	const Scene* scene = m_Scene;
+	ThreadPool& pool = ThreadPool::shared();
+	for(size_t d = 0; d + 1 < scene->m_LevelStart.size(); ++d){
+		unsigned int first = scene->m_LevelStart[d];
+		LevelJob job = { this, &scene->m_LevelNodes[first] };
+		pool.parallelFor(scene->m_LevelStart[d + 1] - first, GRAIN, updateNodeRange, &job);
+	}
+	for(unsigned int m = 0; m < scene->m_MeshNode.size(); ++m)
+		if(scene->m_MeshNode[m] >= 0)
+			getModelView(m) = m_NodeGlobals[scene->m_MeshNode[m]];
+}
+
+void AnimGLData::updateNodes(const unsigned int* nodes, size_t count)
+{
+	for(size_t i = 0; i < count; ++i){
+		unsigned int index = nodes[i];
+		int parent = m_Scene->m_NodeParent[index];
+		aiMatrix4x4 local = localMatrix(index);
+		m_NodeGlobals[index] = parent < 0 ? local : m_NodeGlobals[parent] * local;
+		updateBones(index, m_NodeGlobals[index]);
+	}
 }
 
@@ -13,6 +13,12 @@
 #include <cstdio>
 #include <algorithm>
 #include <fstream>
+#include "dualquat.h"
+#include "arena.h"
+#include "channel_blend.h"
+#include "pose_cache.h"
+#include "morph.h"
+#include "import_profile.h"
 
 /* 
    aiScene have aiMeshes and aiAnimations
@@ -24,6 +30,23 @@
    
 */
 
+/* The vertex data a mesh actually has. Meshes with the same signature
+   can share one specialized shader: defines() turns it into the
+   HAS_NORMALS, HAS_TANGENTS, NUM_UVMAPS and NUM_INFLUENCES defines of
+   shader.vs, so attributes a mesh lacks aren't declared and meshes
+   without bones skip skinning altogether */
+struct AttribSignature
+{
+	bool normals;
+	bool tangents; //and bitangents
+	unsigned int numUVMaps;
+	unsigned int bonesPerVertex; //most bones on any vertex, 0 without bones
+
+	//All four fields in one integer, e.g. to key a map of programs
+	unsigned int pack() const;
+	std::string defines() const;
+};
+
 /* All this OpenGL data is constant during animation */
 struct MeshGLData
 {
@@ -41,6 +64,21 @@ struct MeshGLData
 	unsigned int boneIndices; //indices to bones affecting a vertex
 	unsigned int weights; //bone weights
 	unsigned int numElements; //number of faces * 3
+	/* Index ranges grouped by bone influence count. Range 'n' holds
+	   the triangles whose vertices have at most 'n' bones, and is drawn
+	   with a shader compiled with NUM_INFLUENCES 'n'. Range 0 is only
+	   used by meshes without bones. Offsets and counts are in indices */
+	static const int NUM_INFLUENCE_RANGES = 5;
+	unsigned int influenceFirst[NUM_INFLUENCE_RANGES];
+	unsigned int influenceCount[NUM_INFLUENCE_RANGES];
+	/* Material textures, as handles into TextureCache::shared(), or ~0u.
+	   drawBegin() binds slot 'n' to texture unit 'n', which loads the
+	   file on the first draw */
+	enum { TEXTURE_DIFFUSE, TEXTURE_NORMALS, TEXTURE_SPECULAR, NUM_TEXTURES };
+	unsigned int textures[NUM_TEXTURES];
+	/* Attributes drawBegin() binds. A range 'n' is drawn correctly by
+	   the signature with bonesPerVertex set to 'n' */
+	AttribSignature signature;
 	/* uniforms */
 	//std::vector<aiMatrix4x4> bones; //final bones after transformation
 };
@@ -53,10 +91,17 @@ struct Scene;
 struct AnimRenderer
 {
 	AnimRenderer();
+	virtual ~AnimRenderer() {}
 	friend class AnimGLData;
 protected:
 	void drawBegin(unsigned int shader, int idx);
 	void drawEnd(int idx);
+	//Draw only the triangles in the 'influences' range of mesh 'idx'
+	void drawRange(int idx, int influences);
+	//Number of indices in the 'influences' range of mesh 'idx'
+	unsigned int getRangeCount(int idx, int influences) const;
+	//Constant GL data of mesh 'idx', e.g. its material textures
+	const MeshGLData* getMeshGLData(int idx) const;
 
 private:
 	void setParent(AnimGLData* parent);
@@ -68,22 +113,141 @@ private:
 	const Scene* m_Scene;
 };	
 	
+/* Bone palette format produced by AnimGLData.
+   SKIN_LINEAR: one 4x4 matrix per bone, uniform "sc_bones" (shader.vs)
+   SKIN_DUALQUAT: one dual quaternion per bone, uniform "sc_dqbones"
+   (shader_dq.vs). Half the size of SKIN_LINEAR and no candy-wrapper
+   artifacts, but bone scale is ignored. */
+enum SkinningMode
+{
+	SKIN_LINEAR,
+	SKIN_DUALQUAT
+};
+
+/* Keys of one aiNodeAnim, repacked by Scene at load time. Key times
+   are kept apart from the values, so searching them doesn't pull
+   values into the cache. All arrays are 16 byte aligned and owned by
+   Scene::m_Arena. Time arrays are padded with +inf to a multiple of 4 */
+struct PackedChannel
+{
+	unsigned int numPositionKeys;
+	unsigned int numRotationKeys;
+	unsigned int numScalingKeys;
+	const float* positionTimes;
+	const float* positionValues; //x, y, z per key
+	const float* rotationTimes;
+	const float* rotationValues; //w, x, y, z per key
+	const float* scalingTimes;
+	const float* scalingValues;  //x, y, z per key
+};
+
+/* How AnimGLData interpolates between keys.
+   INTERPOLATE_CHANNEL: one channel at a time with aiQuaternion::Interpolate.
+   The reference the batch modes are checked against.
+   INTERPOLATE_SLERP: all channels in one ChannelBatch, same result.
+   INTERPOLATE_NLERP: like INTERPOLATE_SLERP, but normalized lerp for keys
+   close enough that the error stays below the limit given to
+   setInterpolation(). */
+enum InterpolationMode
+{
+	INTERPOLATE_CHANNEL,
+	INTERPOLATE_SLERP,
+	INTERPOLATE_NLERP
+};
+
+/* One level of animation detail, see Scene::setAnimationLODs().
+   Instances at least 'distance' from the eye use the level. They are
+   evaluated every 'interval' frames and show palettes blended between
+   their last two evaluations in between, so they trail by one interval.
+   Nodes more than 'maxDepth' levels below the topmost animated node of
+   the clip keep their bind pose (-1 animates all of them). */
+struct AnimLOD
+{
+	float distance;
+	unsigned int interval;
+	int maxDepth;
+};
+
+/* Morph target state of one mesh in one instance. The positions and
+   normals have the current weights applied, and are uploaded to the
+   VBOs while any weight is non-zero (m_Active). Otherwise the mesh is
+   drawn from its shared MeshGLData buffers */
+struct AnimMorphState
+{
+	AnimMorphState() : positionVBO(~0u), normalVBO(~0u), active(false) {}
+	std::vector<float> weights;
+	std::vector<float> previous; //weights already applied to positions
+	std::vector<float> positions;
+	std::vector<float> normals;
+	unsigned int positionVBO;
+	unsigned int normalVBO;
+	bool active;
+};
+
 /* This OpenGL data is dynamic during animation. This struct lets us
  * create multiple instances of an animation with different time offsets. */
 struct AnimGLData
 {
 	friend class Scene;
-	const Scene* m_Scene;
-	//pointer to the animation data (constant)
+	Scene* m_Scene;
+	//pointer to the animation data (constant), and its index
 	const aiAnimation* m_Animation;
-	std::map<int, AnimRenderer*> m_Renderer;
-	//2D array of uniform matrices for bones for every mesh (changes every frame)
-	std::vector<std::vector<aiMatrix4x4> > m_Bones;
-	//One worldspace matrix for every mesh
-	std::vector<aiMatrix4x4> m_ModelView;
+	unsigned int m_AnimIndex;
+	//channel animating each node, indexed like Scene::m_NodeBones
+	const std::vector<const aiNodeAnim*>* m_NodeChannels;
+	//nodes with a channel, one ChannelBatch lane each, and the lane
+	//of each node (-1 if not animated)
+	const std::vector<unsigned int>* m_AnimatedNodes;
+	const std::vector<int>* m_NodeLanes;
+	//repacked keys of each lane
+	const std::vector<PackedChannel>* m_PackedChannels;
+	//morph channel of each mesh, or 0, and the morph state of each mesh
+	//(empty for meshes without morph targets)
+	const std::vector<const aiMeshMorphAnim*>* m_MorphChannels;
+	std::vector<AnimMorphState> m_Morphs;
+	ChannelBatch m_Batch;
+	InterpolationMode m_Interpolation;
+	float m_NlerpCos;
+	//renderer for each mesh, or 0
+	std::vector<AnimRenderer*> m_Renderer;
+	//Slot in Scene::m_Palettes holding the bone palettes and world
+	//matrices of this instance. Use getBones() and friends
+	unsigned int m_PaletteSlot;
+	//Position in Scene::m_AnimData
+	unsigned int m_InstanceIndex;
+	//Slot the palettes are read from and evaluated into. m_PaletteSlot,
+	//except while stepLOD() evaluates into m_LODSlots
+	unsigned int m_PoseSlot;
+	//Scene::m_PoseCache key of the pose in m_PaletteSlot, if shared
+	unsigned long long m_PoseKey;
+	bool m_OwnsPoseKey;
+	SkinningMode m_SkinMode;
+	//Level in Scene::m_LODs, picked by Scene::updateLOD()
+	unsigned int m_LOD;
+	//Frame offset of the updates, so instances on the same interval
+	//don't all evaluate on the same frame
+	unsigned int m_LODPhase;
+	//Palettes of the last two evaluations, blended into m_PaletteSlot
+	//while the instance is on a level with interval > 1
+	unsigned int m_LODSlots[2];
+	//m_Time of the poses in m_LODSlots
+	float m_LODTimes[2];
+	bool m_HasLODSlots;
+	bool m_LODPrimed;
+	//Steps taken on coarse levels, and the step of the last evaluation.
+	//Counted per instance, so the blend moves on without updateLOD()
+	unsigned int m_LODStep;
+	unsigned int m_LODUpdateStep;
 	//time of animation
 	float m_Time;
+	//Placement of this instance, uniform "sc_world". Poses are
+	//evaluated in model space, so they don't depend on it
+	aiMatrix4x4 m_World;
+	//uniform "sc_camera"
 	aiMatrix4x4 m_Camera;
+	//Global matrix of every node, only for scenes evaluated level by
+	//level (see Scene::setParallelThreshold())
+	std::vector<aiMatrix4x4> m_NodeGlobals;
 	
 	//add renderer to model with index 'modelIndex'. Returns 'modelIndex'
 	int addRenderer(AnimRenderer* renderer, int modelIndex);
@@ -94,8 +258,34 @@ struct AnimGLData
 	void stepAnimation(float t); //step one frame forwards
 	void render(float t);
 	void setCamera(const aiMatrix4x4& camera);
+	void setWorld(const aiMatrix4x4& world);
+	//Select the bone palette format. Resets the palette, which is
+	//filled in again by the next stepAnimation()
+	void setSkinningMode(SkinningMode mode);
+	//Select how keys are interpolated. 'maxError' is the largest
+	//rotation error in radians INTERPOLATE_NLERP may introduce
+	void setInterpolation(InterpolationMode mode, float maxError = 0.001f);
+	//Bone palette of mesh 'mesh', Scene::MAXBONESPERMESH entries. Both
+	//share the same memory, only the one matching m_SkinMode is valid
+	aiMatrix4x4* getBones(int mesh) const;
+	DualQuat* getDualQuats(int mesh) const;
+	//One worldspace matrix for every mesh
+	aiMatrix4x4& getModelView(int mesh) const;
 private:
-	void recursiveUpdate(aiNode* node, const aiMatrix4x4& parentMatrix);
+	void recursiveUpdate(aiNode* node, const aiMatrix4x4& parentMatrix, unsigned int& nodeIndex);
+	void updateLevels();
+	void updateNodes(const unsigned int* nodes, size_t count);
+	static void updateNodeRange(void* context, size_t begin, size_t end);
+	aiMatrix4x4 localMatrix(unsigned int node);
+	void updateBones(unsigned int node, const aiMatrix4x4& globalMatrix);
+	void gatherChannels();
+	void evaluatePose();
+	float stepLOD();
+	void blendLODPalettes(float alpha);
+	bool lodExcludes(unsigned int node) const;
+	void drawMeshes();
+	void updateMorphs(float time);
+	void releasePose();
 	void interpolateTranslation(const aiNodeAnim* nodeAnim, aiVector3D& translation);
 	void interpolateScale(const aiNodeAnim* nodeAnim, aiVector3D& scale);
 	void interpolateRotation(const aiNodeAnim* nodeAnim, aiQuaternion& rotation);
@@ -123,14 +313,81 @@ struct Scene
 	//look up bone ID and Mesh ID by node. I.e aiNode* 'node' is the 'i'th bone
 	//in the 'j'th mesh.
 	std::map<const aiNode*, std::vector<NodeMeshBoneIndex> > m_LUTBone;
-	//Constant/static data used by OpenGL for each mesh
+	//Per-node tables, indexed in the order AnimGLData::recursiveUpdate()
+	//visits the nodes, so a frame needs no name compares or map lookups
+	unsigned int m_NumNodes;
+	std::vector<const aiNode*> m_Nodes;
+	std::vector<std::vector<NodeMeshBoneIndex> > m_NodeBones;
+	//Parent of every node (-1 for the root), the nodes grouped by depth
+	//(level 'd' is m_LevelNodes[m_LevelStart[d]] up to m_LevelStart[d+1]),
+	//and the node whose matrix ends up in getModelView() of each mesh,
+	//or -1. Used to evaluate large hierarchies in parallel
+	std::vector<int> m_NodeParent;
+	std::vector<unsigned int> m_LevelNodes;
+	std::vector<unsigned int> m_LevelStart;
+	std::vector<int> m_MeshNode;
+	unsigned int m_ParallelThreshold;
+	//[animation][node] channel animating the node, or 0
+	std::vector<std::vector<const aiNodeAnim*> > m_NodeChannels;
+	//[animation] nodes with a channel, and [animation][node] their
+	//position in that list, or -1
+	std::vector<std::vector<unsigned int> > m_AnimatedNodes;
+	std::vector<std::vector<int> > m_NodeLanes;
+	//[animation][lane] keys of the channel of m_AnimatedNodes[animation][lane]
+	std::vector<std::vector<PackedChannel> > m_PackedChannels;
+	//Depth of every node below the root, and [animation] the depth of
+	//its topmost animated node, for AnimLOD::maxDepth
+	std::vector<unsigned int> m_NodeDepth;
+	std::vector<unsigned int> m_AnimRootDepth;
+	//Animation detail levels, sorted by distance. Level 0 is full detail
+	std::vector<AnimLOD> m_LODs;
+	unsigned int m_NextLODPhase;
+	//Distances are scaled by this before picking a level. Grows while
+	//the frame is over m_LODBudgetMs (0 for no budget)
+	float m_LODScale;
+	float m_LODBudgetMs;
+	//Meshes in the order they are drawn
+	std::vector<unsigned int> m_MeshDrawOrder;
+	//Poses evaluated this frame, see setPoseCache()
+	PoseCache m_PoseCache;
+	bool m_PoseCacheEnabled;
+	float m_PoseQuantum;
+	//Constant/static data used by OpenGL for each mesh. Allocated from
+	//m_Arena
 	std::vector<MeshGLData*> m_MeshData;
 	//Dynamic animation data per animation instance that changes every
-	//animation frame
+	//animation frame. Allocated from m_AnimPool
 	std::vector<AnimGLData*> m_AnimData;
+	//Load-time allocations, freed with the scene
+	Arena m_Arena;
+	Pool<AnimGLData> m_AnimPool;
+	//Bone palettes and world matrices of all animation instances, one
+	//slot per instance
+	Slab m_Palettes;
+	//Morph targets of each mesh, and [animation][mesh] the channel
+	//weighting them, or 0. m_NumMorphMeshes counts meshes with targets
+	std::vector<MeshMorph> m_MeshMorphs;
+	std::vector<std::vector<const aiMeshMorphAnim*> > m_MorphChannels;
+	unsigned int m_NumMorphMeshes;
+	//Vertex 'i' in the VBOs of mesh 'j' is vertex m_VertexOrder[j][i]
+	//in the aiMesh. Empty when the mesh wasn't reordered
+	std::vector<std::vector<unsigned int> > m_VertexOrder;
+
+	//Directory of the model file, textures are relative to it
+	std::string m_Directory;
+
+	//Set when the scene creates VAOs and VBOs. A scene without them can
+	//still be animated, e.g. without a GL context
+	bool m_UploadGL;
+	//Set when m_Scene was imported by us and must be released
+	bool m_OwnsScene;
 
 	//functions
-	Scene(const std::string& path);
+	Scene(const std::string& path, bool uploadGL = true);
+	//Import 'path' with the post-processing and properties of 'profile'
+	Scene(const std::string& path, const ImportProfile& profile, bool uploadGL = true);
+	//Wrap an aiScene built in memory. The caller keeps ownership of it
+	Scene(const aiScene* scene, bool uploadGL = true);
 	~Scene();
 	const aiScene* getScene() const;
 	const aiAnimation* getAnimation(const std::string& name) const;
@@ -138,10 +395,41 @@ struct Scene
     size_t getMeshCount(){ return m_MeshData.size(); }
 	AnimGLData* createAnimation(const std::string& name, const aiMatrix4x4& camera);
 	AnimGLData* createAnimation(unsigned int anim, const aiMatrix4x4& camera);
+	//Free an instance made by createAnimation(). Instances still alive
+	//are freed by the destructor
+	void destroyAnimation(AnimGLData* animation);
+	/* Let instances in the same pose share one evaluation. A pose is the
+	   clip, the time in ticks rounded to a multiple of 'quantum' (0 for
+	   exact times), the palette format and the interpolation mode. An
+	   instance that finds its pose evaluated by another one copies that
+	   instance's palette instead of evaluating it. On by default, with
+	   exact times */
+	void setPoseCache(bool enable, float quantum = 0.0f);
+	const PoseCacheStats& getPoseCacheStats() const;
+	void resetPoseCacheStats();
+	/* Replace the animation detail levels. 'lods' is sorted by distance
+	   and level 0 always starts at distance 0. Instances start on level
+	   0 and only move once updateLOD() is called */
+	void setAnimationLODs(const std::vector<AnimLOD>& lods);
+	/* Frame time in milliseconds the animation should stay within. Past
+	   it, updateLOD() pushes instances to coarser levels, and lets them
+	   back once the frame is fast again. 0 turns the budget off */
+	void setAnimationBudget(float ms);
+	/* Call once a frame, before stepping the instances. Picks the level
+	   of every instance by its distance from 'eye' (the translation of
+	   its world matrix), and adapts to 'frameMs', the time the last
+	   frame took */
+	void updateLOD(const aiVector3D& eye, float frameMs);
+	/* Scenes with at least 'nodes' nodes are evaluated level by level
+	   on ThreadPool::shared(), instead of by one recursive walk. Levels
+	   too small to split still run on the calling thread */
+	void setParallelThreshold(unsigned int nodes);
 private:
-	const aiScene* importScene(const std::string& path);
 	void initGLModelData();
-	void initGLBoneData(MeshGLData* gldata, int meshID);
+	void initNodeData();
+	void initPackedChannels();
+	void initGLBoneData(MeshGLData* gldata, int meshID, std::vector<unsigned int>& indices);
+	void initMaterialTextures(MeshGLData* gldata, const aiMesh* mesh);
 };
 
 #endif
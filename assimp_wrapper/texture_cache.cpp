@@ -0,0 +1,183 @@
+#include "texture_cache.h"
+#include <cassert>
+#include <cctype>
+#include "png_loader.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+TextureCache::TextureCache() : m_Fallback(~0u)
+{
+	resetStats();
+}
+
+TextureCache::~TextureCache()
+{
+}
+
+TextureCache& TextureCache::shared()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+unsigned int TextureCache::acquire(const std::string& path, bool srgb)
+{
+	++m_Stats.requests;
+	Key key(path, srgb);
+	std::map<Key, unsigned int>::iterator it = m_Lookup.find(key);
+	if(it != m_Lookup.end()){
+		++m_Entries[it->second].refs;
+		return it->second;
+	}
+	unsigned int handle;
+	if(!m_FreeEntries.empty()){
+		handle = m_FreeEntries.back();
+		m_FreeEntries.pop_back();
+	} else {
+		handle = m_Entries.size();
+		m_Entries.push_back(Entry());
+	}
+	Entry& entry = m_Entries[handle];
+	entry.path = path;
+	entry.srgb = srgb;
+	entry.refs = 1;
+	entry.texture = ~0u;
+	m_Lookup[key] = handle;
+	return handle;
+}
+
+void TextureCache::release(unsigned int handle)
+{
+	if(handle == INVALID) return;
+	assert(handle < m_Entries.size() && m_Entries[handle].refs > 0);
+	Entry& entry = m_Entries[handle];
+	if(--entry.refs) return;
+	if(entry.texture != ~0u && entry.texture != m_Fallback){
+		glDeleteTextures(1, &entry.texture);
+		//The name may be handed out again, so forget what was bound
+		invalidateGLState();
+	}
+	m_Lookup.erase(Key(entry.path, entry.srgb));
+	entry.path.clear();
+	entry.texture = ~0u;
+	m_FreeEntries.push_back(handle);
+}
+
+GLuint TextureCache::texture(unsigned int handle)
+{
+	if(handle == INVALID) return fallback();
+	Entry& entry = m_Entries[handle];
+	if(entry.texture == ~0u)
+		entry.texture = load(entry.path, entry.srgb);
+	return entry.texture;
+}
+
+const std::string& TextureCache::path(unsigned int handle) const
+{
+	return m_Entries[handle].path;
+}
+
+unsigned int TextureCache::refCount(unsigned int handle) const
+{
+	return handle < m_Entries.size() ? m_Entries[handle].refs : 0;
+}
+
+void TextureCache::releaseGL()
+{
+	for(size_t i = 0; i < m_Entries.size(); ++i){
+		Entry& entry = m_Entries[i];
+		if(entry.texture != ~0u && entry.texture != m_Fallback)
+			glDeleteTextures(1, &entry.texture);
+		entry.texture = ~0u;
+	}
+	if(m_Fallback != ~0u)
+		glDeleteTextures(1, &m_Fallback);
+	m_Fallback = ~0u;
+	invalidateGLState();
+}
+
+void TextureCache::resetStats()
+{
+	m_Stats.requests = 0;
+	m_Stats.decodes = 0;
+	m_Stats.compressed = 0;
+	m_Stats.failures = 0;
+}
+
+GLuint TextureCache::load(const std::string& path, bool srgb)
+{
+	PROFILE_SCOPE("TextureCache::load");
+	/* Try the compressed versions first. A material naming a .dds or
+	   .ktx file falls back to the .png next to it */
+	size_t dot = path.find_last_of('.');
+	if(dot == std::string::npos || path.find('/', dot) != std::string::npos)
+		dot = path.size();
+	std::string stem = path.substr(0, dot);
+	std::string ext = path.substr(dot);
+	for(size_t i = 0; i < ext.size(); ++i)
+		ext[i] = tolower(ext[i]);
+	GLuint texture;
+	glGenTextures(1, &texture);
+	if(loadCompressed(stem + ".ktx", texture) || loadCompressed(stem + ".dds", texture))
+		return texture;
+	glDeleteTextures(1, &texture);
+	invalidateGLState();
+	if(ext == ".dds" || ext == ".ktx")
+		return loadPNG(stem + ".png", srgb);
+	return loadPNG(path, srgb);
+}
+
+bool TextureCache::loadCompressed(const std::string& path, GLuint texture)
+{
+	bool loaded = LoadImageCompressed(path, m_Compressed) && UploadCompressedImage(m_Compressed, texture);
+	size_t levels = m_Compressed.levels.size();
+	size_t bytes = 0;
+	for(size_t i = 0; i < levels; ++i)
+		bytes += m_Compressed.levels[i].size;
+	//Don't hold on to the last file, GL has its own copy of the levels
+	std::vector<unsigned char>().swap(m_Compressed.data);
+	m_Compressed.levels.clear();
+	if(!loaded)
+		return false;
+	++m_Stats.decodes;
+	++m_Stats.compressed;
+	bool mipmaps = levels > 1;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	PROFILE_COUNT(PROFILE_BYTES_UPLOADED, bytes);
+	return true;
+}
+
+GLuint TextureCache::loadPNG(const std::string& path, bool srgb)
+{
+	unsigned int width, height;
+	if(!LoadImagePNG(path, m_Pixels, width, height)){
+		printf("Couldn't load texture %s\n", path.c_str());
+		++m_Stats.failures;
+		return fallback();
+	}
+	++m_Stats.decodes;
+	//Gamma-correct mips for color, which glGenerateMipmap() on RGBA8
+	//isn't. Linear data is averaged as it is
+	buildMipChain((const unsigned char*)&m_Pixels[0], width, height, m_Mips, srgb, &ThreadPool::shared());
+	GLuint texture;
+	glGenTextures(1, &texture);
+	uploadMipChain(m_Mips, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	return texture;
+}
+
+GLuint TextureCache::fallback()
+{
+	if(m_Fallback != ~0u) return m_Fallback;
+	const unsigned int white = 0xFFFFFFFF;
+	glGenTextures(1, &m_Fallback);
+	bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, m_Fallback);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	return m_Fallback;
+}
@@ -0,0 +1,89 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include "glstuff.h"
+#include "compressed_loader.h"
+#include "mipmap.h"
+
+struct TextureCacheStats
+{
+	unsigned long requests; //acquire() calls
+	unsigned long decodes;  //files read and uploaded
+	unsigned long compressed; //of those, DDS or KTX files
+	unsigned long failures; //files that couldn't be loaded
+};
+
+/* Textures shared by every Scene, keyed by resolved path and color
+   space.
+
+   acquire() only registers a path and counts a reference, so a scene can
+   resolve its materials without a GL context or any file access. The
+   file is decoded the first time texture() is asked for it, which
+   happens when a mesh using it is drawn, and deleted when the last
+   reference is released. A block compressed version next to the file
+   (same name, .ktx or .dds) is preferred over it when the driver can
+   sample it, see compressed_loader.h. Files that fail to load are drawn
+   with a white texture. Only use it from the thread owning the GL context. */
+struct TextureCache
+{
+	static const unsigned int INVALID = ~0u;
+
+	TextureCache();
+	//Leaves GL objects alone, the context may be gone. See releaseGL()
+	~TextureCache();
+
+	/* Handle for 'path', counting one more reference. 'srgb' is for
+	   color textures, whose mips are averaged in linear light. Data
+	   like normal or specular maps is already linear and passes false;
+	   the same file used both ways is loaded twice */
+	unsigned int acquire(const std::string& path, bool srgb = true);
+	void release(unsigned int handle);
+	//GL texture of 'handle', loading it on first use
+	GLuint texture(unsigned int handle);
+	const std::string& path(unsigned int handle) const;
+	unsigned int refCount(unsigned int handle) const;
+	//Textures with at least one reference
+	size_t size() const { return m_Lookup.size(); }
+	//Delete every loaded texture. They are loaded again on next use
+	void releaseGL();
+
+	const TextureCacheStats& getStats() const { return m_Stats; }
+	void resetStats();
+
+	//Cache shared by the whole program, created on first use
+	static TextureCache& shared();
+
+private:
+	TextureCache(const TextureCache&);
+	TextureCache& operator=(const TextureCache&);
+	GLuint load(const std::string& path, bool srgb);
+	GLuint loadPNG(const std::string& path, bool srgb);
+	bool loadCompressed(const std::string& path, GLuint texture);
+	GLuint fallback();
+
+	struct Entry
+	{
+		std::string path;
+		bool srgb;
+		unsigned int refs;
+		GLuint texture; //~0u until loaded
+	};
+	std::vector<Entry> m_Entries;
+	std::vector<unsigned int> m_FreeEntries;
+	typedef std::pair<std::string, bool> Key; //path, srgb
+	std::map<Key, unsigned int> m_Lookup;
+	GLuint m_Fallback;
+	//Reused, so loading files doesn't allocate each time. Except for
+	//the file data of m_Compressed, which is freed after each upload
+	CompressedImage m_Compressed;
+	std::vector<unsigned int> m_Pixels;
+	MipChain m_Mips;
+	TextureCacheStats m_Stats;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned int workers)
+	: m_Func(0), m_Context(0), m_Count(0), m_Grain(1), m_Next(0), m_Busy(0), m_Generation(0), m_Quit(false)
+{
+	if(!workers){
+		unsigned int hw = std::thread::hardware_concurrency();
+		workers = hw > 1 ? hw - 1 : 0;
+	}
+	for(unsigned int i = 0; i < workers; ++i)
+		m_Threads.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_Wake.notify_all();
+	for(size_t i = 0; i < m_Threads.size(); ++i)
+		m_Threads[i].join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+/* Grab chunks until the loop runs out. Called by every thread taking
+   part, so the chunks balance themselves */
+void ThreadPool::runChunks()
+{
+	for(;;){
+		size_t begin = m_Next.fetch_add(m_Grain);
+		if(begin >= m_Count) break;
+		size_t end = begin + m_Grain < m_Count ? begin + m_Grain : m_Count;
+		m_Func(m_Context, begin, end);
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, RangeFunc func, void* context)
+{
+	if(!grain) grain = 1;
+	//Not worth waking anyone
+	if(m_Threads.empty() || count <= grain){
+		if(count) func(context, 0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> call(m_CallMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Func = func;
+		m_Context = context;
+		m_Count = count;
+		m_Grain = grain;
+		m_Next = 0;
+		m_Busy = m_Threads.size();
+		++m_Generation;
+	}
+	m_Wake.notify_all();
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while(m_Busy)
+		m_Done.wait(lock);
+}
+
+void ThreadPool::workerLoop()
+{
+	unsigned long seen = 0;
+	for(;;){
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			while(!m_Quit && m_Generation == seen)
+				m_Wake.wait(lock);
+			if(m_Quit) return;
+			seen = m_Generation;
+		}
+		runChunks();
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if(--m_Busy == 0)
+			m_Done.notify_one();
+	}
+}
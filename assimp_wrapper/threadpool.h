@@ -0,0 +1,57 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/* A fixed set of worker threads for data-parallel loops.
+
+   parallelFor() splits [0, count) into chunks of 'grain' items and runs
+   them on the workers and the calling thread, returning once all are
+   done. The work is a plain function pointer and a context, so starting
+   a loop never allocates. One loop runs at a time; calls from other
+   threads wait their turn, and calling parallelFor() from inside a loop
+   body deadlocks. */
+struct ThreadPool
+{
+	typedef void (*RangeFunc)(void* context, size_t begin, size_t end);
+
+	//'workers' threads besides the caller. 0 picks one less than the
+	//number of hardware threads
+	explicit ThreadPool(unsigned int workers = 0);
+	~ThreadPool();
+
+	//Threads taking part in a loop, the caller included
+	unsigned int size() const { return m_Threads.size() + 1; }
+	void parallelFor(size_t count, size_t grain, RangeFunc func, void* context);
+
+	//Pool shared by the whole program, created on first use
+	static ThreadPool& shared();
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+	void workerLoop();
+	void runChunks();
+
+	std::vector<std::thread> m_Threads;
+	std::mutex m_CallMutex; //one parallelFor() at a time
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Done;
+	//Current loop
+	RangeFunc m_Func;
+	void* m_Context;
+	size_t m_Count;
+	size_t m_Grain;
+	std::atomic<size_t> m_Next;
+	unsigned int m_Busy; //workers not done with the current loop
+	unsigned long m_Generation;
+	bool m_Quit;
+};
+
+#endif
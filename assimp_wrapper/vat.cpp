@@ -0,0 +1,176 @@
+#include "vat.h"
+#include <cstddef>
+#include <cstdio>
+#include <limits>
+#include "glstuff.h"
+#include "profiler.h"
+
+bool bakeVAT(Scene& scene, unsigned int anim, unsigned int mesh, float framesPerSecond,
+			 VATClip& clip, unsigned int maxWidth)
+{
+	PROFILE_SCOPE("bakeVAT");
+	const aiScene* sceneData = scene.getScene();
+	if(anim >= sceneData->mNumAnimations || mesh >= sceneData->mNumMeshes || framesPerSecond <= 0.0f)
+		return false;
+	const aiMesh* aimesh = sceneData->mMeshes[mesh];
+	const aiAnimation* animation = sceneData->mAnimations[anim];
+	//Same default rate as AnimGLData::stepAnimation()
+	double ticksPerSecond = animation->mTicksPerSecond != 0.0 ? animation->mTicksPerSecond : 32.0;
+	float duration = (float)(animation->mDuration / ticksPerSecond);
+	unsigned int numFrames = (unsigned int)std::floor(duration * framesPerSecond) + 1;
+	unsigned int numVertices = aimesh->mNumVertices;
+	const std::vector<unsigned int>& order = scene.m_VertexOrder[mesh];
+
+	//Bone influences in VBO order, like initGLBoneData() uploads them
+	static const int MAXBONES = Scene::MAXBONESPERVERTEX;
+	std::vector<unsigned int> boneIndex(numVertices * MAXBONES, 0);
+	std::vector<float> boneWeight(numVertices * MAXBONES, 0.0f);
+	std::vector<unsigned int> influences(numVertices, 0);
+	std::vector<unsigned int> remap(numVertices);
+	for(unsigned int v = 0; v < numVertices; ++v)
+		remap[order.empty() ? v : order[v]] = v;
+	unsigned int numBones = std::min<unsigned int>(aimesh->mNumBones, Scene::MAXBONESPERMESH);
+	for(unsigned int b = 0; b < numBones; ++b){
+		const aiBone* bone = aimesh->mBones[b];
+		for(unsigned int w = 0; w < bone->mNumWeights; ++w){
+			unsigned int v = remap[bone->mWeights[w].mVertexId];
+			if(influences[v] == MAXBONES) continue;
+			boneIndex[v * MAXBONES + influences[v]] = b;
+			boneWeight[v * MAXBONES + influences[v]] = bone->mWeights[w].mWeight;
+			++influences[v];
+		}
+	}
+
+	std::vector<float> positions(numFrames * numVertices * 3);
+	std::vector<float> normals(numFrames * numVertices * 3);
+	float inf = std::numeric_limits<float>::infinity();
+	aiVector3D boundsMin(inf, inf, inf), boundsMax(-inf, -inf, -inf);
+
+	//Evaluate through a regular instance, so morph targets and any
+	//future AnimGLData features end up in the bake too
+	AnimGLData* instance = scene.createAnimation(anim, aiMatrix4x4());
+	instance->setSkinningMode(SKIN_LINEAR);
+	for(unsigned int f = 0; f < numFrames; ++f){
+		instance->stepAnimation(f / framesPerSecond);
+		const aiMatrix4x4* bones = instance->getBones(mesh);
+		const AnimMorphState& morph = instance->m_Morphs[mesh];
+		bool morphed = !morph.weights.empty() && morph.active;
+		for(unsigned int v = 0; v < numVertices; ++v){
+			unsigned int src = order.empty() ? v : order[v];
+			aiVector3D p = aimesh->mVertices[src];
+			aiVector3D n = aimesh->mNormals ? aimesh->mNormals[src] : aiVector3D(0.0f, 0.0f, 1.0f);
+			if(morphed){
+				p = aiVector3D(morph.positions[v * 3], morph.positions[v * 3 + 1], morph.positions[v * 3 + 2]);
+				if(!morph.normals.empty())
+					n = aiVector3D(morph.normals[v * 3], morph.normals[v * 3 + 1], morph.normals[v * 3 + 2]);
+			}
+			//Vertices without weights stay in bind pose
+			if(influences[v]){
+				aiVector3D sp, sn;
+				for(unsigned int i = 0; i < influences[v]; ++i){
+					const aiMatrix4x4& bone = bones[boneIndex[v * MAXBONES + i]];
+					float w = boneWeight[v * MAXBONES + i];
+					sp += (bone * p) * w;
+					sn += (aiMatrix3x3(bone) * n) * w;
+				}
+				p = sp;
+				n = sn;
+			}
+			n.Normalize();
+			float* dp = &positions[(f * numVertices + v) * 3];
+			float* dn = &normals[(f * numVertices + v) * 3];
+			for(int c = 0; c < 3; ++c){
+				dp[c] = p[c];
+				dn[c] = n[c];
+				boundsMin[c] = std::min(boundsMin[c], p[c]);
+				boundsMax[c] = std::max(boundsMax[c], p[c]);
+			}
+		}
+	}
+	scene.destroyAnimation(instance);
+
+	clip.numVertices = numVertices;
+	clip.numFrames = numFrames;
+	clip.framesPerSecond = framesPerSecond;
+	clip.width = std::max(1u, std::min(numVertices, maxWidth));
+	clip.rowsPerFrame = std::max(1u, (numVertices + clip.width - 1) / clip.width);
+	clip.height = numFrames * 2 * clip.rowsPerFrame;
+	clip.boundsMin = numVertices ? boundsMin : aiVector3D();
+	clip.boundsMax = numVertices ? boundsMax : aiVector3D();
+	clip.texels.assign((size_t)clip.width * clip.height * 4, 0);
+
+	aiVector3D size = clip.boundsMax - clip.boundsMin;
+	for(unsigned int f = 0; f < numFrames; ++f){
+		for(unsigned int v = 0; v < numVertices; ++v){
+			size_t row = (size_t)f * 2 * clip.rowsPerFrame + v / clip.width;
+			unsigned short* tp = &clip.texels[(row * clip.width + v % clip.width) * 4];
+			unsigned short* tn = tp + (size_t)clip.rowsPerFrame * clip.width * 4;
+			const float* p = &positions[(f * numVertices + v) * 3];
+			const float* n = &normals[(f * numVertices + v) * 3];
+			for(int c = 0; c < 3; ++c){
+				float extent = size[c] > 0.0f ? size[c] : 1.0f;
+				tp[c] = floatToHalf((p[c] - clip.boundsMin[c]) / extent);
+				tn[c] = floatToHalf(n[c]);
+			}
+			tp[3] = tn[3] = floatToHalf(1.0f);
+		}
+	}
+	return true;
+}
+
+bool uploadVAT(VATClip& clip)
+{
+	if(clip.texels.empty()) return false;
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if(clip.width > (unsigned int)maxSize || clip.height > (unsigned int)maxSize){
+		printf("Vertex animation texture %ux%u is over GL_MAX_TEXTURE_SIZE (%d)\n",
+			   clip.width, clip.height, maxSize);
+		return false;
+	}
+	GLuint texture;
+	glGenTextures(1, &texture);
+	bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, clip.width, clip.height, 0, GL_RGBA, GL_HALF_FLOAT, &clip.texels[0]);
+	//Only read with texelFetch
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	clip.texture = texture;
+	clip.vao = createVAO();
+	return true;
+}
+
+void drawVATInstanced(GLuint program, const Scene& scene, unsigned int mesh, const VATClip& clip,
+					  GLuint instances, unsigned int count, float time)
+{
+	PROFILE_SCOPE("drawVATInstanced");
+	const MeshGLData* meshData = scene.getMeshGLData(mesh);
+	if(!meshData || clip.texture == ~0u || !count) return;
+	useProgram(program);
+	bindVAO(clip.vao);
+	if(meshData->tcoord0 != ~0u)
+		bindVBOFloat(program, "sc_tcoord0", meshData->tcoord0, 3);
+	const int stride = sizeof(VATInstance);
+	bindVBOInstanced(program, "sc_world0", instances, 4, stride, offsetof(VATInstance, world));
+	bindVBOInstanced(program, "sc_world1", instances, 4, stride, offsetof(VATInstance, world) + 16);
+	bindVBOInstanced(program, "sc_world2", instances, 4, stride, offsetof(VATInstance, world) + 32);
+	bindVBOInstanced(program, "sc_world3", instances, 4, stride, offsetof(VATInstance, world) + 48);
+	bindVBOInstanced(program, "sc_playback", instances, 2, stride, offsetof(VATInstance, timeOffset));
+
+	bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, clip.texture);
+	bindUniformSampler(program, "sc_vat", GL_TEXTURE1);
+	aiVector3D size = clip.boundsMax - clip.boundsMin;
+	float layout[4] = { (float)clip.width, (float)clip.rowsPerFrame, (float)clip.numFrames, clip.framesPerSecond };
+	float boundsMin[4] = { clip.boundsMin.x, clip.boundsMin.y, clip.boundsMin.z, 0.0f };
+	float boundsSize[4] = { size.x > 0.0f ? size.x : 1.0f, size.y > 0.0f ? size.y : 1.0f, size.z > 0.0f ? size.z : 1.0f, 0.0f };
+	float playTime[4] = { time, 0.0f, 0.0f, 0.0f };
+	setUniform4fv(program, getUniformLocation(program, "sc_vatLayout"), 1, layout);
+	setUniform4fv(program, getUniformLocation(program, "sc_vatBoundsMin"), 1, boundsMin);
+	setUniform4fv(program, getUniformLocation(program, "sc_vatBoundsSize"), 1, boundsSize);
+	setUniform4fv(program, getUniformLocation(program, "sc_vatTime"), 1, playTime);
+
+	bindVBOIndices(program, meshData->indices);
+	glDrawElementsInstanced(GL_TRIANGLES, meshData->numElements, GL_UNSIGNED_INT, 0, count);
+	PROFILE_COUNT(PROFILE_DRAWS, 1);
+	PROFILE_COUNT(PROFILE_TRIANGLES, (unsigned long)meshData->numElements / 3 * count);
+}
@@ -0,0 +1,68 @@
+#ifndef VAT_H
+#define VAT_H
+
+#include <GL/glew.h>
+#include <assimp/types.h>
+#include <vector>
+#include "scene.h"
+
+/* Vertex animation textures, for crowds too far away to need a skeleton.
+
+   bakeVAT() plays a clip through AnimGLData, skins one mesh on the CPU
+   like shader.vs does, and stores the skinned positions and normals of
+   every frame in an RGBA16F texture. shader_vat.vs plays it back from
+   gl_VertexID and a per-instance time, so drawing a crowd costs one
+   instanced draw call and no CPU work per character.
+
+   Layout: frame 'f' takes 2 * rowsPerFrame rows, positions first, then
+   normals. Vertex 'v' is texel (v % width, v / width) of its block.
+   Positions are stored relative to the bounds of the whole clip, so the
+   halves cover [0, 1], which keeps their precision at about 1/2048 of
+   the clip's extent. */
+struct VATClip
+{
+	VATClip() : numVertices(0), numFrames(0), width(0), height(0), rowsPerFrame(0),
+				framesPerSecond(0.0f), texture(~0u), vao(~0u) {}
+	unsigned int numVertices;
+	unsigned int numFrames;
+	unsigned int width;
+	unsigned int height;
+	unsigned int rowsPerFrame;
+	float framesPerSecond;
+	aiVector3D boundsMin;
+	aiVector3D boundsMax;
+	std::vector<unsigned short> texels; //RGBA16F, width * height texels
+	//Set by uploadVAT()
+	unsigned int texture;
+	unsigned int vao;
+};
+
+/* Per-instance record read by shader_vat.vs, one per crowd member */
+struct VATInstance
+{
+	float world[16];  //row major, like aiMatrix4x4
+	float timeOffset; //seconds into the clip at time 0
+	float speed;      //playback rate, 1 is the baked speed
+	float pad[2];
+};
+
+/* Bake mesh 'mesh' of 'scene' playing animation 'anim' at
+   'framesPerSecond' (the clip's own key rate is a good choice). Rows
+   are at most 'maxWidth' texels wide. Works without a GL context.
+   Returns false if the animation or mesh doesn't exist */
+bool bakeVAT(Scene& scene, unsigned int anim, unsigned int mesh, float framesPerSecond,
+			 VATClip& clip, unsigned int maxWidth = 4096);
+
+/* Create the texture, and an empty VAO that drawVATInstanced() binds
+   the mesh's buffers to. Needs a GL context. Returns false, and
+   creates nothing, if the texture is larger than GL_MAX_TEXTURE_SIZE;
+   bake with a smaller 'maxWidth' or fewer frames then */
+bool uploadVAT(VATClip& clip);
+
+/* Draw 'count' instances of the baked mesh with 'program' (built from
+   shader_vat.vs) at 'time' seconds. 'instances' holds 'count'
+   VATInstance records. The caller sets projection and sc_camera */
+void drawVATInstanced(GLuint program, const Scene& scene, unsigned int mesh, const VATClip& clip,
+					  GLuint instances, unsigned int count, float time);
+
+#endif
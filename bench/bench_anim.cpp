@@ -0,0 +1,661 @@
+/* Headless animation benchmark. Needs no window or GL context.
+
+   Times Scene::createAnimation and AnimGLData::stepAnimation (node
+   evaluation and bone palette generation) for the bundled COLLADA
+   files and for synthetic rigs, over a range of instance, bone and key
+   counts. Results are written as JSON, one case per line, and can be
+   compared against a stored baseline:
+
+     bench_anim --json new.json
+     bench_anim --baseline old.json --tolerance 0.10
+
+   stepAnimation must not touch the heap once an instance is set up.
+   --check-allocs N runs every case for N frames and fails if any of
+   them allocated:
+
+     bench_anim --check-allocs 100
+
+   Only the CPU side is covered. There is no GL context and the
+   instances have no AnimRenderer, so drawMeshes() and the GL uploads
+   of a real frame are not part of the check.
+
+   Every case also checks its palettes against the per-channel
+   interpolation (INTERPOLATE_CHANNEL) and fails if the batch slerp
+   differs. A mesh without bones under transformed nodes has to end up
+   at its node's position through sc_modelview.
+
+   Run it from the build directory, so data/ can be found. */
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <dirent.h>
+#include "../assimp_wrapper/scene.h"
+
+/****************************************************************************************
+ ********************************* Allocation counting **********************************
+ ****************************************************************************************/
+static std::atomic<unsigned long> g_Allocations(0);
+
+void* operator new(size_t size)
+{
+	++g_Allocations;
+	void* p = std::malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	++g_Allocations;
+	void* p = std::malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+/****************************************************************************************
+ ********************************* Synthetic rigs ***************************************
+ ****************************************************************************************/
+static aiString makeName(const char* prefix, int i)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+	return aiString(std::string(buf));
+}
+
+static void setChildren(aiNode* node, const std::vector<aiNode*>& children)
+{
+	node->mNumChildren = children.size();
+	node->mChildren = children.empty() ? 0 : new aiNode*[children.size()];
+	for(size_t i = 0; i < children.size(); ++i){
+		node->mChildren[i] = children[i];
+		children[i]->mParent = node;
+	}
+}
+
+/* A binary tree of 'numBones' bones under a root node, skinning one
+   mesh per Scene::MAXBONESPERMESH bones. Every vertex is weighted to
+   Scene::MAXBONESPERVERTEX bones, and every bone has a channel with
+   'numKeys' position, rotation and scaling keys. */
+static aiScene* createSyntheticRig(int numBones, int numKeys, int verticesPerMesh)
+{
+	aiScene* scene = new aiScene;
+	aiNode* root = new aiNode;
+	root->mName = aiString(std::string("root"));
+	scene->mRootNode = root;
+
+	std::vector<aiNode*> bones(numBones);
+	std::vector<std::vector<aiNode*> > children(numBones);
+	for(int i = 0; i < numBones; ++i){
+		bones[i] = new aiNode;
+		bones[i]->mName = makeName("bone", i);
+		aiMatrix4x4::Translation(aiVector3D(0.0f, 1.0f, 0.0f), bones[i]->mTransformation);
+		if(i > 0)
+			children[(i - 1) / 2].push_back(bones[i]);
+	}
+	for(int i = 0; i < numBones; ++i)
+		setChildren(bones[i], children[i]);
+
+	int numMeshes = (numBones + Scene::MAXBONESPERMESH - 1) / Scene::MAXBONESPERMESH;
+	std::vector<aiNode*> rootChildren;
+	rootChildren.push_back(bones[0]);
+	scene->mNumMeshes = numMeshes;
+	scene->mMeshes = new aiMesh*[numMeshes];
+	for(int m = 0; m < numMeshes; ++m){
+		int firstBone = m * Scene::MAXBONESPERMESH;
+		int meshBones = std::min(numBones - firstBone, (int)Scene::MAXBONESPERMESH);
+		aiMesh* mesh = new aiMesh;
+		mesh->mName = makeName("mesh", m);
+		mesh->mNumVertices = verticesPerMesh;
+		mesh->mVertices = new aiVector3D[verticesPerMesh];
+		for(int v = 0; v < verticesPerMesh; ++v)
+			mesh->mVertices[v] = aiVector3D(v * 0.01f, (v % 7) * 0.1f, 0.0f);
+		mesh->mNumFaces = verticesPerMesh / 3;
+		mesh->mFaces = new aiFace[mesh->mNumFaces];
+		for(unsigned int f = 0; f < mesh->mNumFaces; ++f){
+			mesh->mFaces[f].mNumIndices = 3;
+			mesh->mFaces[f].mIndices = new unsigned int[3];
+			for(int k = 0; k < 3; ++k)
+				mesh->mFaces[f].mIndices[k] = f*3 + k;
+		}
+		//Vertex 'v' is weighted to bones v, v+1, ... (mod meshBones)
+		std::vector<std::vector<aiVertexWeight> > weights(meshBones);
+		int influences = std::min((int)Scene::MAXBONESPERVERTEX, meshBones);
+		for(int v = 0; v < verticesPerMesh; ++v)
+			for(int k = 0; k < influences; ++k)
+				weights[(v + k) % meshBones].push_back(aiVertexWeight(v, 1.0f / influences));
+		mesh->mNumBones = meshBones;
+		mesh->mBones = new aiBone*[meshBones];
+		for(int b = 0; b < meshBones; ++b){
+			aiBone* bone = new aiBone;
+			bone->mName = bones[firstBone + b]->mName;
+			bone->mNumWeights = weights[b].size();
+			bone->mWeights = new aiVertexWeight[bone->mNumWeights];
+			std::copy(weights[b].begin(), weights[b].end(), bone->mWeights);
+			mesh->mBones[b] = bone;
+		}
+		scene->mMeshes[m] = mesh;
+
+		aiNode* meshNode = new aiNode;
+		meshNode->mName = mesh->mName;
+		meshNode->mNumMeshes = 1;
+		meshNode->mMeshes = new unsigned int[1];
+		meshNode->mMeshes[0] = m;
+		rootChildren.push_back(meshNode);
+	}
+	setChildren(root, rootChildren);
+
+	aiAnimation* anim = new aiAnimation;
+	anim->mName = aiString(std::string("synthetic"));
+	anim->mTicksPerSecond = 30.0;
+	anim->mDuration = numKeys - 1;
+	anim->mNumChannels = numBones;
+	anim->mChannels = new aiNodeAnim*[numBones];
+	for(int i = 0; i < numBones; ++i){
+		aiNodeAnim* channel = new aiNodeAnim;
+		channel->mNodeName = bones[i]->mName;
+		channel->mNumPositionKeys = channel->mNumRotationKeys = channel->mNumScalingKeys = numKeys;
+		channel->mPositionKeys = new aiVectorKey[numKeys];
+		channel->mRotationKeys = new aiQuatKey[numKeys];
+		channel->mScalingKeys = new aiVectorKey[numKeys];
+		for(int k = 0; k < numKeys; ++k){
+			float a = 0.1f * k + 0.01f * i;
+			channel->mPositionKeys[k].mTime = k;
+			channel->mPositionKeys[k].mValue = aiVector3D(0.0f, 1.0f, 0.1f * std::sin(a));
+			channel->mRotationKeys[k].mTime = k;
+			channel->mRotationKeys[k].mValue = aiQuaternion(std::cos(a * 0.5f), 0.0f, 0.0f, std::sin(a * 0.5f));
+			channel->mScalingKeys[k].mTime = k;
+			channel->mScalingKeys[k].mValue = aiVector3D(1.0f, 1.0f, 1.0f);
+		}
+		anim->mChannels[i] = channel;
+	}
+	scene->mNumAnimations = 1;
+	scene->mAnimations = new aiAnimation*[1];
+	scene->mAnimations[0] = anim;
+	return scene;
+}
+
+/* Add a mesh without bones under two transformed nodes below the root,
+   so it is drawn through sc_modelview (the NUM_INFLUENCES 0 shaders).
+   Returns the mesh index */
+static unsigned int addStaticMesh(aiScene* scene, const aiMatrix4x4& outer, const aiMatrix4x4& inner)
+{
+	aiMesh* mesh = new aiMesh;
+	mesh->mName = aiString(std::string("static"));
+	mesh->mNumVertices = 3;
+	mesh->mVertices = new aiVector3D[3];
+	mesh->mVertices[0] = aiVector3D(0.0f, 0.0f, 0.0f);
+	mesh->mVertices[1] = aiVector3D(1.0f, 0.0f, 0.0f);
+	mesh->mVertices[2] = aiVector3D(0.0f, 1.0f, 0.0f);
+	mesh->mNumFaces = 1;
+	mesh->mFaces = new aiFace[1];
+	mesh->mFaces[0].mNumIndices = 3;
+	mesh->mFaces[0].mIndices = new unsigned int[3];
+	for(int k = 0; k < 3; ++k)
+		mesh->mFaces[0].mIndices[k] = k;
+
+	unsigned int index = scene->mNumMeshes;
+	aiMesh** meshes = new aiMesh*[index + 1];
+	std::copy(scene->mMeshes, scene->mMeshes + index, meshes);
+	meshes[index] = mesh;
+	delete[] scene->mMeshes;
+	scene->mMeshes = meshes;
+	scene->mNumMeshes = index + 1;
+
+	aiNode* holder = new aiNode;
+	holder->mName = aiString(std::string("static_holder"));
+	holder->mTransformation = outer;
+	aiNode* node = new aiNode;
+	node->mName = mesh->mName;
+	node->mTransformation = inner;
+	node->mNumMeshes = 1;
+	node->mMeshes = new unsigned int[1];
+	node->mMeshes[0] = index;
+	setChildren(holder, std::vector<aiNode*>(1, node));
+	aiNode* root = scene->mRootNode;
+	std::vector<aiNode*> children(root->mChildren, root->mChildren + root->mNumChildren);
+	children.push_back(holder);
+	delete[] root->mChildren;
+	setChildren(root, children);
+	return index;
+}
+
+/****************************************************************************************
+ ********************************* Benchmark ********************************************
+ ****************************************************************************************/
+struct BenchResult
+{
+	std::string name;
+	int instances;
+	int bones;  //bones per instance, summed over all meshes
+	int keys;   //largest key count of a channel
+	int frames;
+	double createNs;      //per instance
+	double stepNsPerBone; //average
+	double p50Us, p90Us, p99Us, maxUs; //per frame, all instances
+	double allocsPerFrame;
+	double maxError; //largest palette difference to INTERPOLATE_CHANNEL
+	double poseHitRate; //share of steps served by Scene's pose cache
+};
+
+static double nowNs()
+{
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+	if(v.empty()) return 0.0;
+	std::sort(v.begin(), v.end());
+	size_t idx = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+	return v[idx];
+}
+
+static int countBones(const aiScene* scene)
+{
+	int n = 0;
+	for(unsigned int i = 0; i < scene->mNumMeshes; ++i)
+		n += scene->mMeshes[i]->mNumBones;
+	return n;
+}
+
+static int countKeys(const aiAnimation* anim)
+{
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < anim->mNumChannels; ++i){
+		const aiNodeAnim* c = anim->mChannels[i];
+		n = std::max(n, std::max(c->mNumPositionKeys, std::max(c->mNumRotationKeys, c->mNumScalingKeys)));
+	}
+	return n;
+}
+
+/* Step one instance with 'interp' and one with the per-channel
+   reference side by side, and return the largest palette difference,
+   relative to the size of the reference values */
+static double interpolationError(Scene& scene, SkinningMode mode, InterpolationMode interp, int frames)
+{
+	aiMatrix4x4 camera;
+	AnimGLData* ref = scene.createAnimation(0u, camera);
+	AnimGLData* test = scene.createAnimation(0u, camera);
+	ref->setSkinningMode(mode);
+	test->setSkinningMode(mode);
+	ref->setInterpolation(INTERPOLATE_CHANNEL);
+	test->setInterpolation(interp);
+	int floatsPerBone = (mode == SKIN_DUALQUAT) ? 8 : 16;
+	double maxError = 0.0;
+	for(int f = 0; f < frames; ++f){
+		float t = f / 60.0f;
+		ref->stepAnimation(t);
+		test->stepAnimation(t);
+		for(unsigned int m = 0; m < scene.getScene()->mNumMeshes; ++m){
+			const float* a = ref->getBones(m)[0][0];
+			const float* b = test->getBones(m)[0][0];
+			for(int i = 0; i < Scene::MAXBONESPERMESH * floatsPerBone; ++i)
+				maxError = std::max(maxError, std::fabs(a[i] - b[i]) / std::max(1.0, (double)std::fabs(a[i])));
+		}
+	}
+	scene.destroyAnimation(ref);
+	scene.destroyAnimation(test);
+	return maxError;
+}
+
+/* Largest distance between where shader.vs puts the vertices of a
+   static mesh (sc_modelview * vertex) and where its node hierarchy
+   does, for the recursive and the level by level update */
+static double staticMeshError()
+{
+	aiMatrix4x4 outer, inner, rotation;
+	aiMatrix4x4::Translation(aiVector3D(3.0f, -2.0f, 5.0f), outer);
+	aiMatrix4x4::RotationZ(0.7f, rotation);
+	aiMatrix4x4::Translation(aiVector3D(0.0f, 1.5f, 0.0f), inner);
+	inner = rotation * inner;
+	aiScene* rig = createSyntheticRig(16, 8, 30);
+	unsigned int mesh = addStaticMesh(rig, outer, inner);
+	aiMatrix4x4 expected = rig->mRootNode->mTransformation * outer * inner;
+	double maxError = 0.0;
+	{
+		Scene scene(rig, false);
+		aiMatrix4x4 camera;
+		for(int parallel = 0; parallel < 2; ++parallel){
+			scene.setParallelThreshold(parallel ? 0 : ~0u);
+			AnimGLData* anim = scene.createAnimation(0u, camera);
+			anim->stepAnimation(0.25f);
+			const aiMesh* m = rig->mMeshes[mesh];
+			for(unsigned int v = 0; v < m->mNumVertices; ++v){
+				aiVector3D drawn = anim->getModelView(mesh) * m->mVertices[v];
+				aiVector3D placed = expected * m->mVertices[v];
+				maxError = std::max(maxError, (double)(drawn - placed).Length());
+			}
+			scene.destroyAnimation(anim);
+		}
+	}
+	delete rig;
+	return maxError;
+}
+
+/* 'poses' > 0 makes instances share that many distinct time offsets,
+   like a crowd started in groups */
+static BenchResult runCase(Scene& scene, const std::string& name, int instances, int frames,
+						   SkinningMode mode, InterpolationMode interp, int poses = 0)
+{
+	static const int WARMUP_FRAMES = 10;
+	BenchResult r;
+	r.name = name;
+	r.instances = instances;
+	r.bones = countBones(scene.getScene());
+	r.keys = countKeys(scene.getScene()->mAnimations[0]);
+	r.frames = frames;
+
+	aiMatrix4x4 camera;
+	std::vector<AnimGLData*> anims(instances);
+	double start = nowNs();
+	for(int i = 0; i < instances; ++i)
+		anims[i] = scene.createAnimation(0u, camera);
+	r.createNs = (nowNs() - start) / instances;
+	for(int i = 0; i < instances; ++i){
+		anims[i]->setSkinningMode(mode);
+		anims[i]->setInterpolation(interp);
+		//In a row along x, one unit apart, for Scene::updateLOD()
+		aiMatrix4x4 world;
+		aiMatrix4x4::Translation(aiVector3D((float)i, 0.0f, 0.0f), world);
+		anims[i]->setWorld(world);
+	}
+
+	//Instances are spread out in time, like a crowd would be
+	std::vector<double> samples;
+	samples.reserve(frames);
+	unsigned long allocs = 0;
+	PoseCacheStats cacheBefore = PoseCacheStats();
+	double frameNs = 0.0;
+	for(int f = -WARMUP_FRAMES; f < frames; ++f){
+		float t = f / 60.0f;
+		unsigned long allocsBefore = g_Allocations;
+		double frameStart = nowNs();
+		scene.updateLOD(aiVector3D(), (float)(frameNs * 1e-6));
+		for(int i = 0; i < instances; ++i)
+			anims[i]->stepAnimation(t + (poses ? i % poses : i) * 0.037f);
+		frameNs = nowNs() - frameStart;
+		if(f < 0) continue;
+		if(f == 0) cacheBefore = scene.getPoseCacheStats();
+		samples.push_back(frameNs);
+		allocs += g_Allocations - allocsBefore;
+	}
+
+	double sum = 0.0;
+	for(size_t i = 0; i < samples.size(); ++i)
+		sum += samples[i];
+	r.stepNsPerBone = (r.bones && instances) ? sum / samples.size() / (instances * r.bones) : 0.0;
+	r.p50Us = percentile(samples, 0.50) * 1e-3;
+	r.p90Us = percentile(samples, 0.90) * 1e-3;
+	r.p99Us = percentile(samples, 0.99) * 1e-3;
+	r.maxUs = percentile(samples, 1.0) * 1e-3;
+	r.allocsPerFrame = (double)allocs / frames;
+	const PoseCacheStats& cache = scene.getPoseCacheStats();
+	unsigned long hits = cache.hits - cacheBefore.hits;
+	unsigned long lookups = hits + cache.misses - cacheBefore.misses;
+	r.poseHitRate = lookups ? (double)hits / lookups : 0.0;
+
+	for(int i = 0; i < instances; ++i)
+		scene.destroyAnimation(anims[i]);
+	r.maxError = (interp == INTERPOLATE_CHANNEL) ? 0.0 : interpolationError(scene, mode, interp, 50);
+	return r;
+}
+
+static std::string toJSON(const BenchResult& r)
+{
+	std::ostringstream strm;
+	strm << "{\"name\":\"" << r.name << "\",\"instances\":" << r.instances
+		 << ",\"bones\":" << r.bones << ",\"keys\":" << r.keys << ",\"frames\":" << r.frames
+		 << ",\"create_ns\":" << r.createNs << ",\"step_ns_per_bone\":" << r.stepNsPerBone
+		 << ",\"frame_p50_us\":" << r.p50Us << ",\"frame_p90_us\":" << r.p90Us
+		 << ",\"frame_p99_us\":" << r.p99Us << ",\"frame_max_us\":" << r.maxUs
+		 << ",\"allocs_per_frame\":" << r.allocsPerFrame << ",\"max_error\":" << r.maxError
+		 << ",\"pose_hit_rate\":" << r.poseHitRate << "}";
+	return strm.str();
+}
+
+/* Read "name" -> "step_ns_per_bone" from a file written by toJSON().
+   Only understands our own one-case-per-line format. */
+static std::map<std::string, double> readBaseline(const std::string& path)
+{
+	std::map<std::string, double> baseline;
+	std::ifstream strm(path.c_str());
+	std::string line;
+	while(std::getline(strm, line)){
+		size_t n = line.find("\"name\":\"");
+		size_t v = line.find("\"step_ns_per_bone\":");
+		if(n == std::string::npos || v == std::string::npos) continue;
+		n += 8;
+		std::string name = line.substr(n, line.find('"', n) - n);
+		baseline[name] = std::atof(line.c_str() + v + 19);
+	}
+	return baseline;
+}
+
+static std::vector<std::string> findModels(const std::string& dir)
+{
+	std::vector<std::string> files;
+	DIR* d = opendir(dir.c_str());
+	if(!d) return files;
+	while(dirent* e = readdir(d)){
+		std::string name(e->d_name);
+		if(name.size() > 4 && name.compare(name.size() - 4, 4, ".dae") == 0)
+			files.push_back(dir + "/" + name);
+	}
+	closedir(d);
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+static std::string modeName(SkinningMode mode)
+{
+	return (mode == SKIN_DUALQUAT) ? "dq" : "lbs";
+}
+
+static std::string interpName(InterpolationMode interp)
+{
+	return (interp == INTERPOLATE_CHANNEL) ? "channel" : (interp == INTERPOLATE_NLERP) ? "nlerp" : "slerp";
+}
+
+int main(int argc, char* argv[])
+{
+	std::string jsonPath, baselinePath, dataDir("data");
+	int frames = 200;
+	int checkAllocs = 0;
+	double tolerance = 0.10;
+	ImportPreset preset = IMPORT_DEFAULT;
+	for(int i = 1; i < argc; ++i){
+		std::string arg(argv[i]);
+		if(arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+		else if(arg == "--baseline" && i + 1 < argc) baselinePath = argv[++i];
+		else if(arg == "--frames" && i + 1 < argc) frames = std::atoi(argv[++i]);
+		else if(arg == "--tolerance" && i + 1 < argc) tolerance = std::atof(argv[++i]);
+		else if(arg == "--data" && i + 1 < argc) dataDir = argv[++i];
+		else if(arg == "--check-allocs" && i + 1 < argc) checkAllocs = std::atoi(argv[++i]);
+		else if(arg == "--profile" && i + 1 < argc && ImportProfile::parsePreset(argv[i + 1], preset)) ++i;
+		else {
+			printf("Usage: %s [--json out.json] [--baseline base.json] [--tolerance 0.10]"
+				   " [--frames N] [--data dir] [--check-allocs N]"
+				   " [--profile default|fastload|fastrender]\n", argv[0]);
+			return 0;
+		}
+	}
+
+	if(checkAllocs > 0)
+		frames = checkAllocs;
+
+	static const SkinningMode modes[] = { SKIN_LINEAR, SKIN_DUALQUAT };
+	static const int instanceCounts[] = { 1, 16, 128 };
+	std::vector<BenchResult> results;
+
+	//Bundled models
+	std::vector<std::string> models = findModels(dataDir);
+	ImportProfile profile(preset);
+	for(size_t m = 0; m < models.size(); ++m){
+		try {
+			Scene scene(models[m], profile, false);
+			if(!scene.getScene()->mNumAnimations){
+				fprintf(stderr, "Skipping %s, no animations\n", models[m].c_str());
+				continue;
+			}
+			for(int mode = 0; mode < 2; ++mode)
+				for(int i = 0; i < 3; ++i){
+					std::ostringstream name;
+					name << models[m] << "/i" << instanceCounts[i] << "/" << modeName(modes[mode]);
+					results.push_back(runCase(scene, name.str(), instanceCounts[i], frames, modes[mode], INTERPOLATE_SLERP));
+				}
+		} catch(std::exception& e){
+			fprintf(stderr, "Couldn't load %s\n", models[m].c_str());
+		}
+	}
+
+	//Synthetic rigs
+	static const int boneCounts[] = { 16, 64, 256 };
+	static const int keyCounts[] = { 8, 64, 512 };
+	for(int b = 0; b < 3; ++b)
+		for(int k = 0; k < 3; ++k){
+			aiScene* rig = createSyntheticRig(boneCounts[b], keyCounts[k], 300);
+			{
+				Scene scene(rig, false);
+				for(int mode = 0; mode < 2; ++mode)
+					for(int i = 0; i < 3; ++i){
+						std::ostringstream name;
+						name << "synthetic/b" << boneCounts[b] << "/k" << keyCounts[k]
+							 << "/i" << instanceCounts[i] << "/" << modeName(modes[mode]);
+						results.push_back(runCase(scene, name.str(), instanceCounts[i], frames, modes[mode], INTERPOLATE_SLERP));
+					}
+				//The other interpolation modes, against the default slerp
+				//cases above. Suffixed, so the old names stay comparable
+				static const InterpolationMode interps[] = { INTERPOLATE_CHANNEL, INTERPOLATE_NLERP };
+				for(int n = 0; n < 2; ++n){
+					std::ostringstream name;
+					name << "synthetic/b" << boneCounts[b] << "/k" << keyCounts[k]
+						 << "/i16/lbs/" << interpName(interps[n]);
+					results.push_back(runCase(scene, name.str(), 16, frames, SKIN_LINEAR, interps[n]));
+				}
+				//A crowd in 8 groups, with and without the pose cache
+				for(int cached = 0; cached < 2; ++cached){
+					std::ostringstream name;
+					name << "synthetic/b" << boneCounts[b] << "/k" << keyCounts[k]
+						 << "/i128/lbs/crowd8" << (cached ? "" : "/nocache");
+					scene.setPoseCache(cached != 0);
+					results.push_back(runCase(scene, name.str(), 128, frames, SKIN_LINEAR, INTERPOLATE_SLERP, 8));
+				}
+				scene.setPoseCache(true);
+				//Animation LOD: past 32 units every 4th frame, and only
+				//two levels below the rig's root
+				AnimLOD lods[] = { { 0.0f, 1, -1 }, { 32.0f, 4, 2 } };
+				scene.setAnimationLODs(std::vector<AnimLOD>(lods, lods + 2));
+				{
+					std::ostringstream name;
+					name << "synthetic/b" << boneCounts[b] << "/k" << keyCounts[k] << "/i128/lbs/lod4";
+					results.push_back(runCase(scene, name.str(), 128, frames, SKIN_LINEAR, INTERPOLATE_SLERP));
+				}
+				//Every instance on an interval, level 0 included, so
+				//nothing is ever moved by updateLOD()
+				AnimLOD coarse = { 0.0f, 4, -1 };
+				scene.setAnimationLODs(std::vector<AnimLOD>(1, coarse));
+				{
+					std::ostringstream name;
+					name << "synthetic/b" << boneCounts[b] << "/k" << keyCounts[k] << "/i128/lbs/lod4all";
+					results.push_back(runCase(scene, name.str(), 128, frames, SKIN_LINEAR, INTERPOLATE_SLERP));
+				}
+				scene.setAnimationLODs(std::vector<AnimLOD>());
+			}
+			delete rig;
+		}
+
+	//One wide hierarchy, recursive and level by level on all cores
+	{
+		aiScene* rig = createSyntheticRig(8192, 8, 30);
+		{
+			Scene scene(rig, false);
+			for(int parallel = 0; parallel < 2; ++parallel){
+				std::ostringstream name;
+				name << "synthetic/b8192/k8/i1/lbs/" << (parallel ? "levels" : "recursive");
+				scene.setParallelThreshold(parallel ? 0 : ~0u);
+				results.push_back(runCase(scene, name.str(), 1, frames, SKIN_LINEAR, INTERPOLATE_SLERP));
+			}
+		}
+		delete rig;
+	}
+
+	std::ostringstream json;
+	json << "[\n";
+	for(size_t i = 0; i < results.size(); ++i)
+		json << toJSON(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+	json << "]\n";
+	if(jsonPath.empty()){
+		printf("%s", json.str().c_str());
+	} else {
+		std::ofstream strm(jsonPath.c_str());
+		strm << json.str();
+	}
+
+	//The batch slerp has to match the per-channel path. Nlerp error is
+	//bounded per rotation, but adds up along the hierarchy, so it's only
+	//reported
+	int mismatches = 0;
+	for(size_t i = 0; i < results.size(); ++i){
+		bool nlerp = results[i].name.find("/nlerp") != std::string::npos;
+		//Blended poses lag the exact ones, the lod4all reference included
+		bool blended = results[i].name.find("/lod4all") != std::string::npos;
+		if(nlerp || blended || results[i].maxError <= 1e-3) continue;
+		fprintf(stderr, "MISMATCH %s: %g from the per-channel interpolation\n",
+				results[i].name.c_str(), results[i].maxError);
+		++mismatches;
+	}
+	//Static meshes are drawn at their node, not at the model origin
+	double staticError = staticMeshError();
+	if(staticError > 1e-4){
+		fprintf(stderr, "MISMATCH static mesh: %g from its node's position\n", staticError);
+		++mismatches;
+	}
+	if(mismatches) return 1;
+
+	if(checkAllocs > 0){
+		int failures = 0;
+		for(size_t i = 0; i < results.size(); ++i){
+			if(results[i].allocsPerFrame <= 0.0) continue;
+			fprintf(stderr, "ALLOCATES %s: %.2f allocations per frame\n",
+					results[i].name.c_str(), results[i].allocsPerFrame);
+			++failures;
+		}
+		fprintf(stderr, "%d case(s) allocating in %d steady-state frames\n", failures, checkAllocs);
+		if(failures) return 1;
+	}
+
+	if(baselinePath.empty())
+		return 0;
+	std::map<std::string, double> baseline = readBaseline(baselinePath);
+	int regressions = 0;
+	for(size_t i = 0; i < results.size(); ++i){
+		std::map<std::string, double>::const_iterator it = baseline.find(results[i].name);
+		if(it == baseline.end() || it->second <= 0.0) continue;
+		double ratio = results[i].stepNsPerBone / it->second;
+		if(ratio > 1.0 + tolerance){
+			fprintf(stderr, "REGRESSION %s: %.2f ns/bone, baseline %.2f (%+.1f%%)\n",
+					results[i].name.c_str(), results[i].stepNsPerBone, it->second, (ratio - 1.0) * 100.0);
+			++regressions;
+		}
+	}
+	fprintf(stderr, "%d regression(s) against %s\n", regressions, baselinePath.c_str());
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+/* Import benchmark for MappedFileIO (assimp_wrapper/mapped_io.h).
+
+   Imports each model with Assimp's default stdio reader and through
+   MappedFileIO, and prints the best load time and the peak resident
+   set size of each. Every import runs in a child process of its own, so
+   the peaks don't hide each other:
+
+     bench_import [--iterations N] [--profile default|fastload|fastrender] [model ...]
+
+   Without models, the .dae files in data/ are used. POSIX systems
+   only. */
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../assimp_wrapper/import_profile.h"
+#include "../assimp_wrapper/mapped_io.h"
+
+static double nowMs()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static std::vector<std::string> findModels(const std::string& dir)
+{
+	std::vector<std::string> files;
+	DIR* d = opendir(dir.c_str());
+	if(!d) return files;
+	while(dirent* e = readdir(d)){
+		std::string name(e->d_name);
+		if(name.size() > 4 && name.compare(name.size() - 4, 4, ".dae") == 0)
+			files.push_back(dir + "/" + name);
+	}
+	closedir(d);
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+struct ImportResult
+{
+	double ms;       //-1 if the import failed
+	long peakKB;     //peak resident set size of the child
+};
+
+//Import 'path' in a child process, mapped or through stdio
+static ImportResult runImport(const std::string& path, ImportPreset preset, bool mapped)
+{
+	ImportResult result = { -1.0, 0 };
+	int fds[2];
+	if(pipe(fds) != 0) return result;
+	pid_t pid = fork();
+	if(pid < 0){
+		close(fds[0]);
+		close(fds[1]);
+		return result;
+	}
+	if(pid == 0){
+		close(fds[0]);
+		ImportProfile profile(preset);
+		MappedFileIO io;
+		double start = nowMs();
+		const aiScene* scene = profile.import(path, mapped ? io.get() : 0);
+		double ms = scene ? nowMs() - start : -1.0;
+		aiReleaseImport(scene);
+		ssize_t written = write(fds[1], &ms, sizeof(ms));
+		_exit(written == sizeof(ms) ? 0 : 1);
+	}
+	close(fds[1]);
+	double ms;
+	if(read(fds[0], &ms, sizeof(ms)) == sizeof(ms))
+		result.ms = ms;
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	if(wait4(pid, &status, 0, &usage) == pid)
+		result.peakKB = usage.ru_maxrss;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	int iterations = 3;
+	ImportPreset preset = IMPORT_DEFAULT;
+	std::vector<std::string> models;
+	for(int i = 1; i < argc; ++i){
+		std::string arg(argv[i]);
+		if(arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+		else if(arg == "--profile" && i + 1 < argc && ImportProfile::parsePreset(argv[i + 1], preset)) ++i;
+		else if(arg.compare(0, 2, "--") != 0) models.push_back(arg);
+		else {
+			printf("Usage: %s [--iterations N] [--profile default|fastload|fastrender] [model ...]\n", argv[0]);
+			return 0;
+		}
+	}
+	if(models.empty())
+		models = findModels("data");
+
+	printf("%-40s %12s %12s %12s %12s\n", "model", "stdio ms", "mmap ms", "stdio KB", "mmap KB");
+	for(size_t m = 0; m < models.size(); ++m){
+		ImportResult best[2] = { { -1.0, 0 }, { -1.0, 0 } };
+		for(int i = 0; i < iterations; ++i)
+			for(int mapped = 0; mapped < 2; ++mapped){
+				ImportResult r = runImport(models[m], preset, mapped);
+				if(r.ms < 0.0) continue;
+				if(best[mapped].ms < 0.0 || r.ms < best[mapped].ms)
+					best[mapped].ms = r.ms;
+				best[mapped].peakKB = std::max(best[mapped].peakKB, r.peakKB);
+			}
+		if(best[0].ms < 0.0 || best[1].ms < 0.0){
+			fprintf(stderr, "Couldn't load %s\n", models[m].c_str());
+			continue;
+		}
+		printf("%-40s %12.2f %12.2f %12ld %12ld\n", models[m].c_str(),
+			   best[0].ms, best[1].ms, best[0].peakKB, best[1].peakKB);
+	}
+	return 0;
+}
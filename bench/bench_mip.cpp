@@ -0,0 +1,96 @@
+/* Benchmark for the CPU mip chain builder in assimp_wrapper/mipmap.h.
+
+   Builds the chain of a noisy RGBA image with the scalar reference, with
+   every kernel set the CPU supports on one thread, and with the best
+   one on the shared thread pool:
+
+     bench_mip [--size N] [--iterations N] [--linear]
+
+   Exits with an error if a kernel is off by more than 1 from the
+   reference anywhere in the chain. */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "../assimp_wrapper/mipmap.h"
+#include "../assimp_wrapper/threadpool.h"
+
+static double nowMs()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static int maxDifference(const MipChain& a, const MipChain& b)
+{
+	if(a.data.size() != b.data.size()) return 256;
+	int diff = 0;
+	for(size_t i = 0; i < a.data.size(); ++i)
+		diff = std::max(diff, std::abs((int)a.data[i] - (int)b.data[i]));
+	return diff;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int size = 2048;
+	int iterations = 5;
+	bool srgb = true;
+	for(int i = 1; i < argc; ++i){
+		std::string arg(argv[i]);
+		if(arg == "--size" && i + 1 < argc) size = std::atoi(argv[++i]);
+		else if(arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+		else if(arg == "--linear") srgb = false;
+		else {
+			printf("Usage: %s [--size N] [--iterations N] [--linear]\n", argv[0]);
+			return 0;
+		}
+	}
+
+	//Odd width, so the dropped columns are covered too
+	unsigned int width = size + 1, height = size;
+	std::vector<unsigned char> image((size_t)width * height * 4);
+	unsigned int seed = 12345;
+	for(size_t i = 0; i < image.size(); ++i){
+		seed = seed * 1664525u + 1013904223u;
+		image[i] = seed >> 24;
+	}
+
+	MipChain reference;
+	double start = nowMs();
+	buildMipChainReference(&image[0], width, height, reference, srgb);
+	double referenceMs = nowMs() - start;
+	printf("%ux%u %s, %zu levels\n", width, height, srgb ? "sRGB" : "linear", reference.levels.size());
+	printf("%-16s %10s %10s\n", "kernel", "ms", "speedup");
+	printf("%-16s %10.2f %10.2f\n", "reference", referenceMs, 1.0);
+
+	static const char* names[] = { "scalar", "sse", "avx" };
+	int failures = 0;
+	MipChain chain;
+	for(int pass = 0; pass < 2; ++pass){
+		ThreadPool* pool = pass ? &ThreadPool::shared() : 0;
+		int first = pass ? detectSimdLevel() : SIMD_SCALAR;
+		for(int level = first; level <= detectSimdLevel(); ++level){
+			//The first run sizes the chain
+			buildMipChain(&image[0], width, height, chain, srgb, pool, (SimdLevel)level);
+			start = nowMs();
+			for(int it = 0; it < iterations; ++it)
+				buildMipChain(&image[0], width, height, chain, srgb, pool, (SimdLevel)level);
+			double ms = (nowMs() - start) / iterations;
+			std::string name = names[level];
+			if(pool){
+				char threads[32];
+				snprintf(threads, sizeof(threads), " x%u threads", pool->size());
+				name += threads;
+			}
+			printf("%-16s %10.2f %10.2f\n", name.c_str(), ms, referenceMs / ms);
+			int diff = maxDifference(chain, reference);
+			if(diff > 1){
+				fprintf(stderr, "MISMATCH %s: off by %d from the reference\n", name.c_str(), diff);
+				++failures;
+			}
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/* Microbenchmark for the matrix kernels in include/matrix4_simd.h.
+
+   Times 4x4 matrix products and batch vector transforms for every
+   kernel set the CPU supports, next to the equivalent aiMatrix4x4 code,
+   and checks each kernel against the scalar reference:
+
+     bench_simd [--iterations N] [--count N]
+
+   Exits with an error if a kernel disagrees with the scalar one. */
+#include <assimp/types.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "../include/linealg.h"
+
+static double nowNs()
+{
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+//Keeps the compiler from dropping the benchmarked work
+static volatile float g_Sink;
+
+static float maxError(const float* a, const float* b, size_t n)
+{
+	float err = 0.0f;
+	for(size_t i = 0; i < n; ++i)
+		err = std::max(err, std::fabs(a[i] - b[i]));
+	return err;
+}
+
+/* Chain of products, so each one depends on the last, like a node
+   hierarchy. Returns ns per product */
+static double timeMul(const Matrix4Kernels& k, const std::vector<float>& mats, int iterations, float* result)
+{
+	size_t numMats = mats.size() / 16;
+	float acc[16];
+	for(int i = 0; i < 16; ++i) acc[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	double start = nowNs();
+	for(int it = 0; it < iterations; ++it)
+		k.mul(acc, acc, &mats[(it % numMats) * 16]);
+	double ns = (nowNs() - start) / iterations;
+	for(int i = 0; i < 16; ++i) result[i] = acc[i];
+	g_Sink = acc[0];
+	return ns;
+}
+
+static double timeMulAssimp(const std::vector<float>& mats, int iterations, float* result)
+{
+	size_t numMats = mats.size() / 16;
+	std::vector<aiMatrix4x4> m(numMats);
+	for(size_t n = 0; n < numMats; ++n)
+		for(int i = 0; i < 16; ++i)
+			m[n][i / 4][i % 4] = mats[n * 16 + i];
+	aiMatrix4x4 acc;
+	double start = nowNs();
+	for(int it = 0; it < iterations; ++it)
+		acc = acc * m[it % numMats];
+	double ns = (nowNs() - start) / iterations;
+	for(int i = 0; i < 16; ++i) result[i] = acc[i / 4][i % 4];
+	g_Sink = acc.a1;
+	return ns;
+}
+
+/* Returns ns per vector */
+static double timeTransform(const Matrix4Kernels& k, int components, const float* mat,
+							const std::vector<float>& src, std::vector<float>& dst, int iterations)
+{
+	size_t count = src.size() / components;
+	double start = nowNs();
+	for(int it = 0; it < iterations; ++it){
+		if(components == 3)
+			k.transform3(&dst[0], &src[0], count, mat);
+		else
+			k.transform4(&dst[0], &src[0], count, mat);
+	}
+	double ns = (nowNs() - start) / iterations / count;
+	g_Sink = dst[0];
+	return ns;
+}
+
+static double timeTransformAssimp(const float* mat, const std::vector<float>& src, std::vector<float>& dst, int iterations)
+{
+	aiMatrix4x4 m;
+	for(int i = 0; i < 16; ++i)
+		m[i / 4][i % 4] = mat[i];
+	size_t count = src.size() / 3;
+	const aiVector3D* in = (const aiVector3D*)&src[0];
+	aiVector3D* out = (aiVector3D*)&dst[0];
+	double start = nowNs();
+	for(int it = 0; it < iterations; ++it)
+		for(size_t n = 0; n < count; ++n)
+			out[n] = m * in[n];
+	double ns = (nowNs() - start) / iterations / count;
+	g_Sink = dst[0];
+	return ns;
+}
+
+int main(int argc, char* argv[])
+{
+	int iterations = 1000000;
+	int count = 4096;
+	for(int i = 1; i < argc; ++i){
+		std::string arg(argv[i]);
+		if(arg == "--iterations" && i + 1 < argc) iterations = std::atoi(argv[++i]);
+		else if(arg == "--count" && i + 1 < argc) count = std::atoi(argv[++i]);
+		else {
+			printf("Usage: %s [--iterations N] [--count N]\n", argv[0]);
+			return 0;
+		}
+	}
+
+	//Rotations with a little scale, so long product chains stay finite
+	std::vector<float> mats(64 * 16);
+	for(int n = 0; n < 64; ++n){
+		float a = n * 0.1f, c = std::cos(a) * 0.999f, s = std::sin(a) * 0.999f;
+		float m[16] = { c, -s, 0.0f, n * 0.01f,
+						s,  c, 0.0f, 0.0f,
+						0.0f, 0.0f, 1.0f, -n * 0.01f,
+						0.0f, 0.0f, 0.0f, 1.0f };
+		std::copy(m, m + 16, &mats[n * 16]);
+	}
+	std::vector<float> src3(count * 3), src4(count * 4), dst3(count * 3), dst4(count * 4);
+	for(int i = 0; i < count * 3; ++i) src3[i] = (i % 17) * 0.25f - 2.0f;
+	for(int i = 0; i < count * 4; ++i) src4[i] = (i % 13) * 0.5f - 3.0f;
+	int vecIterations = std::max(1, iterations / count);
+
+	printf("Detected: %s\n", matrix4Kernels().name);
+	printf("%-8s %12s %14s %14s\n", "kernel", "mul ns", "vec3 ns/vec", "vec4 ns/vec");
+
+	//Scalar results are the reference for the others
+	const Matrix4Kernels& scalar = getMatrix4Kernels(SIMD_SCALAR);
+	float refMul[16];
+	std::vector<float> ref3(count * 3), ref4(count * 4);
+	timeMul(scalar, mats, 1000, refMul);
+	scalar.transform3(&ref3[0], &src3[0], count, &mats[16]);
+	scalar.transform4(&ref4[0], &src4[0], count, &mats[16]);
+
+	int failures = 0;
+	for(int level = SIMD_SCALAR; level <= detectSimdLevel(); ++level){
+		const Matrix4Kernels& k = getMatrix4Kernels((SimdLevel)level);
+		float mul[16];
+		double mulNs = timeMul(k, mats, iterations, mul);
+		double vec3Ns = timeTransform(k, 3, &mats[16], src3, dst3, vecIterations);
+		double vec4Ns = timeTransform(k, 4, &mats[16], src4, dst4, vecIterations);
+		printf("%-8s %12.2f %14.3f %14.3f\n", k.name, mulNs, vec3Ns, vec4Ns);
+
+		timeMul(k, mats, 1000, mul);
+		float err = maxError(mul, refMul, 16);
+		err = std::max(err, maxError(&dst3[0], &ref3[0], dst3.size()));
+		err = std::max(err, maxError(&dst4[0], &ref4[0], dst4.size()));
+		if(err > 1e-4f){
+			fprintf(stderr, "MISMATCH %s: max error %g against scalar\n", k.name, err);
+			++failures;
+		}
+	}
+
+	float mul[16];
+	double mulNs = timeMulAssimp(mats, iterations, mul);
+	double vec3Ns = timeTransformAssimp(&mats[16], src3, dst3, vecIterations);
+	printf("%-8s %12.2f %14.3f %14s\n", "assimp", mulNs, vec3Ns, "-");
+
+	return failures ? 1 : 0;
+}
@@ -4,43 +4,87 @@
 #define MAX_BONES_PER_VERTEX 4
 #define MAX_BONES_PER_MESH 32
 
+//Attributes the mesh has, see AttribSignature::defines(). By default
+//all of them are declared. NUM_INFLUENCES is the number of bones used
+//per vertex, defined by createSkinningPrograms() for each influence
+//range of a mesh. 0 means no skinning at all
+#ifndef HAS_NORMALS
+#define HAS_NORMALS 1
+#endif
+#ifndef HAS_TANGENTS
+#define HAS_TANGENTS 1
+#endif
+#ifndef NUM_UVMAPS
+#define NUM_UVMAPS 4
+#endif
+#ifndef NUM_INFLUENCES
+#define NUM_INFLUENCES MAX_BONES_PER_VERTEX
+#endif
+
 uniform mat4 projection;
 uniform mat4 sc_modelview;
+uniform mat4 sc_world;
 uniform mat4 sc_camera;
 uniform mat4 sc_bones[MAX_BONES_PER_MESH];
 
 in vec3 sc_vertex;
+#if HAS_NORMALS
 in vec3 sc_normal;
+#endif
+#if HAS_TANGENTS
 in vec3 sc_tangent;
 in vec3 sc_bitangent;
+#endif
+#if NUM_UVMAPS > 0
 in vec3 sc_tcoord0;
+#endif
+#if NUM_UVMAPS > 1
 in vec3 sc_tcoord1;
+#endif
+#if NUM_UVMAPS > 2
 in vec3 sc_tcoord2;
+#endif
+#if NUM_UVMAPS > 3
 in vec3 sc_tcoord3;
+#endif
+#if NUM_INFLUENCES > 0
 in uvec4 sc_index;
 in vec4 sc_weight; 
+#endif
 
 out vec2 tcoord;
 
 vec4 animateBone(vec4 p)
 {
+#if NUM_INFLUENCES == 0
+  //Static meshes follow their node instead of bones
+  return sc_modelview * p;
+#else
   vec4 vOut;
 
-  uint idx[4] = uint[4](sc_index.x, sc_index.y, sc_index.z, sc_index.w);
-  float weight[4] = float[4](sc_weight.x, sc_weight.y, sc_weight.z, sc_weight.w);
-
-  vOut  = (sc_bones[idx[0]] * p) * weight[0];
-  vOut += (sc_bones[idx[1]] * p) * weight[1];
-  vOut += (sc_bones[idx[2]] * p) * weight[2];
-  vOut += (sc_bones[idx[3]] * p) * weight[3];
+  vOut  = (sc_bones[sc_index.x] * p) * sc_weight.x;
+#if NUM_INFLUENCES > 1
+  vOut += (sc_bones[sc_index.y] * p) * sc_weight.y;
+#endif
+#if NUM_INFLUENCES > 2
+  vOut += (sc_bones[sc_index.z] * p) * sc_weight.z;
+#endif
+#if NUM_INFLUENCES > 3
+  vOut += (sc_bones[sc_index.w] * p) * sc_weight.w;
+#endif
   return vOut;
+#endif
 }
 
 void main()
 {
+#if NUM_UVMAPS > 0
   tcoord = sc_tcoord0.xy;
+#else
+  tcoord = vec2(0.0);
+#endif
   vec4 v = animateBone(vec4(sc_vertex, 1.0));
-  gl_Position = projection * sc_camera * v;
+  gl_Position = projection * sc_camera * sc_world * v;
   //vec4 v = vec4(sc_vertex, 1.0);
   //gl_Position = projection * sc_camera * v;
 }
@@ -0,0 +1,99 @@
+#version 130
+//#version 330
+
+#define MAX_BONES_PER_VERTEX 4
+#define MAX_BONES_PER_MESH 32
+
+//Attributes the mesh has and bones used per vertex, see shader.vs
+#ifndef HAS_NORMALS
+#define HAS_NORMALS 1
+#endif
+#ifndef HAS_TANGENTS
+#define HAS_TANGENTS 1
+#endif
+#ifndef NUM_UVMAPS
+#define NUM_UVMAPS 4
+#endif
+#ifndef NUM_INFLUENCES
+#define NUM_INFLUENCES MAX_BONES_PER_VERTEX
+#endif
+
+uniform mat4 projection;
+uniform mat4 sc_modelview;
+uniform mat4 sc_world;
+uniform mat4 sc_camera;
+//Two vec4s per bone. [2*i] is the real part, [2*i+1] the dual part
+uniform vec4 sc_dqbones[MAX_BONES_PER_MESH * 2];
+
+in vec3 sc_vertex;
+#if HAS_NORMALS
+in vec3 sc_normal;
+#endif
+#if HAS_TANGENTS
+in vec3 sc_tangent;
+in vec3 sc_bitangent;
+#endif
+#if NUM_UVMAPS > 0
+in vec3 sc_tcoord0;
+#endif
+#if NUM_UVMAPS > 1
+in vec3 sc_tcoord1;
+#endif
+#if NUM_UVMAPS > 2
+in vec3 sc_tcoord2;
+#endif
+#if NUM_UVMAPS > 3
+in vec3 sc_tcoord3;
+#endif
+#if NUM_INFLUENCES > 0
+in uvec4 sc_index;
+in vec4 sc_weight; 
+#endif
+
+out vec2 tcoord;
+
+vec4 animateBone(vec4 p)
+{
+#if NUM_INFLUENCES == 0
+  //Static meshes follow their node instead of bones
+  return sc_modelview * p;
+#else
+  uint idx[4] = uint[4](sc_index.x, sc_index.y, sc_index.z, sc_index.w);
+  float weight[4] = float[4](sc_weight.x, sc_weight.y, sc_weight.z, sc_weight.w);
+
+  //Dual quaternion linear blending. q and -q are the same rotation,
+  //so flip bones that lie in the other hemisphere than the first one
+  vec4 r0 = sc_dqbones[idx[0] * 2u];
+  vec4 real = vec4(0.0);
+  vec4 dual = vec4(0.0);
+  for(int i = 0; i < NUM_INFLUENCES; ++i){
+    vec4 r = sc_dqbones[idx[i] * 2u];
+    vec4 d = sc_dqbones[idx[i] * 2u + 1u];
+    float w = weight[i];
+    if(dot(r0, r) < 0.0)
+      w = -w;
+    real += r * w;
+    dual += d * w;
+  }
+
+  float len = length(real);
+  real /= len;
+  dual /= len;
+
+  //rotate, then translate by t = 2 * dual * conjugate(real)
+  vec3 v = p.xyz + 2.0 * cross(real.xyz, cross(real.xyz, p.xyz) + real.w * p.xyz);
+  vec3 t = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+  return vec4(v + t, 1.0);
+#endif
+}
+
+void main()
+{
+#if NUM_UVMAPS > 0
+  tcoord = sc_tcoord0.xy;
+#else
+  tcoord = vec2(0.0);
+#endif
+  vec4 v = animateBone(vec4(sc_vertex, 1.0));
+  gl_Position = projection * sc_camera * sc_world * v;
+}
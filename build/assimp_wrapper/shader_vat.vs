@@ -0,0 +1,51 @@
+#version 130
+//#version 330
+
+//Plays back a clip baked by bakeVAT(), see vat.h. Needs no bones:
+//every vertex reads its position from sc_vat by gl_VertexID
+
+uniform mat4 projection;
+uniform mat4 sc_camera;
+uniform sampler2D sc_vat;
+uniform vec4 sc_vatLayout;     //width, rows per frame, frames, frames per second
+uniform vec4 sc_vatBoundsMin;  //xyz
+uniform vec4 sc_vatBoundsSize; //xyz
+uniform vec4 sc_vatTime;       //x: seconds
+
+in vec3 sc_tcoord0;
+//Per instance, see VATInstance: the rows of the world matrix, then the
+//time offset and playback speed
+in vec4 sc_world0;
+in vec4 sc_world1;
+in vec4 sc_world2;
+in vec4 sc_world3;
+in vec2 sc_playback;
+
+out vec2 tcoord;
+out vec3 normal;
+
+//block 0 holds positions, block 1 normals
+vec3 fetchVAT(int frame, int block)
+{
+  int width = int(sc_vatLayout.x);
+  int rows = int(sc_vatLayout.y);
+  ivec2 texel = ivec2(gl_VertexID % width, (frame * 2 + block) * rows + gl_VertexID / width);
+  return texelFetch(sc_vat, texel, 0).xyz;
+}
+
+void main()
+{
+  tcoord = sc_tcoord0.xy;
+
+  //Loop the clip, blending between the two nearest frames
+  float frames = sc_vatLayout.z;
+  float f = mod((sc_vatTime.x * sc_playback.y + sc_playback.x) * sc_vatLayout.w, frames);
+  int f0 = int(f);
+  int f1 = (f0 + 1) % int(frames);
+  float t = fract(f);
+
+  vec3 p = mix(fetchVAT(f0, 0), fetchVAT(f1, 0), t) * sc_vatBoundsSize.xyz + sc_vatBoundsMin.xyz;
+  mat4 world = transpose(mat4(sc_world0, sc_world1, sc_world2, sc_world3));
+  normal = normalize(mat3(world) * mix(fetchVAT(f0, 1), fetchVAT(f1, 1), t));
+  gl_Position = projection * sc_camera * world * vec4(p, 1.0);
+}
@@ -2,6 +2,7 @@
 #define LINEALG_H_GUARD
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
 #include "vector2.h"
 #include "vector3.h"
 #include "vector4.h"
@@ -271,17 +272,7 @@ inline Vector4f project(const Vector4f& v, float width, float height)
 
 inline void Mat4Mat4Mul(MatrixPOD4f& dst, const MatrixPOD4f& m0, const MatrixPOD4f& m1)
 {
-	MatrixPOD4f tmp;
-	memset(tmp, 0, sizeof(float) * 16);
-	for(int i=0; i<4; ++i) {
-		for(int j=0; j<4; ++j) {
-			//tmp[j+i*4] = 0;
-			for(int k=0; k<4; ++k) {
-				tmp[j+i*4] += m0[k + i*4]*m1[j + k*4];
-			}
-		}
-	}
-	memcpy(dst, tmp, sizeof(float) * 16);
+	matrix4Kernels().mul(dst, m0, m1);
 }
 
 template<class T>
@@ -325,6 +316,18 @@ VectorPOD3<T> Mat3Vec4Mul(const MatrixPOD3f& mat, const VectorPOD4<T>& v)
 	return r;
 }
 
+/* Batch versions of Mat4Vec3Mul and Mat4Vec4Mul for float. dst and src
+   may be the same array */
+inline void Mat4Vec3MulBatch(const MatrixPOD4f& mat, const VectorPOD3f* src, VectorPOD3f* dst, size_t count)
+{
+	matrix4Kernels().transform3(&dst->x, &src->x, count, mat);
+}
+
+inline void Mat4Vec4MulBatch(const MatrixPOD4f& mat, const VectorPOD4f* src, VectorPOD4f* dst, size_t count)
+{
+	matrix4Kernels().transform4(&dst->x, &src->x, count, mat);
+}
+
 template<class T> T distance(const VectorPOD3<T>& v1, const VectorPOD3<T>& v2)
 {
 	VectorPOD3<T> tmp;
@@ -516,18 +519,13 @@ inline VectorPOD4f project(const VectorPOD4f& v, float width, float height)
 
 
 /***********************************************************************
- ************** Assembly optimizations (Currently for x86)**************
+ ************** Rounding and fixed point helpers ***********************
  ********************************************************************* */
+/* Round to nearest in the current rounding mode, like the old x87
+   fistp. Compiles to cvtss2si on SSE targets */
 inline int iround(float f)
 {
-	int r;
-
-	asm volatile ("fistpl %[output]\n"
-	              : [output] "=m" (r)
-	              : [input] "t" (f)
-	              : "st(0)");
-
-	return r;
+	return (int)lrintf(f);
 }
 
 inline int fpceil15(int fp)
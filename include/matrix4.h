@@ -2,6 +2,7 @@
 #define MATRIX4_H_GUARD
 #include <algorithm>
 #include "vector4.h"
+#include "matrix4_simd.h"
 
 template<class T> struct Matrix4 {
 	T m[16];
@@ -58,4 +59,11 @@ template<class T> struct Matrix4 {
 	}
 };
 
+template<>
+inline Matrix4<float> Matrix4<float>::operator*(const Matrix4<float>& mat) const {
+	Matrix4<float> result;
+	matrix4Kernels().mul(result.m, m, mat.m);
+	return result;
+}
+
 #endif
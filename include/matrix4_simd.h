@@ -0,0 +1,226 @@
+#ifndef MATRIX4_SIMD_H_GUARD
+#define MATRIX4_SIMD_H_GUARD
+#include <cstddef>
+
+/* SSE/AVX kernels for 4x4 float matrices, with a scalar fallback.
+
+   Matrices are 16 floats, and multiply as in Mat4Mat4Mul():
+   dst[j+i*4] = sum(a[k+i*4] * b[j+k*4]). Vectors are transformed as in
+   Mat4Vec4Mul() and Mat4Vec3Mul() (w = 1, no divide). Arrays of vectors
+   are tightly packed, 3 or 4 floats each, and need no alignment.
+
+   The best kernel set for the running CPU is picked on first use, see
+   matrix4Kernels(). dst may alias a or b in mul. */
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define MATRIX4_SIMD_X86
+#include <immintrin.h>
+#endif
+
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE,
+	SIMD_AVX
+};
+
+struct Matrix4Kernels
+{
+	SimdLevel level;
+	const char* name;
+	void (*mul)(float* dst, const float* a, const float* b);
+	void (*transform3)(float* dst, const float* src, size_t count, const float* mat);
+	void (*transform4)(float* dst, const float* src, size_t count, const float* mat);
+};
+
+/****************************************************************************************
+ *************************************** Scalar *****************************************
+ ****************************************************************************************/
+inline void mat4MulScalar(float* dst, const float* a, const float* b)
+{
+	float tmp[16];
+	float* r = (dst == a || dst == b) ? tmp : dst;
+	for(int i=0; i<4; ++i) {
+		for(int j=0; j<4; ++j) {
+			r[j+i*4] = a[i*4]*b[j] + a[1+i*4]*b[j+4] + a[2+i*4]*b[j+8] + a[3+i*4]*b[j+12];
+		}
+	}
+	if(r == tmp)
+		for(int i=0; i<16; ++i) dst[i] = tmp[i];
+}
+
+inline void mat4Transform3Scalar(float* dst, const float* src, size_t count, const float* mat)
+{
+	for(size_t n=0; n<count; ++n, src+=3, dst+=3) {
+		float x = src[0], y = src[1], z = src[2];
+		dst[0] = x*mat[ 0] + y*mat[ 1] + z*mat[ 2] + mat[ 3];
+		dst[1] = x*mat[ 4] + y*mat[ 5] + z*mat[ 6] + mat[ 7];
+		dst[2] = x*mat[ 8] + y*mat[ 9] + z*mat[10] + mat[11];
+	}
+}
+
+inline void mat4Transform4Scalar(float* dst, const float* src, size_t count, const float* mat)
+{
+	for(size_t n=0; n<count; ++n, src+=4, dst+=4) {
+		float x = src[0], y = src[1], z = src[2], w = src[3];
+		dst[0] = x*mat[ 0] + y*mat[ 1] + z*mat[ 2] + w*mat[ 3];
+		dst[1] = x*mat[ 4] + y*mat[ 5] + z*mat[ 6] + w*mat[ 7];
+		dst[2] = x*mat[ 8] + y*mat[ 9] + z*mat[10] + w*mat[11];
+		dst[3] = x*mat[12] + y*mat[13] + z*mat[14] + w*mat[15];
+	}
+}
+
+#ifdef MATRIX4_SIMD_X86
+/****************************************************************************************
+ **************************************** SSE *******************************************
+ ****************************************************************************************/
+/* Row i of the product is a linear combination of the rows of b */
+__attribute__((target("sse2")))
+inline void mat4MulSSE(float* dst, const float* a, const float* b)
+{
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b+4);
+	__m128 b2 = _mm_loadu_ps(b+8);
+	__m128 b3 = _mm_loadu_ps(b+12);
+	for(int i=0; i<4; ++i) {
+		__m128 r = _mm_mul_ps(_mm_set1_ps(a[i*4]), b0);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[1+i*4]), b1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[2+i*4]), b2));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[3+i*4]), b3));
+		_mm_storeu_ps(dst+i*4, r);
+	}
+}
+
+/* Columns of 'mat', so a transform is a linear combination of them */
+__attribute__((target("sse2")))
+inline void mat4ColumnsSSE(const float* mat, __m128* c)
+{
+	c[0] = _mm_loadu_ps(mat);
+	c[1] = _mm_loadu_ps(mat+4);
+	c[2] = _mm_loadu_ps(mat+8);
+	c[3] = _mm_loadu_ps(mat+12);
+	_MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+}
+
+__attribute__((target("sse2")))
+inline void mat4Transform3SSE(float* dst, const float* src, size_t count, const float* mat)
+{
+	__m128 c[4];
+	mat4ColumnsSSE(mat, c);
+	for(size_t n=0; n<count; ++n, src+=3, dst+=3) {
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(src[0]), c[0]), c[3]);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(src[1]), c[1]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(src[2]), c[2]));
+		//Store 3 floats, dst may be the end of an array
+		_mm_storel_pi((__m64*)dst, r);
+		_mm_store_ss(dst+2, _mm_movehl_ps(r, r));
+	}
+}
+
+__attribute__((target("sse2")))
+inline void mat4Transform4SSE(float* dst, const float* src, size_t count, const float* mat)
+{
+	__m128 c[4];
+	mat4ColumnsSSE(mat, c);
+	for(size_t n=0; n<count; ++n, src+=4, dst+=4) {
+		__m128 v = _mm_loadu_ps(src);
+		__m128 r = _mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), c[0]);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, 0x55), c[1]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xaa), c[2]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xff), c[3]));
+		_mm_storeu_ps(dst, r);
+	}
+}
+
+/****************************************************************************************
+ **************************************** AVX *******************************************
+ ****************************************************************************************/
+/* Two rows of the product per iteration, one in each 128 bit lane */
+__attribute__((target("avx")))
+inline void mat4MulAVX(float* dst, const float* a, const float* b)
+{
+	__m256 b0 = _mm256_broadcast_ps((const __m128*)b);
+	__m256 b1 = _mm256_broadcast_ps((const __m128*)(b+4));
+	__m256 b2 = _mm256_broadcast_ps((const __m128*)(b+8));
+	__m256 b3 = _mm256_broadcast_ps((const __m128*)(b+12));
+	__m256 a01 = _mm256_loadu_ps(a);
+	__m256 a23 = _mm256_loadu_ps(a+8);
+
+	__m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x00), b0);
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x55), b1));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xaa), b2));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xff), b3));
+	__m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x00), b0);
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x55), b1));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xaa), b2));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xff), b3));
+
+	_mm256_storeu_ps(dst, r01);
+	_mm256_storeu_ps(dst+8, r23);
+}
+
+/* Two vectors per iteration. Leftovers go through the SSE kernel */
+__attribute__((target("avx")))
+inline void mat4Transform4AVX(float* dst, const float* src, size_t count, const float* mat)
+{
+	__m128 c[4];
+	mat4ColumnsSSE(mat, c);
+	__m256 c0 = _mm256_insertf128_ps(_mm256_castps128_ps256(c[0]), c[0], 1);
+	__m256 c1 = _mm256_insertf128_ps(_mm256_castps128_ps256(c[1]), c[1], 1);
+	__m256 c2 = _mm256_insertf128_ps(_mm256_castps128_ps256(c[2]), c[2], 1);
+	__m256 c3 = _mm256_insertf128_ps(_mm256_castps128_ps256(c[3]), c[3], 1);
+	size_t n = 0;
+	for(; n+2<=count; n+=2, src+=8, dst+=8) {
+		__m256 v = _mm256_loadu_ps(src);
+		__m256 r = _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0x00), c0);
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0x55), c1));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0xaa), c2));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0xff), c3));
+		_mm256_storeu_ps(dst, r);
+	}
+	mat4Transform4SSE(dst, src, count - n, mat);
+}
+#endif
+
+/****************************************************************************************
+ ************************************** Dispatch ****************************************
+ ****************************************************************************************/
+inline SimdLevel detectSimdLevel()
+{
+#ifdef MATRIX4_SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx")) return SIMD_AVX;
+	if(__builtin_cpu_supports("sse2")) return SIMD_SSE;
+#endif
+	return SIMD_SCALAR;
+}
+
+/* Kernel set for 'level'. Falls back to the next lower level the
+   build supports, but doesn't check the CPU, see matrix4Kernels() */
+inline const Matrix4Kernels& getMatrix4Kernels(SimdLevel level)
+{
+	static const Matrix4Kernels scalar = {
+		SIMD_SCALAR, "scalar", mat4MulScalar, mat4Transform3Scalar, mat4Transform4Scalar
+	};
+#ifdef MATRIX4_SIMD_X86
+	static const Matrix4Kernels sse = {
+		SIMD_SSE, "sse", mat4MulSSE, mat4Transform3SSE, mat4Transform4SSE
+	};
+	//No 3-component AVX kernel, the unaligned stride makes it no faster
+	static const Matrix4Kernels avx = {
+		SIMD_AVX, "avx", mat4MulAVX, mat4Transform3SSE, mat4Transform4AVX
+	};
+	if(level == SIMD_AVX) return avx;
+	if(level == SIMD_SSE) return sse;
+#endif
+	return scalar;
+}
+
+/* Best kernel set for this CPU */
+inline const Matrix4Kernels& matrix4Kernels()
+{
+	static const Matrix4Kernels& kernels = getMatrix4Kernels(detectSimdLevel());
+	return kernels;
+}
+
+#endif
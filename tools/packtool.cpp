@@ -0,0 +1,119 @@
+/* Builds and lists pack files (assimp_wrapper/pack.h).
+
+     packtool [--lz4] [--align N] out.pak file|directory ...
+     packtool --list in.pak
+
+   Directories are added recursively. Every file is named by the path
+   it was given as, so run packtool from the directory the program is
+   run from, e.g. "packtool data.pak data assimp_wrapper" in the build
+   directory. --lz4 compresses the entries it makes smaller (needs
+   HAVE_LZ4). */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../assimp_wrapper/pack.h"
+
+static bool readFile(const std::string& path, std::vector<char>& data)
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if(!fp) return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	bool ok = size >= 0;
+	data.resize(ok ? size : 0);
+	if(ok && size > 0)
+		ok = fread(&data[0], 1, size, fp) == (size_t)size;
+	fclose(fp);
+	return ok;
+}
+
+//Files below 'path', or 'path' itself, sorted so packs are reproducible
+static void findFiles(const std::string& path, std::vector<std::string>& files)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0){
+		fprintf(stderr, "Can't find %s\n", path.c_str());
+		return;
+	}
+	if(!S_ISDIR(st.st_mode)){
+		files.push_back(path);
+		return;
+	}
+	DIR* d = opendir(path.c_str());
+	if(!d) return;
+	std::vector<std::string> names;
+	while(dirent* e = readdir(d)){
+		std::string name(e->d_name);
+		if(name != "." && name != "..")
+			names.push_back(name);
+	}
+	closedir(d);
+	std::sort(names.begin(), names.end());
+	std::string prefix = path[path.size() - 1] == '/' ? path : path + "/";
+	for(size_t i = 0; i < names.size(); ++i)
+		findFiles(prefix + names[i], files);
+}
+
+static int listPack(const std::string& path)
+{
+	PackArchive pack;
+	if(!pack.open(path)) return 1;
+	for(size_t i = 0; i < pack.size(); ++i){
+		const PackEntry* e = pack.entry(i);
+		printf("%12llu %12llu %s %s\n", e->rawSize, e->size,
+			   (e->flags & PACK_LZ4) ? "lz4 " : "    ", pack.name(e).c_str());
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	bool compress = false;
+	unsigned int alignment = 16;
+	std::vector<std::string> args;
+	for(int i = 1; i < argc; ++i){
+		std::string arg(argv[i]);
+		if(arg == "--list" && i + 1 < argc) return listPack(argv[i + 1]);
+		else if(arg == "--lz4") compress = true;
+		else if(arg == "--align" && i + 1 < argc) alignment = std::max(1, std::atoi(argv[++i]));
+		else args.push_back(arg);
+	}
+	if(args.size() < 2){
+		printf("Usage: %s [--lz4] [--align N] out.pak file|directory ...\n"
+			   "       %s --list in.pak\n", argv[0], argv[0]);
+		return 0;
+	}
+#ifndef HAVE_LZ4
+	if(compress)
+		fprintf(stderr, "Built without HAVE_LZ4, storing everything uncompressed\n");
+#endif
+
+	std::vector<std::string> files;
+	for(size_t i = 1; i < args.size(); ++i)
+		findFiles(args[i], files);
+	PackWriter writer(alignment);
+	std::vector<char> data;
+	size_t added = 0;
+	for(size_t i = 0; i < files.size(); ++i){
+		if(!readFile(files[i], data)){
+			fprintf(stderr, "Couldn't read %s\n", files[i].c_str());
+			return 1;
+		}
+		if(writer.add(files[i], data.empty() ? 0 : &data[0], data.size(), compress))
+			++added;
+		else
+			fprintf(stderr, "Skipping %s, already added\n", files[i].c_str());
+	}
+	if(!writer.write(args[0])){
+		fprintf(stderr, "Couldn't write %s\n", args[0].c_str());
+		return 1;
+	}
+	printf("%lu files, %lu bytes, %lu stored\n", (unsigned long)added,
+		   (unsigned long)writer.getRawBytes(), (unsigned long)writer.getStoredBytes());
+	return 0;
+}